@@ -34,6 +34,8 @@ init_tarantool_cfg(tarantool_cfg *c) {
 	c->coredump = false;
 	c->admin_port = 0;
 	c->replication_port = 0;
+	c->replication_sync_quorum = 0;
+	c->replication_sync_timeout = 0;
 	c->log_level = 0;
 	c->slab_alloc_arena = 0;
 	c->slab_alloc_minimal = 0;
@@ -41,6 +43,7 @@ init_tarantool_cfg(tarantool_cfg *c) {
 	c->work_dir = NULL;
 	c->snap_dir = NULL;
 	c->wal_dir = NULL;
+	c->wal_stripe_dirs = NULL;
 	c->script_dir = NULL;
 	c->archive_dir = NULL;
 	c->archive_filename_pattern = NULL;
@@ -52,6 +55,10 @@ init_tarantool_cfg(tarantool_cfg *c) {
 	c->backlog = 0;
 	c->readahead = 0;
 	c->snap_io_rate_limit = 0;
+	c->snap_fork = false;
+	c->snap_compress = false;
+	c->snap_parts = 0;
+	c->deltas_per_snap = 0;
 	c->rows_per_wal = 0;
 	c->wal_writer_inbox_size = 0;
 	c->wal_mode = NULL;
@@ -69,6 +76,8 @@ init_tarantool_cfg(tarantool_cfg *c) {
 	c->memcached_expire_per_loop = 0;
 	c->memcached_expire_full_sweep = 0;
 	c->replication_source = NULL;
+	c->replication_spaces = NULL;
+	c->replication_compress = false;
 	c->space = NULL;
 }
 
@@ -83,6 +92,8 @@ fill_default_tarantool_cfg(tarantool_cfg *c) {
 	c->coredump = false;
 	c->admin_port = 0;
 	c->replication_port = 0;
+	c->replication_sync_quorum = 0;
+	c->replication_sync_timeout = 1;
 	c->log_level = 4;
 	c->slab_alloc_arena = 1;
 	c->slab_alloc_minimal = 64;
@@ -92,6 +103,7 @@ fill_default_tarantool_cfg(tarantool_cfg *c) {
 	if (c->snap_dir == NULL) return CNF_NOMEMORY;
 	c->wal_dir = strdup(".");
 	if (c->wal_dir == NULL) return CNF_NOMEMORY;
+	c->wal_stripe_dirs = NULL;
 	c->script_dir = strdup(".");
 	if (c->script_dir == NULL) return CNF_NOMEMORY;
 	c->archive_dir = NULL;
@@ -106,6 +118,10 @@ fill_default_tarantool_cfg(tarantool_cfg *c) {
 	c->backlog = 1024;
 	c->readahead = 16320;
 	c->snap_io_rate_limit = 0;
+	c->snap_fork = true;
+	c->snap_compress = false;
+	c->snap_parts = 1;
+	c->deltas_per_snap = 0;
 	c->rows_per_wal = 500000;
 	c->wal_writer_inbox_size = 16384;
 	c->wal_mode = strdup("fsync_delay");
@@ -124,6 +140,8 @@ fill_default_tarantool_cfg(tarantool_cfg *c) {
 	c->memcached_expire_per_loop = 1024;
 	c->memcached_expire_full_sweep = 3600;
 	c->replication_source = NULL;
+	c->replication_spaces = NULL;
+	c->replication_compress = false;
 	c->space = NULL;
 	return 0;
 }
@@ -179,6 +197,12 @@ static NameAtom _name__admin_port[] = {
 static NameAtom _name__replication_port[] = {
 	{ "replication_port", -1, NULL }
 };
+static NameAtom _name__replication_sync_quorum[] = {
+	{ "replication_sync_quorum", -1, NULL }
+};
+static NameAtom _name__replication_sync_timeout[] = {
+	{ "replication_sync_timeout", -1, NULL }
+};
 static NameAtom _name__log_level[] = {
 	{ "log_level", -1, NULL }
 };
@@ -200,6 +224,9 @@ static NameAtom _name__snap_dir[] = {
 static NameAtom _name__wal_dir[] = {
 	{ "wal_dir", -1, NULL }
 };
+static NameAtom _name__wal_stripe_dirs[] = {
+	{ "wal_stripe_dirs", -1, NULL }
+};
 static NameAtom _name__script_dir[] = {
 	{ "script_dir", -1, NULL }
 };
@@ -233,6 +260,18 @@ static NameAtom _name__readahead[] = {
 static NameAtom _name__snap_io_rate_limit[] = {
 	{ "snap_io_rate_limit", -1, NULL }
 };
+static NameAtom _name__snap_fork[] = {
+	{ "snap_fork", -1, NULL }
+};
+static NameAtom _name__snap_compress[] = {
+	{ "snap_compress", -1, NULL }
+};
+static NameAtom _name__snap_parts[] = {
+	{ "snap_parts", -1, NULL }
+};
+static NameAtom _name__deltas_per_snap[] = {
+	{ "deltas_per_snap", -1, NULL }
+};
 static NameAtom _name__rows_per_wal[] = {
 	{ "rows_per_wal", -1, NULL }
 };
@@ -284,6 +323,12 @@ static NameAtom _name__memcached_expire_full_sweep[] = {
 static NameAtom _name__replication_source[] = {
 	{ "replication_source", -1, NULL }
 };
+static NameAtom _name__replication_spaces[] = {
+	{ "replication_spaces", -1, NULL }
+};
+static NameAtom _name__replication_compress[] = {
+	{ "replication_compress", -1, NULL }
+};
 static NameAtom _name__space[] = {
 	{ "space", -1, NULL }
 };
@@ -464,6 +509,28 @@ acceptValue(tarantool_cfg* c, OptDef* opt, int check_rdonly) {
 			return CNF_RDONLY;
 		c->replication_port = i32;
 	}
+	else if ( cmpNameAtoms( opt->name, _name__replication_sync_quorum) ) {
+		if (opt->paramType != scalarType )
+			return CNF_WRONGTYPE;
+		c->__confetti_flags &= ~CNF_FLAG_STRUCT_NOTSET;
+		errno = 0;
+		long int i32 = strtol(opt->paramValue.scalarval, NULL, 10);
+		if (i32 == 0 && errno == EINVAL)
+			return CNF_WRONGINT;
+		if ( (i32 == LONG_MIN || i32 == LONG_MAX) && errno == ERANGE)
+			return CNF_WRONGRANGE;
+		c->replication_sync_quorum = i32;
+	}
+	else if ( cmpNameAtoms( opt->name, _name__replication_sync_timeout) ) {
+		if (opt->paramType != scalarType )
+			return CNF_WRONGTYPE;
+		c->__confetti_flags &= ~CNF_FLAG_STRUCT_NOTSET;
+		errno = 0;
+		double dbl = strtod(opt->paramValue.scalarval, NULL);
+		if ( (dbl == 0 || dbl == -HUGE_VAL || dbl == HUGE_VAL) && errno == ERANGE)
+			return CNF_WRONGRANGE;
+		c->replication_sync_timeout = dbl;
+	}
 	else if ( cmpNameAtoms( opt->name, _name__log_level) ) {
 		if (opt->paramType != scalarType )
 			return CNF_WRONGTYPE;
@@ -550,6 +617,18 @@ acceptValue(tarantool_cfg* c, OptDef* opt, int check_rdonly) {
 		if (opt->paramValue.scalarval && c->wal_dir == NULL)
 			return CNF_NOMEMORY;
 	}
+	else if ( cmpNameAtoms( opt->name, _name__wal_stripe_dirs) ) {
+		if (opt->paramType != scalarType )
+			return CNF_WRONGTYPE;
+		c->__confetti_flags &= ~CNF_FLAG_STRUCT_NOTSET;
+		errno = 0;
+		if (check_rdonly && ( (opt->paramValue.scalarval == NULL && c->wal_stripe_dirs == NULL) || strcmp(opt->paramValue.scalarval, c->wal_stripe_dirs) != 0))
+			return CNF_RDONLY;
+		 if (c->wal_stripe_dirs) free(c->wal_stripe_dirs);
+		c->wal_stripe_dirs = (opt->paramValue.scalarval) ? strdup(opt->paramValue.scalarval) : NULL;
+		if (opt->paramValue.scalarval && c->wal_stripe_dirs == NULL)
+			return CNF_NOMEMORY;
+	}
 	else if ( cmpNameAtoms( opt->name, _name__archive_dir) ) {
 		if (opt->paramType != scalarType )
 			return CNF_WRONGTYPE;
@@ -691,6 +770,84 @@ acceptValue(tarantool_cfg* c, OptDef* opt, int check_rdonly) {
 			return CNF_WRONGRANGE;
 		c->snap_io_rate_limit = dbl;
 	}
+	else if ( cmpNameAtoms( opt->name, _name__snap_fork) ) {
+		if (opt->paramType != scalarType )
+			return CNF_WRONGTYPE;
+		c->__confetti_flags &= ~CNF_FLAG_STRUCT_NOTSET;
+		errno = 0;
+		bool bln;
+
+		if (strcasecmp(opt->paramValue.scalarval, "true") == 0 ||
+				strcasecmp(opt->paramValue.scalarval, "yes") == 0 ||
+				strcasecmp(opt->paramValue.scalarval, "enable") == 0 ||
+				strcasecmp(opt->paramValue.scalarval, "on") == 0 ||
+				strcasecmp(opt->paramValue.scalarval, "1") == 0 )
+			bln = true;
+		else if (strcasecmp(opt->paramValue.scalarval, "false") == 0 ||
+				strcasecmp(opt->paramValue.scalarval, "no") == 0 ||
+				strcasecmp(opt->paramValue.scalarval, "disable") == 0 ||
+				strcasecmp(opt->paramValue.scalarval, "off") == 0 ||
+				strcasecmp(opt->paramValue.scalarval, "0") == 0 )
+			bln = false;
+		else
+			return CNF_WRONGRANGE;
+		if (check_rdonly && c->snap_fork != bln)
+			return CNF_RDONLY;
+		c->snap_fork = bln;
+	}
+	else if ( cmpNameAtoms( opt->name, _name__snap_compress) ) {
+		if (opt->paramType != scalarType )
+			return CNF_WRONGTYPE;
+		c->__confetti_flags &= ~CNF_FLAG_STRUCT_NOTSET;
+		errno = 0;
+		bool bln;
+
+		if (strcasecmp(opt->paramValue.scalarval, "true") == 0 ||
+				strcasecmp(opt->paramValue.scalarval, "yes") == 0 ||
+				strcasecmp(opt->paramValue.scalarval, "enable") == 0 ||
+				strcasecmp(opt->paramValue.scalarval, "on") == 0 ||
+				strcasecmp(opt->paramValue.scalarval, "1") == 0 )
+			bln = true;
+		else if (strcasecmp(opt->paramValue.scalarval, "false") == 0 ||
+				strcasecmp(opt->paramValue.scalarval, "no") == 0 ||
+				strcasecmp(opt->paramValue.scalarval, "disable") == 0 ||
+				strcasecmp(opt->paramValue.scalarval, "off") == 0 ||
+				strcasecmp(opt->paramValue.scalarval, "0") == 0 )
+			bln = false;
+		else
+			return CNF_WRONGRANGE;
+		if (check_rdonly && c->snap_compress != bln)
+			return CNF_RDONLY;
+		c->snap_compress = bln;
+	}
+	else if ( cmpNameAtoms( opt->name, _name__snap_parts) ) {
+		if (opt->paramType != scalarType )
+			return CNF_WRONGTYPE;
+		c->__confetti_flags &= ~CNF_FLAG_STRUCT_NOTSET;
+		errno = 0;
+		long int i32 = strtol(opt->paramValue.scalarval, NULL, 10);
+		if (i32 == 0 && errno == EINVAL)
+			return CNF_WRONGINT;
+		if ( (i32 == LONG_MIN || i32 == LONG_MAX) && errno == ERANGE)
+			return CNF_WRONGRANGE;
+		if (check_rdonly && c->snap_parts != i32)
+			return CNF_RDONLY;
+		c->snap_parts = i32;
+	}
+	else if ( cmpNameAtoms( opt->name, _name__deltas_per_snap) ) {
+		if (opt->paramType != scalarType )
+			return CNF_WRONGTYPE;
+		c->__confetti_flags &= ~CNF_FLAG_STRUCT_NOTSET;
+		errno = 0;
+		long int i32 = strtol(opt->paramValue.scalarval, NULL, 10);
+		if (i32 == 0 && errno == EINVAL)
+			return CNF_WRONGINT;
+		if ( (i32 == LONG_MIN || i32 == LONG_MAX) && errno == ERANGE)
+			return CNF_WRONGRANGE;
+		if (check_rdonly && c->deltas_per_snap != i32)
+			return CNF_RDONLY;
+		c->deltas_per_snap = i32;
+	}
 	else if ( cmpNameAtoms( opt->name, _name__rows_per_wal) ) {
 		if (opt->paramType != scalarType )
 			return CNF_WRONGTYPE;
@@ -936,6 +1093,43 @@ acceptValue(tarantool_cfg* c, OptDef* opt, int check_rdonly) {
 		if (opt->paramValue.scalarval && c->replication_source == NULL)
 			return CNF_NOMEMORY;
 	}
+	else if ( cmpNameAtoms( opt->name, _name__replication_spaces) ) {
+		if (opt->paramType != scalarType )
+			return CNF_WRONGTYPE;
+		c->__confetti_flags &= ~CNF_FLAG_STRUCT_NOTSET;
+		errno = 0;
+		if (check_rdonly && ( (opt->paramValue.scalarval == NULL && c->replication_spaces == NULL) || strcmp(opt->paramValue.scalarval, c->replication_spaces) != 0))
+			return CNF_RDONLY;
+		 if (c->replication_spaces) free(c->replication_spaces);
+		c->replication_spaces = (opt->paramValue.scalarval) ? strdup(opt->paramValue.scalarval) : NULL;
+		if (opt->paramValue.scalarval && c->replication_spaces == NULL)
+			return CNF_NOMEMORY;
+	}
+	else if ( cmpNameAtoms( opt->name, _name__replication_compress) ) {
+		if (opt->paramType != scalarType )
+			return CNF_WRONGTYPE;
+		c->__confetti_flags &= ~CNF_FLAG_STRUCT_NOTSET;
+		errno = 0;
+		bool bln;
+
+		if (strcasecmp(opt->paramValue.scalarval, "true") == 0 ||
+				strcasecmp(opt->paramValue.scalarval, "yes") == 0 ||
+				strcasecmp(opt->paramValue.scalarval, "enable") == 0 ||
+				strcasecmp(opt->paramValue.scalarval, "on") == 0 ||
+				strcasecmp(opt->paramValue.scalarval, "1") == 0 )
+			bln = true;
+		else if (strcasecmp(opt->paramValue.scalarval, "false") == 0 ||
+				strcasecmp(opt->paramValue.scalarval, "no") == 0 ||
+				strcasecmp(opt->paramValue.scalarval, "disable") == 0 ||
+				strcasecmp(opt->paramValue.scalarval, "off") == 0 ||
+				strcasecmp(opt->paramValue.scalarval, "0") == 0 )
+			bln = false;
+		else
+			return CNF_WRONGRANGE;
+		if (check_rdonly && c->replication_compress != bln)
+			return CNF_RDONLY;
+		c->replication_compress = bln;
+	}
 	else if ( cmpNameAtoms( opt->name, _name__space) ) {
 		if (opt->paramType != arrayType )
 			return CNF_WRONGTYPE;
@@ -1253,6 +1447,8 @@ typedef enum IteratorState {
 	S_name__coredump,
 	S_name__admin_port,
 	S_name__replication_port,
+	S_name__replication_sync_quorum,
+	S_name__replication_sync_timeout,
 	S_name__log_level,
 	S_name__slab_alloc_arena,
 	S_name__slab_alloc_minimal,
@@ -1260,6 +1456,7 @@ typedef enum IteratorState {
 	S_name__work_dir,
 	S_name__snap_dir,
 	S_name__wal_dir,
+	S_name__wal_stripe_dirs,
 	S_name__script_dir,
 	S_name__archive_dir,
 	S_name__archive_filename_format,
@@ -1270,6 +1467,10 @@ typedef enum IteratorState {
 	S_name__backlog,
 	S_name__readahead,
 	S_name__snap_io_rate_limit,
+	S_name__snap_fork,
+	S_name__snap_compress,
+	S_name__snap_parts,
+	S_name__deltas_per_snap,
 	S_name__rows_per_wal,
 	S_name__wal_writer_inbox_size,
 	S_name__wal_mode,
@@ -1287,6 +1488,8 @@ typedef enum IteratorState {
 	S_name__memcached_expire_per_loop,
 	S_name__memcached_expire_full_sweep,
 	S_name__replication_source,
+	S_name__replication_spaces,
+	S_name__replication_compress,
 	S_name__space,
 	S_name__space__enabled,
 	S_name__space__cardinality,
@@ -1386,6 +1589,28 @@ again:
 			}
 			sprintf(*v, "%"PRId32, c->replication_port);
 			snprintf(buf, PRINTBUFLEN-1, "replication_port");
+			i->state = S_name__replication_sync_quorum;
+			return buf;
+		case S_name__replication_sync_quorum:
+			*v = malloc(32);
+			if (*v == NULL) {
+				free(i);
+				out_warning(CNF_NOMEMORY, "No memory to output value");
+				return NULL;
+			}
+			sprintf(*v, "%"PRId32, c->replication_sync_quorum);
+			snprintf(buf, PRINTBUFLEN-1, "replication_sync_quorum");
+			i->state = S_name__replication_sync_timeout;
+			return buf;
+		case S_name__replication_sync_timeout:
+			*v = malloc(32);
+			if (*v == NULL) {
+				free(i);
+				out_warning(CNF_NOMEMORY, "No memory to output value");
+				return NULL;
+			}
+			sprintf(*v, "%g", c->replication_sync_timeout);
+			snprintf(buf, PRINTBUFLEN-1, "replication_sync_timeout");
 			i->state = S_name__log_level;
 			return buf;
 		case S_name__log_level:
@@ -1460,6 +1685,16 @@ again:
 				return NULL;
 			}
 			snprintf(buf, PRINTBUFLEN-1, "wal_dir");
+			i->state = S_name__wal_stripe_dirs;
+			return buf;
+		case S_name__wal_stripe_dirs:
+			*v = (c->wal_stripe_dirs) ? strdup(c->wal_stripe_dirs) : NULL;
+			if (*v == NULL && c->wal_stripe_dirs) {
+				free(i);
+				out_warning(CNF_NOMEMORY, "No memory to output value");
+				return NULL;
+			}
+			snprintf(buf, PRINTBUFLEN-1, "wal_stripe_dirs");
 			i->state = S_name__script_dir;
 			return buf;
 		case S_name__script_dir:
@@ -1545,6 +1780,50 @@ again:
 			}
 			sprintf(*v, "%g", c->snap_io_rate_limit);
 			snprintf(buf, PRINTBUFLEN-1, "snap_io_rate_limit");
+			i->state = S_name__snap_fork;
+			return buf;
+		case S_name__snap_fork:
+			*v = malloc(8);
+			if (*v == NULL) {
+				free(i);
+				out_warning(CNF_NOMEMORY, "No memory to output value");
+				return NULL;
+			}
+			sprintf(*v, "%s", c->snap_fork ? "true" : "false");
+			snprintf(buf, PRINTBUFLEN-1, "snap_fork");
+			i->state = S_name__snap_compress;
+			return buf;
+		case S_name__snap_compress:
+			*v = malloc(8);
+			if (*v == NULL) {
+				free(i);
+				out_warning(CNF_NOMEMORY, "No memory to output value");
+				return NULL;
+			}
+			sprintf(*v, "%s", c->snap_compress ? "true" : "false");
+			snprintf(buf, PRINTBUFLEN-1, "snap_compress");
+			i->state = S_name__snap_parts;
+			return buf;
+		case S_name__snap_parts:
+			*v = malloc(32);
+			if (*v == NULL) {
+				free(i);
+				out_warning(CNF_NOMEMORY, "No memory to output value");
+				return NULL;
+			}
+			sprintf(*v, "%"PRId32, c->snap_parts);
+			snprintf(buf, PRINTBUFLEN-1, "snap_parts");
+			i->state = S_name__deltas_per_snap;
+			return buf;
+		case S_name__deltas_per_snap:
+			*v = malloc(32);
+			if (*v == NULL) {
+				free(i);
+				out_warning(CNF_NOMEMORY, "No memory to output value");
+				return NULL;
+			}
+			sprintf(*v, "%"PRId32, c->deltas_per_snap);
+			snprintf(buf, PRINTBUFLEN-1, "deltas_per_snap");
 			i->state = S_name__rows_per_wal;
 			return buf;
 		case S_name__rows_per_wal:
@@ -1729,6 +2008,27 @@ again:
 				return NULL;
 			}
 			snprintf(buf, PRINTBUFLEN-1, "replication_source");
+			i->state = S_name__replication_spaces;
+			return buf;
+		case S_name__replication_spaces:
+			*v = (c->replication_spaces) ? strdup(c->replication_spaces) : NULL;
+			if (*v == NULL && c->replication_spaces) {
+				free(i);
+				out_warning(CNF_NOMEMORY, "No memory to output value");
+				return NULL;
+			}
+			snprintf(buf, PRINTBUFLEN-1, "replication_spaces");
+			i->state = S_name__replication_compress;
+			return buf;
+		case S_name__replication_compress:
+			*v = malloc(8);
+			if (*v == NULL) {
+				free(i);
+				out_warning(CNF_NOMEMORY, "No memory to output value");
+				return NULL;
+			}
+			sprintf(*v, "%s", c->replication_compress ? "true" : "false");
+			snprintf(buf, PRINTBUFLEN-1, "replication_compress");
 			i->state = S_name__space;
 			return buf;
 		case S_name__space:
@@ -2017,6 +2317,8 @@ dup_tarantool_cfg(tarantool_cfg* dst, tarantool_cfg* src) {
 	dst->coredump = src->coredump;
 	dst->admin_port = src->admin_port;
 	dst->replication_port = src->replication_port;
+	dst->replication_sync_quorum = src->replication_sync_quorum;
+	dst->replication_sync_timeout = src->replication_sync_timeout;
 	dst->log_level = src->log_level;
 	dst->slab_alloc_arena = src->slab_alloc_arena;
 	dst->slab_alloc_minimal = src->slab_alloc_minimal;
@@ -2030,6 +2332,9 @@ dup_tarantool_cfg(tarantool_cfg* dst, tarantool_cfg* src) {
 	if (dst->wal_dir) free(dst->wal_dir);dst->wal_dir = src->wal_dir == NULL ? NULL : strdup(src->wal_dir);
 	if (src->wal_dir != NULL && dst->wal_dir == NULL)
 		return CNF_NOMEMORY;
+	if (dst->wal_stripe_dirs) free(dst->wal_stripe_dirs);dst->wal_stripe_dirs = src->wal_stripe_dirs == NULL ? NULL : strdup(src->wal_stripe_dirs);
+	if (src->wal_stripe_dirs != NULL && dst->wal_stripe_dirs == NULL)
+		return CNF_NOMEMORY;
 	if (dst->script_dir) free(dst->script_dir);dst->script_dir = src->script_dir == NULL ? NULL : strdup(src->script_dir);
 	if (src->script_dir != NULL && dst->script_dir == NULL)
 		return CNF_NOMEMORY;
@@ -2044,6 +2349,10 @@ dup_tarantool_cfg(tarantool_cfg* dst, tarantool_cfg* src) {
 	dst->backlog = src->backlog;
 	dst->readahead = src->readahead;
 	dst->snap_io_rate_limit = src->snap_io_rate_limit;
+	dst->snap_fork = src->snap_fork;
+	dst->snap_compress = src->snap_compress;
+	dst->snap_parts = src->snap_parts;
+	dst->deltas_per_snap = src->deltas_per_snap;
 	dst->rows_per_wal = src->rows_per_wal;
 	dst->wal_writer_inbox_size = src->wal_writer_inbox_size;
 	if (dst->wal_mode) free(dst->wal_mode);dst->wal_mode = src->wal_mode == NULL ? NULL : strdup(src->wal_mode);
@@ -2067,6 +2376,10 @@ dup_tarantool_cfg(tarantool_cfg* dst, tarantool_cfg* src) {
 	if (dst->replication_source) free(dst->replication_source);dst->replication_source = src->replication_source == NULL ? NULL : strdup(src->replication_source);
 	if (src->replication_source != NULL && dst->replication_source == NULL)
 		return CNF_NOMEMORY;
+	if (dst->replication_spaces) free(dst->replication_spaces);dst->replication_spaces = src->replication_spaces == NULL ? NULL : strdup(src->replication_spaces);
+	if (src->replication_spaces != NULL && dst->replication_spaces == NULL)
+		return CNF_NOMEMORY;
+	dst->replication_compress = src->replication_compress;
 
 	dst->space = NULL;
 	if (src->space != NULL) {
@@ -2140,6 +2453,8 @@ destroy_tarantool_cfg(tarantool_cfg* c) {
 		free(c->snap_dir);
 	if (c->wal_dir != NULL)
 		free(c->wal_dir);
+	if (c->wal_stripe_dirs != NULL)
+		free(c->wal_stripe_dirs);
 	if (c->script_dir != NULL)
 		free(c->script_dir);
 	if (c->pid_file != NULL)
@@ -2152,6 +2467,8 @@ destroy_tarantool_cfg(tarantool_cfg* c) {
 		free(c->custom_proc_title);
 	if (c->replication_source != NULL)
 		free(c->replication_source);
+	if (c->replication_spaces != NULL)
+		free(c->replication_spaces);
 
 	if (c->space != NULL) {
 		i->idx_name__space = 0;
@@ -2243,6 +2560,20 @@ cmp_tarantool_cfg(tarantool_cfg* c1, tarantool_cfg* c2, int only_check_rdonly) {
 
 		return diff;
 	}
+	if (!only_check_rdonly) {
+		if (c1->replication_sync_quorum != c2->replication_sync_quorum) {
+			snprintf(diff, PRINTBUFLEN - 1, "%s", "c->replication_sync_quorum");
+
+			return diff;
+		}
+	}
+	if (!only_check_rdonly) {
+		if (c1->replication_sync_timeout != c2->replication_sync_timeout) {
+			snprintf(diff, PRINTBUFLEN - 1, "%s", "c->replication_sync_timeout");
+
+			return diff;
+		}
+	}
 	if (!only_check_rdonly) {
 		if (c1->log_level != c2->log_level) {
 			snprintf(diff, PRINTBUFLEN - 1, "%s", "c->log_level");
@@ -2280,6 +2611,11 @@ cmp_tarantool_cfg(tarantool_cfg* c1, tarantool_cfg* c2, int only_check_rdonly) {
 
 		return diff;
 }
+	if (confetti_strcmp(c1->wal_stripe_dirs, c2->wal_stripe_dirs) != 0) {
+		snprintf(diff, PRINTBUFLEN - 1, "%s", "c->wal_stripe_dirs");
+
+		return diff;
+}
 	if (confetti_strcmp(c1->script_dir, c2->script_dir) != 0) {
 		snprintf(diff, PRINTBUFLEN - 1, "%s", "c->script_dir");
 
@@ -2326,6 +2662,26 @@ cmp_tarantool_cfg(tarantool_cfg* c1, tarantool_cfg* c2, int only_check_rdonly) {
 			return diff;
 		}
 	}
+	if (c1->snap_fork != c2->snap_fork) {
+		snprintf(diff, PRINTBUFLEN - 1, "%s", "c->snap_fork");
+
+		return diff;
+	}
+	if (c1->snap_compress != c2->snap_compress) {
+		snprintf(diff, PRINTBUFLEN - 1, "%s", "c->snap_compress");
+
+		return diff;
+	}
+	if (c1->snap_parts != c2->snap_parts) {
+		snprintf(diff, PRINTBUFLEN - 1, "%s", "c->snap_parts");
+
+		return diff;
+	}
+	if (c1->deltas_per_snap != c2->deltas_per_snap) {
+		snprintf(diff, PRINTBUFLEN - 1, "%s", "c->deltas_per_snap");
+
+		return diff;
+	}
 	if (c1->rows_per_wal != c2->rows_per_wal) {
 		snprintf(diff, PRINTBUFLEN - 1, "%s", "c->rows_per_wal");
 
@@ -2423,6 +2779,16 @@ cmp_tarantool_cfg(tarantool_cfg* c1, tarantool_cfg* c2, int only_check_rdonly) {
 			return diff;
 }
 	}
+	if (confetti_strcmp(c1->replication_spaces, c2->replication_spaces) != 0) {
+		snprintf(diff, PRINTBUFLEN - 1, "%s", "c->replication_spaces");
+
+		return diff;
+}
+	if (c1->replication_compress != c2->replication_compress) {
+		snprintf(diff, PRINTBUFLEN - 1, "%s", "c->replication_compress");
+
+		return diff;
+	}
 
 	i1->idx_name__space = 0;
 	i2->idx_name__space = 0;
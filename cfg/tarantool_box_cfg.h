@@ -73,6 +73,15 @@ typedef struct tarantool_cfg {
 	/* Replication clients should use this port (bind_ipaddr:replication_port). */
 	int32_t	replication_port;
 
+	/*
+	 * The number of replicas which must confirm a change before
+	 * it is acknowledged, 0 turns semi-synchronous replication off
+	 */
+	int32_t	replication_sync_quorum;
+
+	/* Seconds to wait for the confirmations of replicas */
+	double	replication_sync_timeout;
+
 	/* Log verbosity, possible values: ERROR=1, CRIT=2, WARN=3, INFO=4(default), DEBUG=5 */
 	int32_t	log_level;
 
@@ -94,6 +103,13 @@ typedef struct tarantool_cfg {
 	/* WAL directory (where WALs get saved/read) */
 	char*	wal_dir;
 
+	/*
+	 * Additional WAL directories, separated by commas.
+	 * WAL files are spread over wal_dir and these
+	 * directories in turn, one file after another.
+	 */
+	char*	wal_stripe_dirs;
+
 	/* script directory (where init.lua is expected to be) */
 	char*	script_dir;
 
@@ -132,6 +148,27 @@ typedef struct tarantool_cfg {
 	/* Do not write into snapshot faster than snap_io_rate_limit MB/sec */
 	double	snap_io_rate_limit;
 
+	/*
+	 * Save snapshots from a forked child process (the default). If
+	 * false, save them from a thread over an in-memory read view
+	 */
+	confetti_bool_t	snap_fork;
+
+	/*
+	 * Write snapshots as LZF-compressed blocks of rows (file format
+	 * version 0.12)
+	 */
+	confetti_bool_t	snap_compress;
+
+	/*
+	 * The number of files a snapshot is split into, written and read
+	 * at once
+	 */
+	int32_t	snap_parts;
+
+	/* The number of delta snapshots to write between two full ones */
+	int32_t	deltas_per_snap;
+
 	/* Write no more rows in WAL */
 	int32_t	rows_per_wal;
 
@@ -161,6 +198,8 @@ typedef struct tarantool_cfg {
 	/*
 	 * Delay, in seconds, between successive re-readings of wal_dir.
 	 * The re-scan is necessary to discover new WAL files or snapshots.
+	 * On Linux, changes are discovered with inotify, and the re-scan
+	 * is only a fallback, done at most once a second.
 	 */
 	double	wal_dir_rescan_delay;
 
@@ -213,6 +252,12 @@ typedef struct tarantool_cfg {
 	 * only accepts reads.
 	 */
 	char*	replication_source;
+
+	/* Replicate only the rows of these spaces, separated by commas */
+	char*	replication_spaces;
+
+	/* Ask the master for an LZF-compressed replication stream */
+	confetti_bool_t	replication_compress;
 	tarantool_cfg_space**	space;
 } tarantool_cfg;
 
@@ -0,0 +1,81 @@
+
+/*
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <cfg/prscfg.h>
+#include <cfg/tarantool_box_cfg.h>
+
+#include "ts_options.h"
+#include "ts_config.h"
+
+int ts_config_load(struct ts_options *opts)
+{
+	FILE *f = fopen(opts->file_config, "r");
+	if (f == NULL) {
+		printf("failed to open config file: %s\n", opts->file_config);
+		return -1;
+	}
+	int accepted = 0,
+	    skipped = 0,
+	    optional = 0;
+	int rc = parse_cfg_file_tarantool_cfg(&opts->cfg, f, 0,
+					      &accepted,
+					      &skipped,
+					      &optional);
+	fclose(f);
+	if (rc == -1)
+		return -1;
+	rc = check_cfg_tarantool_cfg(&opts->cfg);
+	if (rc == -1)
+		return -1;
+	if (opts->snap_dir == NULL)
+		opts->snap_dir = opts->cfg.snap_dir;
+	if (opts->wal_dir == NULL) {
+		/* archived logs given on the command line are not striped */
+		opts->wal_dir = opts->cfg.wal_dir;
+		opts->wal_stripe_dirs = opts->cfg.wal_stripe_dirs;
+	}
+	if (opts->output_dir == NULL)
+		opts->output_dir = opts->snap_dir;
+	if (opts->snap_dir == NULL) {
+		printf("snapshot directory is not specified\n");
+		return -1;
+	}
+	if (opts->wal_dir == NULL) {
+		printf("xlog directory is not specified\n");
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,6 @@
+#ifndef TS_CONFIG_H_INCLUDED
+#define TS_CONFIG_H_INCLUDED
+
+int ts_config_load(struct ts_options *opts);
+
+#endif
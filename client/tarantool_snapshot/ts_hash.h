@@ -0,0 +1,41 @@
+#ifndef TS_HASH_H_INCLUDED
+#define TS_HASH_H_INCLUDED
+
+#if !MH_SOURCE
+#define MH_UNDEF
+#endif
+
+#include <stdint.h>
+
+#define mh_name _u32ptr
+struct mh_u32ptr_node_t {
+	uint32_t key;
+	void *val;
+};
+
+#define mh_node_t struct mh_u32ptr_node_t
+#define mh_hash_arg_t void *
+#define mh_hash(a, arg) (a->key)
+#define mh_eq_arg_t void *
+#define mh_eq(a, b, arg) ((a->key) == (b->key))
+#include <mhash.h>
+
+
+struct ts_space;
+struct ts_tuple;
+
+uint32_t
+ts_space_hash(const struct ts_tuple *t, struct ts_space *s);
+
+int
+ts_space_equal(const struct ts_tuple *a, const struct ts_tuple *b, struct ts_space *s);
+
+#define mh_name _pk
+#define mh_node_t struct ts_tuple *
+#define mh_hash_arg_t struct ts_space *
+#define mh_hash(a, arg) ts_space_hash(*(a), arg)
+#define mh_eq_arg_t struct ts_space *
+#define mh_eq(a, b, arg) ts_space_equal(*(a), *(b), arg)
+#include <mhash.h>
+
+#endif
@@ -0,0 +1,145 @@
+
+/*
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <connector/c/include/tarantool/tnt.h>
+#include <connector/c/include/tarantool/tnt_snapshot.h>
+#include <connector/c/include/tarantool/tnt_dir.h>
+
+#include <third_party/gopt/gopt.h>
+
+#include <cfg/prscfg.h>
+#include <cfg/tarantool_box_cfg.h>
+
+#include "ts_tuple.h"
+#define MH_SOURCE 1
+#include "ts_hash.h"
+#include "ts_options.h"
+#include "ts_config.h"
+#include "ts_space.h"
+#include "ts_replay.h"
+#include "ts_snapshot.h"
+
+void out_warning(ConfettyError v, char *format, ...) {
+	(void)v;
+	va_list ap;
+	va_start(ap, format);
+	vprintf(format, ap);
+	printf("\n");
+	va_end(ap);
+}
+
+static int
+ts_create(struct ts_options *opts)
+{
+	printf(">>> Snapshot creation\n");
+
+	/* 1. create spaces according to a configuration file */
+	struct ts_spaces s;
+	int rc = ts_space_init(&s);
+	if (rc == -1)
+		return -1;
+	rc = ts_space_fill(&s, opts);
+	if (rc == -1) {
+		ts_space_free(&s);
+		return -1;
+	}
+	printf("configured spaces: %d\n", mh_size(s.t));
+	printf("snap_dir: %s\n", opts->snap_dir);
+	printf("wal_dir: %s\n", opts->wal_dir);
+
+	/* 2. find newest snapshot lsn */
+	struct tnt_dir snap_dir;
+	tnt_dir_init(&snap_dir, TNT_DIR_SNAPSHOT);
+	rc = tnt_dir_scan(&snap_dir, (char *)opts->snap_dir);
+	if (rc == -1) {
+		printf("failed to open snapshot directory\n");
+		goto error;
+	}
+	uint64_t snap_lsn = 0;
+	rc = tnt_dir_match_gt(&snap_dir, &snap_lsn);
+	if (rc == -1) {
+		printf("failed to match greatest snapshot lsn\n");
+		goto error;
+	}
+	printf("last snapshot lsn: %llu\n", (unsigned long long) snap_lsn);
+
+	/* 3. load the snapshot and replay the xlogs after it */
+	rc = ts_replay_snapshot(&s, opts->snap_dir, snap_lsn);
+	if (rc == -1)
+		goto error;
+	uint64_t last_lsn = 0;
+	rc = ts_replay_xlogs(&s, opts, snap_lsn, &last_lsn);
+	if (rc == -1)
+		goto error;
+	printf("last xlog lsn: %llu\n", (unsigned long long) last_lsn);
+
+	/* 4. save the result at the last lsn */
+	rc = ts_snapshot_save(&s, opts->output_dir, last_lsn);
+	if (rc == -1)
+		goto error;
+
+	tnt_dir_free(&snap_dir);
+	ts_space_free(&s);
+	return 0;
+error:
+	tnt_dir_free(&snap_dir);
+	ts_space_free(&s);
+	return -1;
+}
+
+int main(int argc, char *argv[])
+{
+	struct ts_options opts;
+	ts_options_init(&opts);
+
+	int rc = 0;
+	enum ts_options_mode mode = ts_options_process(&opts, argc, argv);
+	switch (mode) {
+	case TS_MODE_USAGE:
+		return ts_options_usage();
+	case TS_MODE_VERSION:
+		return 0;
+	case TS_MODE_CREATE:
+		rc = ts_config_load(&opts);
+		if (rc == -1)
+			break;
+		rc = ts_create(&opts);
+		break;
+	}
+
+	ts_options_free(&opts);
+	return rc == -1 ? 1 : 0;
+}
@@ -0,0 +1,378 @@
+
+/*
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+#include <connector/c/include/tarantool/tnt.h>
+#include <connector/c/include/tarantool/tnt_xlog.h>
+#include <connector/c/include/tarantool/tnt_snapshot.h>
+#include <connector/c/include/tarantool/tnt_dir.h>
+
+#include <cfg/prscfg.h>
+#include <cfg/tarantool_box_cfg.h>
+
+#include "ts_tuple.h"
+#include "ts_hash.h"
+#include "ts_options.h"
+#include "ts_space.h"
+#include "ts_replay.h"
+
+/*
+ * The number of files of a snapshot: <lsn>.snap tells it in
+ * a "Parts: N" header line if it was written in several parts.
+ */
+static int
+ts_replay_part_count(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	if (f == NULL)
+		return -1;
+	char buf[256];
+	int count = 1, lines = 0;
+	while (fgets(buf, sizeof(buf), f) != NULL) {
+		/* skip the file type and version */
+		if (lines++ < 2)
+			continue;
+		if (strcmp(buf, "\n") == 0 || strcmp(buf, "\r\n") == 0)
+			break;
+		if (sscanf(buf, "Parts: %d", &count) == 1 && count < 1)
+			count = -1;
+	}
+	fclose(f);
+	return count;
+}
+
+static int
+ts_replay_snapshot_file(struct ts_spaces *s, char *path)
+{
+	printf("(snapshot) %s\n", path);
+
+	struct tnt_stream st;
+	tnt_snapshot(&st);
+	if (tnt_snapshot_open(&st, path) == -1) {
+		printf("failed to open snapshot file\n");
+		tnt_stream_free(&st);
+		return -1;
+	}
+	struct tnt_iter i;
+	tnt_iter_storage(&i, &st);
+	int rc = 0;
+	while (tnt_next(&i)) {
+		struct tnt_iter_storage *is = TNT_ISTORAGE(&i);
+		struct tnt_stream_snapshot *ss =
+			TNT_SSNAPSHOT_CAST(TNT_IREQUEST_STREAM(&i));
+		uint32_t ns = ss->log.current.row_snap.space;
+		struct ts_space *space = ts_space_match(s, ns);
+		if (space == NULL) {
+			printf("space %d is not defined\n", ns);
+			rc = -1;
+			goto done;
+		}
+		struct ts_tuple *t =
+			ts_tuple_new(is->t.cardinality,
+				     is->t.data + sizeof(uint32_t),
+				     is->t.size - sizeof(uint32_t));
+		if (t == NULL || ts_space_replace(space, t) == -1) {
+			printf("failed to store a tuple\n");
+			free(t);
+			rc = -1;
+			goto done;
+		}
+	}
+	if (i.status == TNT_ITER_FAIL) {
+		printf("snapshot parsing failed: %s\n", tnt_snapshot_strerror(&st));
+		rc = -1;
+	}
+done:
+	tnt_iter_free(&i);
+	tnt_stream_free(&st);
+	return rc;
+}
+
+int ts_replay_snapshot(struct ts_spaces *s, const char *snap_dir, uint64_t lsn)
+{
+	char path[PATH_MAX];
+	if (snprintf(path, sizeof(path), "%s/%020llu.snap", snap_dir,
+		     (unsigned long long) lsn) >= (int) sizeof(path)) {
+		printf("snapshot path is too long: %s\n", snap_dir);
+		return -1;
+	}
+	int count = ts_replay_part_count(path);
+	if (count == -1) {
+		printf("failed to read snapshot header: %s\n", path);
+		return -1;
+	}
+	int part;
+	for (part = 0; part < count; part++) {
+		char part_path[PATH_MAX];
+		int len;
+		if (part == 0)
+			len = snprintf(part_path, sizeof(part_path), "%s",
+				       path);
+		else
+			len = snprintf(part_path, sizeof(part_path), "%s.%d",
+				       path, part);
+		if (len >= (int) sizeof(part_path)) {
+			printf("snapshot part path is too long: %s\n", path);
+			return -1;
+		}
+		if (ts_replay_snapshot_file(s, part_path) == -1)
+			return -1;
+	}
+	return 0;
+}
+
+static int
+ts_replay_request(struct ts_spaces *s, struct tnt_request *r)
+{
+	uint32_t ns;
+	struct tnt_tuple *t;
+	switch (r->h.type) {
+	case TNT_OP_INSERT:
+		ns = r->r.insert.h.ns;
+		t = &r->r.insert.t;
+		break;
+	case TNT_OP_UPDATE:
+		ns = r->r.update.h.ns;
+		t = &r->r.update.t;
+		break;
+	case TNT_OP_DELETE:
+		ns = r->r.del.h.ns;
+		t = &r->r.del.t;
+		break;
+	default:
+		printf("bad xlog operation %d\n", r->h.type);
+		return -1;
+	}
+	struct ts_space *space = ts_space_match(s, ns);
+	if (space == NULL) {
+		printf("space %d is not defined\n", ns);
+		return -1;
+	}
+	if (r->h.type == TNT_OP_INSERT) {
+		struct ts_tuple *tuple =
+			ts_tuple_new(t->cardinality, t->data + sizeof(uint32_t),
+				     t->size - sizeof(uint32_t));
+		if (tuple == NULL || ts_space_replace(space, tuple) == -1) {
+			printf("failed to store a tuple\n");
+			free(tuple);
+			return -1;
+		}
+		return 0;
+	}
+	struct ts_tuple *key = ts_space_key(space, t);
+	if (key == NULL) {
+		printf("failed to create key\n");
+		return -1;
+	}
+	int rc = 0;
+	if (r->h.type == TNT_OP_DELETE)
+		ts_space_delete(space, key);
+	else
+		rc = ts_space_update(space, key, &r->r.update);
+	free(key);
+	return rc;
+}
+
+static int
+ts_replay_xlog(struct ts_spaces *s, struct tnt_dir_file *file, char *dir,
+	       int is_last, uint64_t *last)
+{
+	char path[PATH_MAX];
+	if (snprintf(path, sizeof(path), "%s/%s", dir,
+		     file->name) >= (int) sizeof(path)) {
+		printf("xlog path is too long: %s\n", file->name);
+		return -1;
+	}
+
+	printf("(xlog) %s\r", file->name);
+	fflush(stdout);
+
+	struct tnt_stream st;
+	tnt_xlog(&st);
+	if (tnt_xlog_open(&st, path) == -1) {
+		printf("failed to open xlog file %s\n", path);
+		tnt_stream_free(&st);
+		return -1;
+	}
+
+	struct tnt_iter i;
+	tnt_iter_request(&i, &st);
+	int count = 0;
+	int rc = 0;
+	while (tnt_next(&i)) {
+		struct tnt_request *r = TNT_IREQUEST_PTR(&i);
+		struct tnt_stream_xlog *xs =
+			TNT_SXLOG_CAST(TNT_IREQUEST_STREAM(&i));
+		uint64_t lsn = xs->log.current.hdr.lsn;
+		if (lsn <= *last)
+			continue;
+		if (lsn != *last + 1)
+			printf("\nwarning: lsn gap %llu - %llu\n",
+			       (unsigned long long) *last,
+			       (unsigned long long) lsn);
+		rc = ts_replay_request(s, r);
+		if (rc == -1) {
+			printf("failed to apply lsn %llu\n",
+			       (unsigned long long) lsn);
+			goto done;
+		}
+		*last = lsn;
+		if (++count % 10000 == 0) {
+			printf("(xlog) %s %.3fM processed\r", file->name,
+			       (float)count / 1000000);
+			fflush(stdout);
+		}
+	}
+	printf("\n");
+	if (i.status == TNT_ITER_FAIL) {
+		/* the tail of the newest file may be unfinished */
+		if (is_last) {
+			printf("xlog %s is truncated at lsn %llu: %s\n",
+			       file->name, (unsigned long long) *last,
+			       tnt_xlog_strerror(&st));
+		} else {
+			printf("xlog parsing failed: %s\n", tnt_xlog_strerror(&st));
+			rc = -1;
+		}
+	}
+done:
+	tnt_iter_free(&i);
+	tnt_stream_free(&st);
+	return rc;
+}
+
+/* an xlog file in one of the wal directories */
+struct ts_xlog {
+	struct tnt_dir_file *file;
+	char *dir;
+};
+
+static int
+ts_xlog_cmp(const void *_a, const void *_b)
+{
+	const struct ts_xlog *a = _a;
+	const struct ts_xlog *b = _b;
+	if (a->file->lsn == b->file->lsn)
+		return 0;
+	return (a->file->lsn > b->file->lsn) ? 1: -1;
+}
+
+/*
+ * Scan wal_dir and the stripe directories and merge the files
+ * into one list, ordered by lsn.
+ */
+static int
+ts_replay_scan(struct ts_options *opts, struct tnt_dir *dirs, int *dir_count,
+	       struct ts_xlog **xlogs, int *count)
+{
+	char *stripes = NULL, *saveptr = NULL;
+	char *name = (char *)opts->wal_dir;
+	if (opts->wal_stripe_dirs != NULL) {
+		stripes = strdup(opts->wal_stripe_dirs);
+		if (stripes == NULL)
+			return -1;
+	}
+	*dir_count = 0;
+	*count = 0;
+	char *next = stripes ? strtok_r(stripes, ",", &saveptr) : NULL;
+	while (name != NULL) {
+		if (*name != '\0') {
+			if (*dir_count == TS_WAL_DIRS_MAX) {
+				printf("too many wal directories\n");
+				goto error;
+			}
+			struct tnt_dir *d = &dirs[(*dir_count)++];
+			tnt_dir_init(d, TNT_DIR_XLOG);
+			if (tnt_dir_scan(d, name) == -1) {
+				printf("failed to open wal directory %s\n", name);
+				goto error;
+			}
+			*count += d->count;
+		}
+		name = next;
+		next = next ? strtok_r(NULL, ",", &saveptr) : NULL;
+	}
+	*xlogs = malloc(sizeof(struct ts_xlog) * (*count + 1));
+	if (*xlogs == NULL)
+		goto error;
+	int i, j, n = 0;
+	for (i = 0; i < *dir_count; i++) {
+		for (j = 0; j < dirs[i].count; j++) {
+			(*xlogs)[n].file = &dirs[i].files[j];
+			(*xlogs)[n].dir = dirs[i].path;
+			n++;
+		}
+	}
+	qsort(*xlogs, *count, sizeof(struct ts_xlog), ts_xlog_cmp);
+	free(stripes);
+	return 0;
+error:
+	free(stripes);
+	return -1;
+}
+
+int ts_replay_xlogs(struct ts_spaces *s, struct ts_options *opts,
+		    uint64_t snap_lsn, uint64_t *last_lsn)
+{
+	struct tnt_dir dirs[TS_WAL_DIRS_MAX];
+	struct ts_xlog *xlogs = NULL;
+	int dir_count = 0, count = 0, rc = -1;
+	if (ts_replay_scan(opts, dirs, &dir_count, &xlogs, &count) == -1)
+		goto done;
+
+	/* start with the file holding the first row after the snapshot */
+	*last_lsn = snap_lsn;
+	int i = 0;
+	while (i + 1 < count && xlogs[i + 1].file->lsn <= snap_lsn + 1)
+		i++;
+	if (i < count && xlogs[i].file->lsn > snap_lsn + 1) {
+		printf("no xlogs between lsn %llu and %llu\n",
+		       (unsigned long long) snap_lsn,
+		       (unsigned long long) xlogs[i].file->lsn);
+		goto done;
+	}
+	for (; i < count; i++) {
+		if (ts_replay_xlog(s, xlogs[i].file, xlogs[i].dir,
+				   i == count - 1, last_lsn) == -1)
+			goto done;
+	}
+	rc = 0;
+done:
+	free(xlogs);
+	for (i = 0; i < dir_count; i++)
+		tnt_dir_free(&dirs[i]);
+	return rc;
+}
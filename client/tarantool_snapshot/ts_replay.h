@@ -0,0 +1,11 @@
+#ifndef TS_REPLAY_H_INCLUDED
+#define TS_REPLAY_H_INCLUDED
+
+/* wal_dir and up to 16 stripe directories */
+enum { TS_WAL_DIRS_MAX = 17 };
+
+int ts_replay_snapshot(struct ts_spaces *s, const char *snap_dir, uint64_t lsn);
+int ts_replay_xlogs(struct ts_spaces *s, struct ts_options *opts,
+		    uint64_t snap_lsn, uint64_t *last_lsn);
+
+#endif
@@ -0,0 +1,199 @@
+
+/*
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+
+#include <connector/c/include/tarantool/tnt.h>
+#include <connector/c/include/tarantool/tnt_log.h>
+
+#include <third_party/crc32.h>
+
+#include "ts_tuple.h"
+#include "ts_hash.h"
+#include "ts_space.h"
+#include "ts_snapshot.h"
+
+/* as in the server: row tag and cookie of snapshot rows */
+static const uint32_t ts_row_marker = 0xba0babed;
+static const uint32_t ts_eof_marker = 0x10adab1e;
+static const uint16_t ts_snap_tag = 65535;
+static const uint64_t ts_snap_cookie = 0;
+
+struct ts_writer {
+	FILE *f;
+	char *buf;
+	size_t size;
+	double tm;
+	uint64_t rows;
+};
+
+static int
+ts_snapshot_write_row(struct ts_writer *w, uint32_t space, struct ts_tuple *t)
+{
+	struct tnt_log_header_v11 hdr;
+	struct tnt_log_row_snap_v11 row;
+	size_t len = sizeof(row) + t->size;
+	if (len > w->size) {
+		char *buf = realloc(w->buf, len);
+		if (buf == NULL)
+			return -1;
+		w->buf = buf;
+		w->size = len;
+	}
+	row.tag = ts_snap_tag;
+	row.cookie = ts_snap_cookie;
+	row.space = space;
+	row.tuple_size = t->field_count;
+	row.data_size = t->size;
+	memcpy(w->buf, &row, sizeof(row));
+	memcpy(w->buf + sizeof(row), t->data, t->size);
+
+	hdr.lsn = 0;
+	hdr.tm = w->tm;
+	hdr.len = len;
+	hdr.crc32_data = crc32c(0, (unsigned char *)w->buf, len);
+	hdr.crc32_hdr = crc32c(0, (unsigned char *)&hdr.lsn,
+			       sizeof(hdr) - sizeof(hdr.crc32_hdr));
+	if (fwrite(&ts_row_marker, sizeof(ts_row_marker), 1, w->f) != 1 ||
+	    fwrite(&hdr, sizeof(hdr), 1, w->f) != 1 ||
+	    fwrite(w->buf, len, 1, w->f) != 1)
+		return -1;
+	if (++w->rows % 100000 == 0) {
+		printf("(snapshot) %.1fM rows written\r", w->rows / 1000000.);
+		fflush(stdout);
+	}
+	return 0;
+}
+
+static int
+ts_space_cmp(const void *_a, const void *_b)
+{
+	const struct ts_space *a = *(struct ts_space **)_a;
+	const struct ts_space *b = *(struct ts_space **)_b;
+	if (a->id == b->id)
+		return 0;
+	return (a->id > b->id) ? 1: -1;
+}
+
+/* write the spaces in the order of their numbers, as the server does */
+static int
+ts_snapshot_write(struct ts_spaces *s, struct ts_writer *w)
+{
+	struct ts_space **spaces = malloc(sizeof(struct ts_space *) *
+					  (mh_size(s->t) + 1));
+	if (spaces == NULL)
+		return -1;
+	int count = 0, i, rc = 0;
+	mh_int_t pos;
+	mh_foreach(s->t, pos)
+		spaces[count++] = mh_u32ptr_node(s->t, pos)->val;
+	qsort(spaces, count, sizeof(struct ts_space *), ts_space_cmp);
+
+	for (i = 0; i < count && rc == 0; i++) {
+		struct ts_space *space = spaces[i];
+		mh_foreach(space->hash, pos) {
+			struct ts_tuple *t = *mh_pk_node(space->hash, pos);
+			rc = ts_snapshot_write_row(w, space->id, t);
+			if (rc == -1)
+				break;
+		}
+	}
+	free(spaces);
+	return rc;
+}
+
+int ts_snapshot_save(struct ts_spaces *s, const char *dir, uint64_t lsn)
+{
+	char path[PATH_MAX], path_inprogress[PATH_MAX];
+	if (snprintf(path, sizeof(path), "%s/%020llu.snap", dir,
+		     (unsigned long long) lsn) >= (int) sizeof(path) ||
+	    snprintf(path_inprogress, sizeof(path_inprogress),
+		     "%s.inprogress", path) >= (int) sizeof(path_inprogress)) {
+		printf("snapshot path is too long: %s\n", dir);
+		return -1;
+	}
+	printf("(snapshot) saving %s\n", path);
+
+	if (access(path, F_OK) == 0) {
+		printf("snapshot %s already exists\n", path);
+		return -1;
+	}
+	int fd = open(path_inprogress, O_WRONLY | O_CREAT | O_EXCL, 0664);
+	if (fd == -1) {
+		printf("failed to create %s: %s\n", path_inprogress,
+		       strerror(errno));
+		return -1;
+	}
+	struct ts_writer w;
+	memset(&w, 0, sizeof(w));
+	w.f = fdopen(fd, "w");
+	if (w.f == NULL) {
+		close(fd);
+		goto error;
+	}
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	w.tm = tv.tv_sec + tv.tv_usec / 1000000.;
+
+	if (fputs(TNT_LOG_MAGIC_SNAP TNT_LOG_VERSION "\n", w.f) == EOF)
+		goto error;
+	if (ts_snapshot_write(s, &w) == -1)
+		goto error;
+	if (fwrite(&ts_eof_marker, sizeof(ts_eof_marker), 1, w.f) != 1)
+		goto error;
+	if (fflush(w.f) != 0 || fsync(fileno(w.f)) != 0)
+		goto error;
+	int rc = fclose(w.f);
+	w.f = NULL;
+	if (rc != 0)
+		goto error;
+	if (rename(path_inprogress, path) != 0)
+		goto error;
+	printf("(snapshot) %llu rows written\n", (unsigned long long) w.rows);
+	free(w.buf);
+	return 0;
+error:
+	printf("failed to write %s: %s\n", path_inprogress, strerror(errno));
+	if (w.f)
+		fclose(w.f);
+	unlink(path_inprogress);
+	free(w.buf);
+	return -1;
+}
@@ -0,0 +1,6 @@
+#ifndef TS_SNAPSHOT_H_INCLUDED
+#define TS_SNAPSHOT_H_INCLUDED
+
+int ts_snapshot_save(struct ts_spaces *s, const char *dir, uint64_t lsn);
+
+#endif
@@ -0,0 +1,345 @@
+
+/*
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <connector/c/include/tarantool/tnt.h>
+
+#include <cfg/prscfg.h>
+#include <cfg/tarantool_box_cfg.h>
+
+#include <third_party/murmur_hash2.c>
+
+#include "ts_tuple.h"
+#include "ts_hash.h"
+#include "ts_options.h"
+#include "ts_space.h"
+
+int ts_space_init(struct ts_spaces *s) {
+	s->t = mh_u32ptr_init();
+	if (s->t == NULL)
+		return -1;
+	return 0;
+}
+
+void ts_space_free(struct ts_spaces *s)
+{
+	mh_int_t i;
+	mh_foreach(s->t, i) {
+		struct ts_space *space = mh_u32ptr_node(s->t, i)->val;
+		mh_u32ptr_del(s->t, i, NULL, NULL);
+
+		mh_int_t pos;
+		mh_foreach(space->hash, pos)
+			free(*mh_pk_node(space->hash, pos));
+		mh_pk_destroy(space->hash);
+
+		free(space->pk.fields);
+		free(space);
+	}
+	mh_u32ptr_destroy(s->t);
+}
+
+struct ts_space *ts_space_create(struct ts_spaces *s, uint32_t id) {
+	struct ts_space *space = malloc(sizeof(struct ts_space));
+	if (space == NULL)
+		return NULL;
+	memset(space, 0, sizeof(struct ts_space));
+	space->id = id;
+	space->hash = mh_pk_init();
+	if (space->hash == NULL) {
+		free(space);
+		return NULL;
+	}
+	int ret;
+
+	const struct mh_u32ptr_node_t node = { .key = space->id, .val = space };
+	mh_u32ptr_put(s->t, &node, space, space, &ret);
+	return space;
+}
+
+struct ts_space *ts_space_match(struct ts_spaces *s, uint32_t id) {
+	const struct mh_u32ptr_node_t node = { .key = id };
+	mh_int_t k = mh_u32ptr_get(s->t, &node, NULL, NULL);
+	struct ts_space *space = NULL;
+	if (k != mh_end(s->t))
+		space = mh_u32ptr_node(s->t, k)->val;
+	return space;
+}
+
+static enum ts_space_key_type
+ts_space_key_typeof(char *name)
+{
+	if (strcmp(name, "NUM")  == 0)
+		return TS_SPACE_KEY_NUM;
+	else
+	if (strcmp(name, "NUM64")  == 0)
+		return TS_SPACE_KEY_NUM64;
+	else
+	if (strcmp(name, "STR")  == 0)
+		return TS_SPACE_KEY_STRING;
+	return TS_SPACE_KEY_UNKNOWN;
+}
+
+static int
+ts_space_key_init(struct ts_space *s, tarantool_cfg_space *cs)
+{
+	struct tarantool_cfg_space_index *primary = cs->index[0];
+
+	/* calculate primary key part count */
+	while (primary->key_field[s->pk.count]) {
+		if (primary->key_field[s->pk.count]->fieldno == -1)
+			break;
+		s->pk.count++;
+	}
+
+	/* allocate key fields */
+	s->pk.fields = calloc(s->pk.count, sizeof(struct ts_space_key_field));
+	if (s->pk.fields == NULL) {
+		printf("can't allocate key fields\n");
+		return -1;
+	}
+
+	/* init key fields */
+	int kn;
+	for (kn = 0; kn < s->pk.count; kn++) {
+		struct ts_space_key_field *k = &s->pk.fields[kn];
+		k->n = primary->key_field[kn]->fieldno;
+		k->type = ts_space_key_typeof(primary->key_field[kn]->type);
+	}
+	return 0;
+}
+
+static int
+ts_space_fillof(struct ts_spaces *s, int n, tarantool_cfg_space *cs)
+{
+	struct ts_space *space = ts_space_match(s, n);
+	if (space) {
+		printf("space %i is already defined\n", n);
+		return -1;
+	}
+	if (cs->index[0] == NULL) {
+		printf("primary index is not defined\n");
+		return -1;
+	}
+	space = ts_space_create(s, n);
+	if (space == NULL) {
+		printf("failed to create space %d\n", n);
+		return -1;
+	}
+	return ts_space_key_init(space, cs);
+}
+
+/*
+ * The memcached space is not in the configuration: the server
+ * creates it with a single string key on the first field.
+ */
+static int
+ts_space_fill_memcached(struct ts_spaces *s, int n)
+{
+	struct ts_space *space = ts_space_match(s, n);
+	if (space) {
+		printf("space %i is already defined\n", n);
+		return -1;
+	}
+	space = ts_space_create(s, n);
+	if (space == NULL) {
+		printf("failed to create space %d\n", n);
+		return -1;
+	}
+	space->pk.fields = calloc(1, sizeof(struct ts_space_key_field));
+	if (space->pk.fields == NULL) {
+		printf("can't allocate key fields\n");
+		return -1;
+	}
+	space->pk.fields[0].type = TS_SPACE_KEY_STRING;
+	space->pk.fields[0].n = 0;
+	space->pk.count = 1;
+	return 0;
+}
+
+int ts_space_fill(struct ts_spaces *s, struct ts_options *opts)
+{
+	int i = 0;
+	for (; opts->cfg.space && opts->cfg.space[i]; i++) {
+		tarantool_cfg_space *cs = opts->cfg.space[i];
+		if (!CNF_STRUCT_DEFINED(cs) || !cs->enabled)
+			continue;
+		int rc = ts_space_fillof(s, i, cs);
+		if (rc == -1)
+			return -1;
+	}
+	if (opts->cfg.memcached_port != 0)
+		return ts_space_fill_memcached(s, opts->cfg.memcached_space);
+	return 0;
+}
+
+static char *
+ts_space_key_part(struct ts_space *s, const struct ts_tuple *t, int i, uint32_t *size)
+{
+	if (t->field_count == TS_TUPLE_KEY)
+		return ts_tuple_field(t, i, size);
+	return ts_tuple_field(t, s->pk.fields[i].n, size);
+}
+
+uint32_t
+ts_space_hash(const struct ts_tuple *t, struct ts_space *s)
+{
+	uint32_t h = 13;
+	int i;
+	for (i = 0; i < s->pk.count; i++) {
+		uint32_t size = 0;
+		char *part = ts_space_key_part(s, t, i, &size);
+		if (part != NULL)
+			h = MurmurHash2(part, size, h);
+	}
+	return h;
+}
+
+int
+ts_space_equal(const struct ts_tuple *a, const struct ts_tuple *b, struct ts_space *s)
+{
+	int i;
+	for (i = 0; i < s->pk.count; i++) {
+		uint32_t asize = 0, bsize = 0;
+		char *ap = ts_space_key_part(s, a, i, &asize);
+		char *bp = ts_space_key_part(s, b, i, &bsize);
+		if (ap == NULL || bp == NULL)
+			return ap == bp;
+		if (asize != bsize || memcmp(ap, bp, asize) != 0)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Make a search key of a request key. A 32-bit part of a
+ * 64-bit key is widened, as the server does.
+ */
+struct ts_tuple *
+ts_space_key(struct ts_space *s, struct tnt_tuple *t)
+{
+	if (t->cardinality < (uint32_t)s->pk.count)
+		return NULL;
+	struct ts_tuple *k = malloc(sizeof(struct ts_tuple) +
+				    t->size + s->pk.count * sizeof(uint32_t));
+	if (k == NULL)
+		return NULL;
+	k->field_count = TS_TUPLE_KEY;
+	char *p = t->data + sizeof(uint32_t), *end = t->data + t->size;
+	char *out = k->data;
+	int i;
+	for (i = 0; i < s->pk.count; i++) {
+		uint32_t size = 0;
+		int esize = tnt_enc_read(p, &size);
+		if (p >= end || esize == -1 || p + esize + size > end) {
+			free(k);
+			return NULL;
+		}
+		p += esize;
+		if (s->pk.fields[i].type == TS_SPACE_KEY_NUM64 &&
+		    size == sizeof(uint32_t)) {
+			uint64_t v = *(uint32_t *)p;
+			tnt_enc_write(out, sizeof(v));
+			out += tnt_enc_size(sizeof(v));
+			memcpy(out, &v, sizeof(v));
+			out += sizeof(v);
+		} else {
+			tnt_enc_write(out, size);
+			out += tnt_enc_size(size);
+			memcpy(out, p, size);
+			out += size;
+		}
+		p += size;
+	}
+	k->size = out - k->data;
+	return k;
+}
+
+int ts_space_replace(struct ts_space *s, struct ts_tuple *t)
+{
+	const struct ts_tuple *node = t;
+	mh_int_t pos = mh_pk_get(s->hash, &node, s, s);
+	if (pos != mh_end(s->hash)) {
+		struct ts_tuple **old = mh_pk_node(s->hash, pos);
+		free(*old);
+		*old = t;
+		return 0;
+	}
+	pos = mh_pk_put(s->hash, &node, s, s, NULL);
+	if (pos == mh_end(s->hash))
+		return -1;
+	return 0;
+}
+
+void ts_space_delete(struct ts_space *s, struct ts_tuple *key)
+{
+	const struct ts_tuple *node = key;
+	mh_int_t pos = mh_pk_get(s->hash, &node, s, s);
+	if (pos == mh_end(s->hash))
+		return;
+	free(*mh_pk_node(s->hash, pos));
+	mh_pk_del(s->hash, pos, s, s);
+}
+
+int ts_space_update(struct ts_space *s, struct ts_tuple *key,
+		    struct tnt_request_update *u)
+{
+	/* an update of a missing tuple is logged but does nothing */
+	const struct ts_tuple *node = key;
+	mh_int_t pos = mh_pk_get(s->hash, &node, s, s);
+	if (pos == mh_end(s->hash))
+		return 0;
+	struct ts_tuple **t_ptr = mh_pk_node(s->hash, pos);
+	struct ts_tuple *old = *t_ptr;
+	const char *error = NULL;
+	struct ts_tuple *t = ts_tuple_update(old, u, &error);
+	if (t == NULL) {
+		printf("update in space %d failed: %s\n", s->id, error);
+		return -1;
+	}
+	if (ts_space_equal(t, old, s)) {
+		*t_ptr = t;
+		free(old);
+		return 0;
+	}
+	/* the primary key has changed */
+	mh_pk_del(s->hash, pos, s, s);
+	free(old);
+	if (ts_space_replace(s, t) == -1) {
+		free(t);
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,51 @@
+#ifndef TS_SPACE_H_INCLUDED
+#define TS_SPACE_H_INCLUDED
+
+enum ts_space_key_type {
+	TS_SPACE_KEY_UNKNOWN = -1,
+	TS_SPACE_KEY_NUM = 0,
+	TS_SPACE_KEY_NUM64,
+	TS_SPACE_KEY_STRING
+};
+
+struct ts_space_key_field {
+	enum ts_space_key_type type;
+	int n;
+};
+
+struct ts_space_key {
+	struct ts_space_key_field *fields;
+	int count;
+};
+
+struct ts_space {
+	uint32_t id;
+	struct mh_pk_t *hash;
+	struct ts_space_key pk;
+};
+
+struct ts_spaces {
+	struct mh_u32ptr_t *t;
+};
+
+int ts_space_init(struct ts_spaces *s);
+void ts_space_free(struct ts_spaces *s);
+
+struct ts_space *ts_space_create(struct ts_spaces *s, uint32_t id);
+struct ts_space *ts_space_match(struct ts_spaces *s, uint32_t id);
+
+struct ts_options;
+
+int ts_space_fill(struct ts_spaces *s, struct ts_options *opts);
+
+struct tnt_tuple;
+struct tnt_request_update;
+
+struct ts_tuple *ts_space_key(struct ts_space *s, struct tnt_tuple *t);
+
+int ts_space_replace(struct ts_space *s, struct ts_tuple *t);
+void ts_space_delete(struct ts_space *s, struct ts_tuple *key);
+int ts_space_update(struct ts_space *s, struct ts_tuple *key,
+		    struct tnt_request_update *u);
+
+#endif
@@ -0,0 +1,326 @@
+
+/*
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <connector/c/include/tarantool/tnt.h>
+
+#include "ts_tuple.h"
+
+/* update operation codes, as in the server */
+enum ts_update_op {
+	TS_UPDATE_SET = 0,
+	TS_UPDATE_ADD,
+	TS_UPDATE_AND,
+	TS_UPDATE_XOR,
+	TS_UPDATE_OR,
+	TS_UPDATE_SPLICE,
+	TS_UPDATE_DELETE,
+	TS_UPDATE_INSERT,
+	TS_UPDATE_SUBTRACT
+};
+
+/* a field of a tuple being updated */
+struct ts_field {
+	char *data;
+	uint32_t size;
+	/* data, if it is a result of an operation */
+	char *mem;
+};
+
+struct ts_tuple *
+ts_tuple_new(uint32_t field_count, const char *data, uint32_t size)
+{
+	struct ts_tuple *t = malloc(sizeof(struct ts_tuple) + size);
+	if (t == NULL)
+		return NULL;
+	t->field_count = field_count;
+	t->size = size;
+	memcpy(t->data, data, size);
+	return t;
+}
+
+char *
+ts_tuple_field(const struct ts_tuple *t, uint32_t n, uint32_t *size)
+{
+	char *p = (char *)t->data;
+	char *end = p + t->size;
+	uint32_t i;
+	for (i = 0; p < end; i++) {
+		uint32_t len = 0;
+		int esize = tnt_enc_read(p, &len);
+		if (esize == -1 || p + esize + len > end)
+			return NULL;
+		p += esize;
+		if (i == n) {
+			*size = len;
+			return p;
+		}
+		p += len;
+	}
+	return NULL;
+}
+
+static void
+ts_field_set(struct ts_field *f, char *data, uint32_t size, char *mem)
+{
+	free(f->mem);
+	f->data = data;
+	f->size = size;
+	f->mem = mem;
+}
+
+static const char *
+ts_update_arith(struct ts_field *f, struct tnt_request_update_op *op)
+{
+	char *mem = malloc(f->size);
+	if (mem == NULL)
+		return "out of memory";
+	if (f->size == sizeof(int32_t)) {
+		if (op->size != sizeof(int32_t)) {
+			free(mem);
+			return "argument type mismatch: expected 32-bit int";
+		}
+		int32_t a = *(int32_t *)f->data;
+		int32_t b = *(int32_t *)op->data;
+		int32_t *r = (int32_t *)mem;
+		switch (op->op) {
+		case TS_UPDATE_ADD: *r = a + b; break;
+		case TS_UPDATE_SUBTRACT: *r = a - b; break;
+		case TS_UPDATE_AND: *r = a & b; break;
+		case TS_UPDATE_XOR: *r = a ^ b; break;
+		case TS_UPDATE_OR: *r = a | b; break;
+		}
+	} else if (f->size == sizeof(int64_t)) {
+		int64_t b;
+		if (op->size == sizeof(int32_t)) {
+			b = *(int32_t *)op->data;
+		} else if (op->size == sizeof(int64_t)) {
+			b = *(int64_t *)op->data;
+		} else {
+			free(mem);
+			return "argument type mismatch: expected 32-bit or 64-bit int";
+		}
+		int64_t a = *(int64_t *)f->data;
+		int64_t *r = (int64_t *)mem;
+		switch (op->op) {
+		case TS_UPDATE_ADD: *r = a + b; break;
+		case TS_UPDATE_SUBTRACT: *r = a - b; break;
+		case TS_UPDATE_AND: *r = a & b; break;
+		case TS_UPDATE_XOR: *r = a ^ b; break;
+		case TS_UPDATE_OR: *r = a | b; break;
+		}
+	} else {
+		free(mem);
+		return "field type mismatch: expected 32-bit or 64-bit int";
+	}
+	ts_field_set(f, mem, f->size, mem);
+	return NULL;
+}
+
+/* read a varint-prefixed value off the splice argument */
+static char *
+ts_splice_arg(char **p, char *end, uint32_t *size)
+{
+	if (*p >= end)
+		return NULL;
+	int esize = tnt_enc_read(*p, size);
+	if (esize == -1 || *p + esize + *size > end)
+		return NULL;
+	char *data = *p + esize;
+	*p = data + *size;
+	return data;
+}
+
+static const char *
+ts_update_splice(struct ts_field *f, struct tnt_request_update_op *op)
+{
+	char *p = op->data, *end = op->data + op->size;
+	uint32_t size;
+	char *arg = ts_splice_arg(&p, end, &size);
+	if (arg == NULL || size != sizeof(int32_t))
+		return "illegal splice offset";
+	int32_t offset = *(int32_t *)arg;
+	if (offset < 0) {
+		if (-offset > (int64_t)f->size)
+			return "splice offset is out of bound";
+		offset += f->size;
+	} else if (offset > (int64_t)f->size) {
+		offset = f->size;
+	}
+	arg = ts_splice_arg(&p, end, &size);
+	if (arg == NULL || size != sizeof(int32_t))
+		return "illegal splice length";
+	int32_t cut = *(int32_t *)arg;
+	if (cut < 0) {
+		if (-cut > (int64_t)f->size - offset)
+			cut = 0;
+		else
+			cut += f->size - offset;
+	} else if (cut > (int64_t)f->size - offset) {
+		cut = f->size - offset;
+	}
+	uint32_t paste_size;
+	char *paste = ts_splice_arg(&p, end, &paste_size);
+	if (paste == NULL || p != end)
+		return "field splice format error";
+
+	uint32_t tail = f->size - offset - cut;
+	uint32_t new_size = offset + paste_size + tail;
+	char *mem = malloc(new_size ? new_size : 1);
+	if (mem == NULL)
+		return "out of memory";
+	memcpy(mem, f->data, offset);
+	memcpy(mem + offset, paste, paste_size);
+	memcpy(mem + offset + paste_size, f->data + offset + cut, tail);
+	ts_field_set(f, mem, new_size, mem);
+	return NULL;
+}
+
+/*
+ * Apply the operations one after another, with the same
+ * semantics and field number checks as the server.
+ */
+static const char *
+ts_update_ops(struct ts_field *f, uint32_t *count, struct tnt_request_update *u)
+{
+	uint32_t i;
+	for (i = 0; i < u->opc; i++) {
+		struct tnt_request_update_op *op = &u->opv[i];
+		uint32_t n = op->field;
+		const char *error = NULL;
+		switch (op->op) {
+		case TS_UPDATE_SET:
+			if (n < *count) {
+				ts_field_set(&f[n], op->data, op->size, NULL);
+				break;
+			}
+			/* A set of the next field is an insert. */
+			/* Fall through. */
+		case TS_UPDATE_INSERT:
+			if (n == UINT32_MAX)
+				n = *count;
+			if (n > *count)
+				return "field not found";
+			memmove(f + n + 1, f + n, (*count - n) * sizeof(*f));
+			f[n].data = op->data;
+			f[n].size = op->size;
+			f[n].mem = NULL;
+			(*count)++;
+			break;
+		case TS_UPDATE_DELETE:
+			if (*count == 0)
+				return "field not found";
+			if (n == UINT32_MAX)
+				n = *count - 1;
+			if (n >= *count)
+				return "field not found";
+			free(f[n].mem);
+			memmove(f + n, f + n + 1, (*count - n - 1) * sizeof(*f));
+			(*count)--;
+			break;
+		case TS_UPDATE_ADD:
+		case TS_UPDATE_SUBTRACT:
+		case TS_UPDATE_AND:
+		case TS_UPDATE_XOR:
+		case TS_UPDATE_OR:
+			if (n >= *count)
+				return "field not found";
+			error = ts_update_arith(&f[n], op);
+			break;
+		case TS_UPDATE_SPLICE:
+			if (n >= *count)
+				return "field not found";
+			error = ts_update_splice(&f[n], op);
+			break;
+		default:
+			return "unknown update operation";
+		}
+		if (error != NULL)
+			return error;
+	}
+	return NULL;
+}
+
+struct ts_tuple *
+ts_tuple_update(struct ts_tuple *t, struct tnt_request_update *u,
+		const char **error)
+{
+	/* each operation adds at most one field */
+	struct ts_field *f = calloc(t->field_count + u->opc + 1,
+				    sizeof(struct ts_field));
+	if (f == NULL) {
+		*error = "out of memory";
+		return NULL;
+	}
+	struct ts_tuple *result = NULL;
+	uint32_t count = 0, i;
+	char *p = t->data, *end = t->data + t->size;
+	for (; count < t->field_count; count++) {
+		int esize = tnt_enc_read(p, &f[count].size);
+		if (p >= end || esize == -1 ||
+		    p + esize + f[count].size > end) {
+			*error = "bad tuple";
+			goto done;
+		}
+		f[count].data = p + esize;
+		p += esize + f[count].size;
+	}
+	*error = ts_update_ops(f, &count, u);
+	if (*error != NULL)
+		goto done;
+
+	uint32_t size = 0;
+	for (i = 0; i < count; i++)
+		size += tnt_enc_size(f[i].size) + f[i].size;
+	result = malloc(sizeof(struct ts_tuple) + size);
+	if (result == NULL) {
+		*error = "out of memory";
+		goto done;
+	}
+	result->field_count = count;
+	result->size = size;
+	p = result->data;
+	for (i = 0; i < count; i++) {
+		tnt_enc_write(p, f[i].size);
+		p += tnt_enc_size(f[i].size);
+		memcpy(p, f[i].data, f[i].size);
+		p += f[i].size;
+	}
+done:
+	for (i = 0; i < count; i++)
+		free(f[i].mem);
+	free(f);
+	return result;
+}
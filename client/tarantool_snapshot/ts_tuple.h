@@ -0,0 +1,29 @@
+#ifndef TS_TUPLE_H_INCLUDED
+#define TS_TUPLE_H_INCLUDED
+
+/*
+ * A tuple is kept in the form it has in a snapshot row: the
+ * field count and the fields, each prefixed with its varint
+ * length.
+ */
+struct ts_tuple {
+	uint32_t field_count;
+	uint32_t size;
+	char data[];
+};
+
+/*
+ * The field count of a search key: a tuple which holds only
+ * the primary key parts, in key order.
+ */
+#define TS_TUPLE_KEY UINT32_MAX
+
+struct tnt_request_update;
+
+struct ts_tuple *ts_tuple_new(uint32_t field_count, const char *data, uint32_t size);
+char *ts_tuple_field(const struct ts_tuple *t, uint32_t n, uint32_t *size);
+
+struct ts_tuple *ts_tuple_update(struct ts_tuple *t, struct tnt_request_update *u,
+				 const char **error);
+
+#endif
@@ -33,6 +33,8 @@
 #define TNT_LOG_MAGIC_XLOG "XLOG\n"
 #define TNT_LOG_MAGIC_SNAP "SNAP\n"
 #define TNT_LOG_VERSION "0.11\n"
+/* v11 rows in compressed blocks */
+#define TNT_LOG_VERSION_BLOCKS "0.12\n"
 
 enum tnt_log_error {
 	TNT_LOG_EOK,
@@ -53,6 +55,14 @@ struct tnt_log_header_v11 {
 	uint32_t crc32_data;
 } __attribute__((packed));
 
+struct tnt_log_block_header_v12 {
+	uint32_t marker;
+	uint32_t crc32_hdr;
+	uint32_t len;
+	uint32_t raw_len;
+	uint32_t crc32_data;
+} __attribute__((packed));
+
 struct tnt_log_row_v11 {
 	uint16_t tag;
 	uint64_t cookie;
@@ -28,7 +28,13 @@
  * SUCH DAMAGE.
  */
 
+/* fopencookie(), unless the build has defined it already. */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
@@ -38,6 +44,7 @@
 #include <errno.h>
 
 #include <third_party/crc32.h>
+#include <third_party/lzf/lzf.h>
 
 #include <connector/c/include/tarantool/tnt.h>
 #include <connector/c/include/tarantool/tnt_log.h>
@@ -213,6 +220,176 @@ tnt_log_open_err(struct tnt_log *l, enum tnt_log_error e) {
 	return -1;
 }
 
+#if defined(HAVE_FOPENCOOKIE)
+
+static const uint32_t tnt_log_marker_block_v12 = 0xb10cb10c;
+
+/*
+ * Reading of compressed (0.12) logs: the file is a sequence of
+ * blocks of v11 rows, followed by the eof marker. The blocks are
+ * decompressed one by one and served through a FILE, so that
+ * the rest of the reader works the same for both versions.
+ * Seeking is possible within the current block only.
+ */
+struct tnt_log_blocks {
+	FILE *fd;
+	char *data;
+	size_t size;
+	size_t pos;
+	/* offset of the current block in the stream of rows */
+	off_t offset;
+};
+
+/* returns 0 on success, 1 on eof, -1 on error */
+static int
+tnt_log_block_next(struct tnt_log_blocks *b)
+{
+	struct tnt_log_block_header_v12 hdr;
+	char *data = NULL, *buf = NULL;
+	if (fread(&hdr.marker, sizeof(hdr.marker), 1, b->fd) != 1)
+		return ferror(b->fd) ? -1 : 1;
+	if (hdr.marker == tnt_log_marker_eof_v11) {
+		/* passing eof marker through */
+		data = tnt_mem_alloc(sizeof(hdr.marker));
+		if (data == NULL)
+			return -1;
+		memcpy(data, &hdr.marker, sizeof(hdr.marker));
+		hdr.raw_len = sizeof(hdr.marker);
+		goto done;
+	}
+	size_t crc_offset = offsetof(struct tnt_log_block_header_v12, len);
+	if (hdr.marker != tnt_log_marker_block_v12 ||
+	    fread((char*)&hdr + sizeof(hdr.marker),
+		  sizeof(hdr) - sizeof(hdr.marker), 1, b->fd) != 1 ||
+	    hdr.crc32_hdr != crc32c(0, (unsigned char*)&hdr + crc_offset,
+				    sizeof(hdr) - crc_offset) ||
+	    hdr.len > hdr.raw_len)
+		goto corrupt;
+	buf = tnt_mem_alloc(hdr.len);
+	if (buf == NULL)
+		return -1;
+	if (fread(buf, hdr.len, 1, b->fd) != 1) {
+		tnt_mem_free(buf);
+		return ferror(b->fd) ? -1 : 1;
+	}
+	if (crc32c(0, (unsigned char*)buf, hdr.len) != hdr.crc32_data)
+		goto corrupt;
+	if (hdr.len == hdr.raw_len) {
+		/* stored uncompressed */
+		data = buf;
+		goto done;
+	}
+	data = tnt_mem_alloc(hdr.raw_len);
+	if (data == NULL) {
+		tnt_mem_free(buf);
+		return -1;
+	}
+	if (lzf_decompress(buf, hdr.len, data, hdr.raw_len) != hdr.raw_len) {
+		tnt_mem_free(data);
+		goto corrupt;
+	}
+	tnt_mem_free(buf);
+done:
+	b->offset += b->size;
+	if (b->data)
+		tnt_mem_free(b->data);
+	b->data = data;
+	b->size = hdr.raw_len;
+	b->pos = 0;
+	return 0;
+corrupt:
+	if (buf)
+		tnt_mem_free(buf);
+	errno = EBADMSG;
+	return -1;
+}
+
+static ssize_t
+tnt_log_block_read(void *cookie, char *buf, size_t size)
+{
+	struct tnt_log_blocks *b = cookie;
+	size_t done = 0;
+	while (done < size) {
+		if (b->pos == b->size) {
+			int rc = tnt_log_block_next(b);
+			if (rc == -1 && done == 0)
+				return -1;
+			if (rc != 0)
+				break;
+		}
+		size_t n = size - done;
+		if (n > b->size - b->pos)
+			n = b->size - b->pos;
+		memcpy(buf + done, b->data + b->pos, n);
+		b->pos += n;
+		done += n;
+	}
+	return done;
+}
+
+static int
+tnt_log_block_seek(void *cookie, off64_t *offset, int whence)
+{
+	struct tnt_log_blocks *b = cookie;
+	off_t target;
+	switch (whence) {
+	case SEEK_SET:
+		target = *offset;
+		break;
+	case SEEK_CUR:
+		target = b->offset + b->pos + *offset;
+		break;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+	if (target < b->offset || target > b->offset + (off_t)b->size) {
+		errno = EINVAL;
+		return -1;
+	}
+	b->pos = target - b->offset;
+	*offset = target;
+	return 0;
+}
+
+static int
+tnt_log_block_close(void *cookie)
+{
+	struct tnt_log_blocks *b = cookie;
+	int rc = fclose(b->fd);
+	if (b->data)
+		tnt_mem_free(b->data);
+	tnt_mem_free(b);
+	return rc;
+}
+
+static int
+tnt_log_open_blocks(struct tnt_log *l)
+{
+	struct tnt_log_blocks *b = tnt_mem_alloc(sizeof(struct tnt_log_blocks));
+	if (b == NULL)
+		return tnt_log_seterr(l, TNT_LOG_EMEMORY);
+	memset(b, 0, sizeof(struct tnt_log_blocks));
+	b->fd = l->fd;
+	b->offset = ftello(l->fd);
+	cookie_io_functions_t io = {
+		.read = tnt_log_block_read,
+		.write = NULL,
+		.seek = tnt_log_block_seek,
+		.close = tnt_log_block_close
+	};
+	FILE *fd = fopencookie(b, "r", io);
+	if (fd == NULL) {
+		tnt_mem_free(b);
+		return tnt_log_seterr(l, TNT_LOG_ESYSTEM);
+	}
+	setvbuf(fd, NULL, _IONBF, 0);
+	l->fd = fd;
+	return 0;
+}
+
+#endif /* HAVE_FOPENCOOKIE */
+
 enum tnt_log_error
 tnt_log_open(struct tnt_log *l, char *file, enum tnt_log_type type)
 {
@@ -250,7 +427,12 @@ tnt_log_open(struct tnt_log *l, char *file, enum tnt_log_type type)
 	if (strcmp(filetype, magic))
 		return tnt_log_open_err(l, TNT_LOG_ETYPE);
 	/* checking version */
-	if (strcmp(version, TNT_LOG_VERSION))
+	int blocks = strcmp(version, TNT_LOG_VERSION_BLOCKS) == 0;
+#if !defined(HAVE_FOPENCOOKIE)
+	if (blocks)
+		return tnt_log_open_err(l, TNT_LOG_EVERSION);
+#endif
+	if (!blocks && strcmp(version, TNT_LOG_VERSION))
 		return tnt_log_open_err(l, TNT_LOG_EVERSION);
 	for (;;) {
 		char buf[256];
@@ -260,6 +442,13 @@ tnt_log_open(struct tnt_log *l, char *file, enum tnt_log_type type)
 		if (strcmp(rc, "\n") == 0 || strcmp(rc, "\r\n") == 0)
 			break;
 	}
+#if defined(HAVE_FOPENCOOKIE)
+	/* reading rows from compressed blocks */
+	if (blocks && tnt_log_open_blocks(l) == -1) {
+		tnt_log_close(l);
+		return -1;
+	}
+#endif
 	/* getting current offset */
 	l->offset = ftello(l->fd);
 	return 0;
@@ -57,6 +57,22 @@
  * Defined if fdatasync(2) call is present.
  */
 #cmakedefine HAVE_FDATASYNC 1
+/*
+ * Defined if fallocate(2) call is present.
+ */
+#cmakedefine HAVE_FALLOCATE 1
+/*
+ * Defined if sync_file_range(2) call is present.
+ */
+#cmakedefine HAVE_SYNC_FILE_RANGE 1
+/*
+ * Defined if posix_fadvise(2) call is present.
+ */
+#cmakedefine HAVE_POSIX_FADVISE 1
+/*
+ * Defined if fopencookie(3) is present.
+ */
+#cmakedefine HAVE_FOPENCOOKIE 1
 /*
  * Defined if this platform has GNU specific memmem().
  */
@@ -65,6 +81,10 @@
  * Defined if this platform has GNU specific memrchr().
  */
 #cmakedefine HAVE_MEMRCHR 1
+/*
+ * Defined if this is Linux with inotify_init1(2).
+ */
+#cmakedefine HAVE_INOTIFY_INIT1 1
 /*
  * Set if this is a GNU system and libc has __libc_stack_end.
  */
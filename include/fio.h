@@ -139,6 +139,57 @@ fio_lseek(int fd, off_t offset, int whence);
 int
 fio_truncate(int fd, off_t offset);
 
+/**
+ * Reserve disk blocks for the first len bytes of a file
+ * without changing the file size, so that appends within
+ * the reserved range do not allocate blocks, and the
+ * subsequent fdatasync() has less metadata to flush.
+ * The reservation beyond the end of data is dropped
+ * by fio_truncate().
+ *
+ * @return 0 on success, or if the operation is not
+ *         supported by the platform or the file system,
+ *         -1 on error.
+ */
+int
+fio_preallocate(int fd, off_t len);
+
+/**
+ * Initiate write-out of dirty pages in the given range of
+ * a file, and return without waiting for it to complete.
+ * Does not flush file metadata, and is not a replacement for
+ * fsync(): its purpose is to leave less dirty data for
+ * the next fsync() to wait for.
+ *
+ * @return 0 on success, or if the operation is not
+ *         supported by the platform, -1 on error.
+ */
+int
+fio_writeback(int fd, off_t offset, off_t len);
+
+/**
+ * Start reading the given range of a file into the page
+ * cache, and return without waiting for it to complete.
+ * len == 0 stands for "up to the end of file".
+ *
+ * @return 0 on success, or if the operation is not
+ *         supported by the platform, -1 on error.
+ */
+int
+fio_readahead(int fd, off_t offset, off_t len);
+
+/**
+ * Wait until the given range of a file is on disk and drop it
+ * from the page cache, so that data which won't be read back
+ * soon does not push out pages which will.
+ * len == 0 stands for "up to the end of file".
+ *
+ * @return 0 on success, or if the operation is not
+ *         supported by the platform, -1 on error.
+ */
+int
+fio_evict(int fd, off_t offset, off_t len);
+
 /**
  * A helper wrapper around writev() to do batched
  * writes.
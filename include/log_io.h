@@ -37,35 +37,144 @@
 
 extern const u32 default_version;
 
+/**
+ * A replica asks for an LZF-compressed replication stream by
+ * setting this flag in the LSN it subscribes from. A master
+ * which can compress answers with lzf_replication_version and
+ * sends the rows as a sequence of struct replication_block.
+ * An older master answers with default_version, and has no
+ * rows to send from such a far away LSN.
+ */
+#define REPLICATION_LZF_FLAG (1LL << 62)
+extern const u32 lzf_replication_version;
+
+/**
+ * A new replica, which has no snapshot, asks the master for one
+ * by setting this flag in the LSN it subscribes from. A master
+ * which can send it sets REPLICATION_JOIN_VERSION in the version
+ * it answers with, sends the rows of its newest snapshot and a
+ * JOIN_EOF row with the LSN of the snapshot, and then the rows
+ * which follow, as to any replica.
+ */
+#define REPLICATION_JOIN_FLAG (1LL << 61)
+enum { REPLICATION_JOIN_VERSION = 0x20000 };
+
+/**
+ * A replica which takes heartbeats sets this flag. A master
+ * which sends them sets REPLICATION_HEARTBEAT_VERSION, and sends
+ * a HEARTBEAT row, with the LSN of the last row sent, whenever it
+ * has had nothing to send for a second.
+ */
+#define REPLICATION_HEARTBEAT_FLAG (1LL << 60)
+enum { REPLICATION_HEARTBEAT_VERSION = 0x40000 };
+
+/**
+ * A replica which confirms the rows it has written sets this
+ * flag. A master which reads the confirmations sets
+ * REPLICATION_ACK_VERSION. The replica then sends the LSN of the
+ * last row of every burst of rows it has written to its WAL, an
+ * i64 each, without waiting for anything.
+ */
+#define REPLICATION_ACK_FLAG (1LL << 59)
+enum { REPLICATION_ACK_VERSION = 0x80000 };
+
+/**
+ * A replica which needs the rows of some spaces only sets this
+ * flag, and sends the number of the spaces and the space numbers
+ * after the LSN, a u32 each. A master which drops the rows of
+ * other spaces sets REPLICATION_SPACES_VERSION.
+ */
+#define REPLICATION_SPACES_FLAG (1LL << 58)
+enum {
+	REPLICATION_SPACES_VERSION = 0x100000,
+	REPLICATION_SPACES_MAX = 256
+};
+
+#define REPLICATION_LSN_FLAGS (REPLICATION_LZF_FLAG | \
+			       REPLICATION_JOIN_FLAG | \
+			       REPLICATION_HEARTBEAT_FLAG | \
+			       REPLICATION_ACK_FLAG | \
+			       REPLICATION_SPACES_FLAG)
+
 enum log_format { XLOG = 65534, SNAP = 65535, ARCH = 65533 };
 
+/**
+ * Tags of rows which only go to replicas: the end of the snapshot
+ * sent to a new replica, and a heartbeat of an idle master.
+ */
+enum { JOIN_EOF = 65532, HEARTBEAT = 65531 };
+
 
 enum log_mode {
 	LOG_READ,
 	LOG_WRITE
 };
 
-enum log_suffix { NONE, INPROGRESS };
+enum log_suffix { NONE, INPROGRESS, SPARE };
+extern const char inprogress_suffix[];
+
+enum { LOG_DIR_STRIPES_MAX = 16, LOG_PARTS_MAX = 64 };
+/** How many files a striped directory remembers the stripe of. */
+enum { LOG_DIR_STRIPE_CACHE = 64 };
+
+/**
+ * A WAL gets an index entry every so many bytes, so that a
+ * reader which starts at a given LSN can skip to the nearest
+ * entry instead of reading the file from the beginning.
+ */
+enum { LOG_INDEX_STEP = 64 * 1024 };
 
 struct log_dir {
 	bool panic_if_error;
 
 	/* Additional flags to apply at open(2) to write. */
 	int  open_wflags;
+	/** Write new files as compressed blocks of rows. */
+	bool compress;
+	/**
+	 * Drop written data from the page cache as soon as it
+	 * is on disk: such files are not read back any time soon.
+	 */
+	bool drop_cache;
 	const char *filetype;
 	const char *filename_ext;
 	char *dirname;
+	/**
+	 * Additional directories, usually on other disks.
+	 * New files are created in dirname and stripes in
+	 * turn, lookups search all of them.
+	 */
+	char *stripes[LOG_DIR_STRIPES_MAX];
+	int stripe_count;
+	/** Where to create the next file, 0 stands for dirname. */
+	unsigned next_stripe;
+	/**
+	 * The stripes of the files seen last, so that a lookup
+	 * doesn't try every stripe: (lsn << 5) | stripe at
+	 * lsn % LOG_DIR_STRIPE_CACHE, 0 if none.
+	 */
+	i64 stripe_cache[LOG_DIR_STRIPE_CACHE];
 };
 
 extern struct log_dir snap_dir;
 extern struct log_dir wal_dir;
+extern struct log_dir delta_dir;
 
+ssize_t
+scan_dir(struct log_dir *dir, i64 **ret_lsn);
 i64
 greatest_lsn(struct log_dir *dir);
 char *
 format_filename(struct log_dir *dir, i64 lsn, enum log_suffix suffix);
 i64
 find_including_file(struct log_dir *dir, i64 target_lsn);
+void
+log_dir_readahead(struct log_dir *dir, const i64 *lsns, ssize_t count,
+		  i64 lsn);
+int
+log_dir_add_stripes(struct log_dir *dir, const char *dirnames);
+void
+log_dir_free_stripes(struct log_dir *dir);
 
 struct log_io {
 	struct log_dir *dir;
@@ -77,24 +186,93 @@ struct log_io {
 	char filename[PATH_MAX + 1];
 
 	bool is_inprogress;
+	/** The EOF marker is written and the file is synced. */
+	bool is_finished;
+	/**
+	 * Disk space reserved for the file at open, in bytes.
+	 * What remains unused is given back at close.
+	 */
+	off_t preallocated;
+	/** The end of the range last handed to fio_writeback(). */
+	off_t writeback_offset;
+	/** The end of the range dropped from the page cache. */
+	off_t evict_offset;
+	/** Bytes appended since the last fio_writeback(). */
+	size_t writeback_pending;
+	/**
+	 * The file is a sequence of compressed blocks of rows
+	 * (version 0.12). When reading, f returns the rows as
+	 * they'd be in a plain file.
+	 */
+	bool is_compressed;
+	/**
+	 * The number of files of a snapshot written in parts,
+	 * 0 for a plain file. Only set in the first part.
+	 */
+	int part_count;
+	/**
+	 * The LSN of the snapshot or delta snapshot a delta
+	 * snapshot is based on, 0 for other files.
+	 */
+	i64 base_lsn;
+	/**
+	 * The index of a WAL being written, <filename>.index:
+	 * a sequence of (LSN, offset) pairs of some of the
+	 * rows. Created with the first entry, -1 if not open.
+	 */
+	int index_fd;
+	/** Don't try to write the index after an error. */
+	bool no_index;
+	/** Bytes written since the last index entry. */
+	size_t index_pending;
+	/** Scratch space of log_io_write_block(). */
+	char *block_buf;
+	size_t block_buf_size;
+	void *lzf_state;
 };
 
 
 int log_io_write_header(struct log_io *l);
+int log_io_append_header(struct log_io *l, const char *line);
+int log_io_write_block(struct log_io *l, const void *rows, size_t len);
 
 struct log_io *
 log_io_open_for_read(struct log_dir *dir, i64 lsn, enum log_suffix suffix);
 struct log_io *
 log_io_open_for_write(struct log_dir *dir, i64 lsn, enum log_suffix suffix);
 struct log_io *
+log_io_open_part_for_read(struct log_dir *dir, i64 lsn, int part);
+struct log_io *
+log_io_open_part_for_write(struct log_dir *dir, i64 lsn, int part);
+struct log_io *
 log_io_open(struct log_dir *dir, enum log_mode mode,
 	    const char *filename, enum log_suffix suffix, FILE *file);
 int
 log_io_sync(struct log_io *l);
 int
+log_io_preallocate(struct log_io *l, off_t size);
+void
+log_io_writeback(struct log_io *l, size_t bytes, size_t threshold);
+/**
+ * Write the EOF marker of a file open for write, give back the
+ * space reserved for it, sync it and drop the '.inprogress'
+ * suffix. The file stays open; log_io_close() finishes the
+ * file itself unless it is finished already.
+ */
+void
+log_io_finish(struct log_io *l);
+int
 log_io_close(struct log_io **lptr);
 void
+log_io_discard(struct log_io **lptr);
+void
 log_io_atfork(struct log_io **lptr);
+off_t
+log_io_index_offset(struct log_io *l);
+void
+log_io_index_add(struct log_io *l, i64 lsn, off_t offset, size_t bytes);
+void
+log_io_seek_lsn(struct log_io *l, i64 lsn);
 
 struct log_io_cursor
 {
@@ -102,6 +280,23 @@ struct log_io_cursor
 	int row_count;
 	off_t good_offset;
 	bool eof_read;
+	/**
+	 * The file mapped into memory, or NULL if the file
+	 * is read with stdio. Rows are handed out in place.
+	 */
+	char *map;
+	size_t map_size;
+	/** Pages before this offset are given back to the OS. */
+	off_t map_released;
+	/** Checks rows ahead of the cursor, may be NULL. */
+	struct log_io_verifier *verifier;
+	/** Rows before this offset are known to be intact. */
+	off_t verified;
+	/**
+	 * Don't map a grown file again at EOF: the rows handed
+	 * out so far point into the mapping and are still in use.
+	 */
+	bool keep_map;
 };
 
 void
@@ -110,6 +305,12 @@ void
 log_io_cursor_close(struct log_io_cursor *i);
 struct tbuf *
 log_io_cursor_next(struct log_io_cursor *i);
+/**
+ * Check if the mapped file is complete: it ends with an EOF
+ * marker, and so will not grow and be mapped again.
+ */
+bool
+log_io_cursor_is_complete(struct log_io_cursor *i);
 
 typedef u32 log_magic_t;
 
@@ -150,6 +351,39 @@ row_v11_fill(struct row_v11 *row, u64 lsn, u16 tag, u64 cookie,
 	     const void *metadata, size_t metadata_len, const void
 	     *data, size_t data_len);
 
+/**
+ * A block of a compressed log: a number of whole v11 rows,
+ * followed by the LZF-compressed data. If the data does not
+ * compress, it is stored as is, with len == raw_len.
+ */
+struct block_header_v12 {
+	log_magic_t marker;
+	/** crc32c of the rest of the header. */
+	u32 header_crc32c;
+	/** Size of the stored data. */
+	u32 len;
+	/** Size of the rows. */
+	u32 raw_len;
+	/** crc32c of the stored data. */
+	u32 data_crc32c;
+} __attribute__((packed));
+
+/**
+ * A block of a compressed replication stream: the next up to
+ * REPLICATION_BLOCK_MAX bytes of the usual stream of rows,
+ * compressed with LZF. Blocks don't follow row boundaries. If
+ * the data does not compress, it is sent as is, with
+ * len == raw_len.
+ */
+struct replication_block {
+	/** Size of the data which follows. */
+	u32 len;
+	/** Size of the data when decompressed. */
+	u32 raw_len;
+} __attribute__((packed));
+
+enum { REPLICATION_BLOCK_MAX = 64 * 1024 };
+
 static inline size_t
 row_v11_size(struct row_v11 *row)
 {
@@ -161,4 +395,9 @@ inprogress_log_unlink(char *filename);
 int
 inprogress_log_rename(struct log_io *l);
 
+struct log_io *
+spare_log_create(struct log_dir *dir);
+int
+spare_log_rename(struct log_io *l, i64 lsn);
+
 #endif /* TARANTOOL_LOG_IO_H_INCLUDED */
@@ -69,6 +69,32 @@ struct remote {
 	struct fiber *reader;
 	u64 cookie;
 	ev_tstamp recovery_lag, recovery_last_update_tstamp;
+	/** Rows being applied, and waiting for the WAL. */
+	int rows_in_flight;
+	/** Ask the master for an LZF-compressed stream. */
+	bool compress;
+	/** Receiving the snapshot of the master. */
+	bool is_joining;
+	/** Ask the master for heartbeats. */
+	bool heartbeat;
+	/** Confirm the rows written to the WAL to the master. */
+	bool ack;
+	/** Receive the rows of these spaces only, if any. */
+	u32 *spaces;
+	u32 space_count;
+	/** Rows applied per second. */
+	double apply_rate;
+	/**
+	 * The average time to apply a burst of rows, and the
+	 * part of it spent waiting for the WAL.
+	 */
+	ev_tstamp apply_latency, wal_wait;
+	/** Accumulated since tstamp, for the numbers above. */
+	struct {
+		u64 rows;
+		int bursts;
+		ev_tstamp apply, wal, tstamp;
+	} window;
 };
 
 enum wal_mode { WAL_NONE = 0, WAL_WRITE, WAL_FSYNC, WAL_FSYNC_DELAY, WAL_MODE_MAX };
@@ -82,6 +108,7 @@ struct recovery_state {
 	struct log_io *current_wal;
 	struct log_dir *snap_dir;
 	struct log_dir *wal_dir;
+	struct log_dir *delta_dir;
 	struct wal_writer *writer;
 	struct wal_watcher *watcher;
 	struct remote *remote;
@@ -115,6 +142,7 @@ void recovery_update_io_rate_limit(struct recovery_state *r,
 				   double new_limit);
 void recovery_free();
 void recover_snap(struct recovery_state *);
+void recover_deltas(struct recovery_state *);
 void recover_existing_wals(struct recovery_state *);
 void recovery_follow_local(struct recovery_state *r, ev_tstamp wal_dir_rescan_delay);
 void recovery_finalize(struct recovery_state *r);
@@ -122,6 +150,8 @@ int wal_write(struct recovery_state *r, i64 lsn, u64 cookie,
 	      u16 op, struct tbuf *data);
 
 void recovery_setup_panic(struct recovery_state *r, bool on_snap_error, bool on_wal_error);
+void recovery_setup_wal_stripes(struct recovery_state *r, const char *dirnames);
+void recovery_setup_snap_compress(struct recovery_state *r, bool compress);
 
 void confirm_lsn(struct recovery_state *r, int64_t lsn, bool is_commit);
 int64_t next_lsn(struct recovery_state *r);
@@ -133,7 +163,15 @@ int read_log(const char *filename,
 	     row_handler xlog_handler, row_handler snap_handler,
 	     void *param);
 
-void recovery_follow_remote(struct recovery_state *r, const char *addr);
+void recovery_follow_remote(struct recovery_state *r, const char *addr,
+			    bool compress, const char *spaces);
+/**
+ * Parse a list of space numbers separated by commas.
+ *
+ * @return the number of spaces, -1 if the list is malformed or
+ *         longer than REPLICATION_SPACES_MAX.
+ */
+int remote_parse_spaces(const char *list, u32 *spaces);
 void recovery_stop_remote(struct recovery_state *r);
 
 struct fio_batch;
@@ -141,7 +179,16 @@ struct fio_batch;
 void snapshot_write_row(struct log_io *i, struct fio_batch *batch,
 			const void *metadata, size_t metadata_size,
 			const void *data, size_t data_size);
-void snapshot_save(struct recovery_state *r,
-		   void (*loop) (struct log_io *, struct fio_batch *));
+/** Write the rows of part `part' out of `part_count'. */
+typedef void (*snapshot_part_f)(struct log_io *, struct fio_batch *,
+				int part, int part_count);
+int snapshot_save(struct recovery_state *r, i64 lsn, int part_count,
+		  snapshot_part_f f);
+void delta_write_row(struct log_io *l, struct fio_batch *batch,
+		     const void *metadata, size_t metadata_size,
+		     const void *data, size_t data_size);
+i64 snapshot_last(struct recovery_state *r, int *delta_count);
+int snapshot_save_delta(struct recovery_state *r, i64 base_lsn, i64 lsn,
+			snapshot_part_f f);
 
 #endif /* TARANTOOL_RECOVERY_H_INCLUDED */
@@ -30,6 +30,32 @@
  */
 #include <tarantool.h>
 #include <util.h>
+#include <netinet/in.h>
+
+struct tbuf;
+
+/**
+ * Statistics of a replica, kept by the relay which feeds it, in
+ * memory shared by the relay processes with the main one.
+ */
+struct relay_stat {
+	/** The relay process, 0 if the slot is free. */
+	pid_t pid;
+	struct sockaddr_in peer;
+	/** The LSN of the last row sent. */
+	i64 lsn;
+	u64 rows;
+	u64 bytes;
+	/** Bytes waiting to be sent, in the relay and the socket. */
+	u64 send_queue;
+	/** The LSN the replica has confirmed to have written. */
+	i64 ack_lsn;
+};
+
+enum { RELAY_STAT_MAX = 64 };
+
+/** RELAY_STAT_MAX slots, NULL if replication is off. */
+extern struct relay_stat *relay_stats;
 
 /**
  * Check replication configuration.
@@ -57,5 +83,18 @@ replication_prefork();
 void
 replication_init();
 
+/**
+ * Wait till replication_sync_quorum replicas confirm that they
+ * have written the row with the LSN, for at most
+ * replication_sync_timeout seconds. Once the time is out,
+ * commits don't wait till the replicas catch up.
+ */
+void
+replication_sync(i64 lsn);
+
+/** Print the statistics of replicas for 'show info'. */
+void
+replication_info(struct tbuf *out);
+
 #endif // TARANTOOL_REPLICATION_H_INCLUDED
 
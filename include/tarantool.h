@@ -45,7 +45,11 @@ i32 mod_check_config(struct tarantool_cfg *conf);
 i32 mod_reload_config(struct tarantool_cfg *old_conf, struct tarantool_cfg *new_conf);
 void mod_lua_load_cfg(struct lua_State *L);
 int mod_cat(const char *filename);
-void mod_snapshot(struct log_io *, struct fio_batch *batch);
+void mod_snapshot(struct log_io *, struct fio_batch *batch,
+		  int part, int part_count);
+i64 mod_snapshot_delta_base(void);
+void mod_snapshot_freeze(i64 delta_base);
+void mod_snapshot_release(void);
 void mod_info(struct tbuf *out);
 const char *mod_status(void);
 
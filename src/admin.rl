@@ -40,6 +40,7 @@
 #include <tarantool.h>
 #include "lua/init.h"
 #include <recovery.h>
+#include <replication.h>
 #include <tbuf.h>
 #include <util.h>
 #include <errinj.h>
@@ -162,7 +163,14 @@ tarantool_info(struct tbuf *out)
 	tbuf_printf(out, "  recovery_last_update: %.3f" CRLF,
 		    recovery_state->remote ?
 		    recovery_state->remote->recovery_last_update_tstamp :0);
+	struct remote *remote = recovery_state->remote;
+	if (remote != NULL)
+		tbuf_printf(out, "  replica: { apply_rate: %.1f, "
+			    "apply_latency: %.6f, wal_wait: %.6f }" CRLF,
+			    remote->apply_rate, remote->apply_latency,
+			    remote->wal_wait);
 	mod_info(out);
+	replication_info(out);
 	const char *path = cfg_filename_fullpath;
 	if (path == NULL)
 		path = cfg_filename;
@@ -32,6 +32,8 @@
 struct txn;
 struct tbuf;
 struct port;
+struct space;
+struct tuple;
 
 typedef void (*mod_process_func)(struct port *, u32, struct tbuf *);
 extern mod_process_func mod_process;
@@ -47,4 +49,7 @@ struct box_snap_row {
 void
 mod_leave_local_standby_mode(void *data __attribute__((unused)));
 
+void
+box_mark_dirty(struct space *sp, struct tuple *tuple);
+
 #endif /* INCLUDES_TARANTOOL_BOX_H */
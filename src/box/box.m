@@ -48,6 +48,8 @@
 #include "request.h"
 #include "txn.h"
 #include "archive.h"
+#include <assoc.h>
+#include <fiber.h>
 
 static void box_process_replica(struct port *port,
 				u32 op, struct tbuf *request_data);
@@ -61,9 +63,23 @@ mod_process_func mod_process_ro = box_process_ro;
 const char *mod_name = "Box";
 
 static char status[64] = "unknown";
+/**
+ * How long it took a local hot standby to become primary
+ * once it got hold of the primary port, in seconds. Negative
+ * if this server was never a hot standby.
+ */
+static ev_tstamp failover_time = -1;
 
 static int stat_base;
 
+/**
+ * Keys of the tuples replaced or deleted since the newest
+ * snapshot or delta snapshot, for the next delta: (varint
+ * length, space number, primary key fields) => the LSN of the
+ * last change. NULL unless delta snapshots are on.
+ */
+static struct mh_lstrptr_t *snapshot_dirty;
+
 
 
 static inline struct box_snap_row *
@@ -113,6 +129,10 @@ box_process_replica(struct port *port, u32 op, struct tbuf *request_data)
 		tnt_raise(ClientError, :ER_NONMASTER,
 			  cfg.replication_source);
 	}
+	/* The snapshot of the master is being received. */
+	if (primary_indexes_enabled == false)
+		tnt_raise(ClientError, :ER_UNSUPPORTED,
+			  "A joining replica", "requests");
 	return box_process_rw(port, op, request_data);
 }
 
@@ -274,6 +294,24 @@ recover_snap_row(struct tbuf *t)
 	tuple_ref(tuple, 1);
 }
 
+/**
+ * The snapshot of the master is received by a new replica:
+ * finish the indexes, and save the snapshot, so that the replica
+ * doesn't have to join again when restarted.
+ */
+static void
+box_end_join(i64 lsn)
+{
+	end_build_primary_indexes();
+	say_info("building secondary indexes");
+	build_secondary_indexes();
+	set_lsn(recovery_state, lsn);
+	say_info("the snapshot of the master is received, lsn: %" PRIi64,
+		 lsn);
+	if (snapshot(NULL, 0) != 0)
+		panic("can't save the snapshot of the master");
+}
+
 static int
 recover_row(void *param __attribute__((unused)), struct tbuf *t)
 {
@@ -290,6 +328,8 @@ recover_row(void *param __attribute__((unused)), struct tbuf *t)
 		read_u64(t); /* drop cookie */
 		if (tag == SNAP) {
 			recover_snap_row(t);
+		} else if (tag == JOIN_EOF) {
+			box_end_join(header->lsn);
 		} else if (tag == XLOG) {
 			u16 op = read_u16(t);
             arc_save_real_tm(header->tm);
@@ -315,7 +355,9 @@ box_enter_master_or_replica_mode(struct tarantool_cfg *conf)
 		mod_process = box_process_replica;
 
 		recovery_wait_lsn(recovery_state, recovery_state->lsn);
-		recovery_follow_remote(recovery_state, conf->replication_source);
+		recovery_follow_remote(recovery_state, conf->replication_source,
+				       conf->replication_compress,
+				       conf->replication_spaces);
 
 		snprintf(status, sizeof(status), "replica/%s%s",
 			 conf->replication_source, custom_proc_title);
@@ -335,12 +377,26 @@ box_enter_master_or_replica_mode(struct tarantool_cfg *conf)
 void
 mod_leave_local_standby_mode(void *data __attribute__((unused)))
 {
+	/*
+	 * A hot standby has been applying the master's WALs to
+	 * all indexes, primary and secondary: it only needs to
+	 * read the rows it hasn't seen yet and start the WAL
+	 * writer.
+	 */
+	ev_tstamp start = ev_time();
+
 	recovery_finalize(recovery_state);
 
 	recovery_update_mode(recovery_state, cfg.wal_mode,
 			     cfg.wal_fsync_delay);
     arc_start();
 	box_enter_master_or_replica_mode(&cfg);
+
+	if (cfg.local_hot_standby) {
+		failover_time = ev_time() - start;
+		say_info("left local hot standby in %.3f sec, lsn: %" PRIi64,
+			 failover_time, recovery_state->confirmed_lsn);
+	}
 }
 
 i32
@@ -370,6 +426,14 @@ mod_check_config(struct tarantool_cfg *conf)
 		}
 	}
 
+	u32 spaces[REPLICATION_SPACES_MAX];
+	if (conf->replication_spaces != NULL &&
+	    remote_parse_spaces(conf->replication_spaces, spaces) < 0) {
+		out_warning(0, "replication_spaces is not a list of "
+			    "space numbers separated by commas");
+		return -1;
+	}
+
 	/* check primary port */
 	if (conf->primary_port != 0 &&
 	    (conf->primary_port <= 0 || conf->primary_port >= USHRT_MAX)) {
@@ -420,6 +484,13 @@ mod_reload_config(struct tarantool_cfg *old_conf, struct tarantool_cfg *new_conf
 
 			return -1;
 		}
+		if (primary_indexes_enabled == false) {
+			out_warning(0, "Could not propagate %s before the "
+				    "snapshot of the master is received",
+				    old_is_replica == true ? "slave to master" :
+				    "master to slave");
+			return -1;
+		}
 
 		if (!old_is_replica && new_is_replica)
 			memcached_stop_expire();
@@ -460,15 +531,33 @@ mod_init(void)
 		      init_storage ? RECOVER_READONLY : 0);
 	recovery_update_io_rate_limit(recovery_state, cfg.snap_io_rate_limit);
 	recovery_setup_panic(recovery_state, cfg.panic_on_snap_error, cfg.panic_on_wal_error);
+	recovery_setup_snap_compress(recovery_state, cfg.snap_compress);
+	if (cfg.wal_stripe_dirs != NULL)
+		recovery_setup_wal_stripes(recovery_state, cfg.wal_stripe_dirs);
 
 	stat_base = stat_register(requests_strs, requests_MAX);
 
 	if (init_storage)
 		return;
 
+	if (cfg.deltas_per_snap > 0)
+		snapshot_dirty = mh_lstrptr_init();
+
 	begin_build_primary_indexes();
+	if (cfg.replication_source != NULL &&
+	    greatest_lsn(recovery_state->snap_dir) <= 0 &&
+	    greatest_lsn(recovery_state->wal_dir) <= 0) {
+		/*
+		 * A new replica: the snapshot comes from the master,
+		 * the primary keys are built as it arrives.
+		 */
+		say_info("no snapshot, will join %s", cfg.replication_source);
+		title("orphan");
+		return;
+	}
 	recover_snap(recovery_state);
 	end_build_primary_indexes();
+	recover_deltas(recovery_state);
 	recover_existing_wals(recovery_state);
 
 	stat_cleanup(stat_base, requests_MAX);
@@ -520,9 +609,324 @@ snapshot_space(struct space *sp, void *udata)
 		snapshot_write_tuple(ud->l, ud->batch, space_n(sp), tuple);
 }
 
+/** Remember that the tuple is about to be replaced or deleted. */
 void
-mod_snapshot(struct log_io *l, struct fio_batch *batch)
+box_mark_dirty(struct space *sp, struct tuple *tuple)
 {
+	if (snapshot_dirty == NULL || tuple == NULL)
+		return;
+
+	struct key_def *key_def = space_index(sp, 0)->key_def;
+	u32 n = space_n(sp);
+	u32 size = sizeof(n);
+	for (int i = 0; i < key_def->part_count; i++) {
+		void *field = tuple_field(tuple, key_def->parts[i].fieldno);
+		void *data = field;
+		u32 len = load_varint32(&data);
+		size += (u8 *) data - (u8 *) field + len;
+	}
+	u8 *key = palloc(fiber->gc_pool, varint32_sizeof(size) + size);
+	u8 *pos = save_varint32(key, size);
+	memcpy(pos, &n, sizeof(n));
+	pos += sizeof(n);
+	for (int i = 0; i < key_def->part_count; i++) {
+		void *field = tuple_field(tuple, key_def->parts[i].fieldno);
+		void *data = field;
+		u32 len = load_varint32(&data);
+		len += (u8 *) data - (u8 *) field;
+		memcpy(pos, field, len);
+		pos += len;
+	}
+	/*
+	 * The change gets the next LSN: there is no yield
+	 * between here and txn_commit().
+	 */
+	struct mh_lstrptr_node_t node = {
+		.key = key, .val = (void *) (intptr_t) (recovery_state->lsn + 1)
+	};
+	mh_int_t k = mh_lstrptr_get(snapshot_dirty, &node, NULL, NULL);
+	if (k != mh_end(snapshot_dirty)) {
+		node.key = mh_lstrptr_node(snapshot_dirty, k)->key;
+	} else {
+		size_t key_size = pos - key;
+		node.key = malloc(key_size);
+		if (node.key == NULL)
+			tnt_raise(LoggedError, :ER_MEMORY_ISSUE, key_size,
+				  "delta snapshot", "key");
+		memcpy(node.key, key, key_size);
+	}
+	k = mh_lstrptr_put(snapshot_dirty, &node, NULL, NULL, NULL);
+	if (k == mh_end(snapshot_dirty)) {
+		free(node.key);
+		tnt_raise(LoggedError, :ER_MEMORY_ISSUE, (ssize_t) k,
+			  "delta snapshot", "key");
+	}
+}
+
+/** Forget the changes saved in the snapshot at the given LSN. */
+static void
+snapshot_dirty_forget(i64 lsn)
+{
+	mh_int_t k;
+	mh_foreach(snapshot_dirty, k) {
+		const struct mh_lstrptr_node_t *node =
+			mh_lstrptr_node(snapshot_dirty, k);
+		if ((intptr_t) node->val > lsn)
+			continue;
+		free(node->key);
+		mh_lstrptr_del(snapshot_dirty, k, NULL, NULL);
+	}
+}
+
+static void
+snapshot_count_tuples(struct space *sp, void *udata)
+{
+	*(size_t *) udata += [space_index(sp, 0) size];
+}
+
+/**
+ * Choose between a full and a delta snapshot.
+ *
+ * @return the LSN of the snapshot the next one is a delta
+ *         of, or 0 to save a full snapshot.
+ */
+i64
+mod_snapshot_delta_base(void)
+{
+	if (snapshot_dirty == NULL)
+		return 0;
+
+	int delta_count;
+	i64 base = snapshot_last(recovery_state, &delta_count);
+	if (base <= 0)
+		return 0;
+	snapshot_dirty_forget(base);
+	if (delta_count >= cfg.deltas_per_snap ||
+	    base >= recovery_state->confirmed_lsn)
+		return 0;
+	/* A delta of most of the data is no cheaper. */
+	size_t tuple_count = 0;
+	space_foreach(snapshot_count_tuples, &tuple_count);
+	if (mh_size(snapshot_dirty) * 2 > tuple_count)
+		return 0;
+	return base;
+}
+
+/**
+ * A read view of all spaces for a snapshot written by a thread:
+ * the tuples of every space, in primary key order, as of the
+ * moment the view was taken. Tuple data is never changed in
+ * place, and tuples are not freed while the view exists, so the
+ * thread can read them while the transaction processor goes on.
+ */
+struct snapshot_space_view {
+	u32 n;
+	size_t tuple_count;
+	struct tuple **tuples;
+};
+
+/**
+ * A changed key of a delta snapshot: the tuple with this key as
+ * of the moment the view was taken, or NULL if it's deleted.
+ */
+struct snapshot_change {
+	u32 n;
+	int part_count;
+	u32 key_size;
+	void *key;
+	struct tuple *tuple;
+};
+
+static struct snapshot_view {
+	struct snapshot_space_view *spaces;
+	int space_count;
+	int space_size;
+	/** Tuples in all spaces. */
+	size_t tuple_count;
+	/** The base of a delta snapshot, 0 for a full one. */
+	i64 delta_base;
+	struct snapshot_change *changes;
+	size_t change_count;
+} *snapshot_view;
+
+static void
+snapshot_view_add_space(struct space *sp, void *udata)
+{
+	struct snapshot_view *view = udata;
+	assert(view->space_count < view->space_size);
+	struct snapshot_space_view *sv = &view->spaces[view->space_count++];
+	Index *pk = space_index(sp, 0);
+
+	sv->n = space_n(sp);
+	sv->tuple_count = 0;
+	sv->tuples = malloc(([pk size] + 1) * sizeof(struct tuple *));
+	if (sv->tuples == NULL)
+		panic("can't allocate a read view of space %" PRIu32, sv->n);
+
+	struct tuple *tuple;
+	struct iterator *it = pk->position;
+	[pk initIterator: it :ITER_ALL :NULL :0];
+	while ((tuple = it->next(it)))
+		sv->tuples[sv->tuple_count++] = tuple;
+	view->tuple_count += sv->tuple_count;
+}
+
+static void
+snapshot_view_count_space(struct space *sp __attribute__((unused)),
+			  void *udata)
+{
+	++((struct snapshot_view *) udata)->space_size;
+}
+
+/** Look up the current tuples of the changed keys. */
+static void
+snapshot_view_add_changes(struct snapshot_view *view)
+{
+	view->changes = malloc((mh_size(snapshot_dirty) + 1) *
+			       sizeof(*view->changes));
+	if (view->changes == NULL)
+		panic("can't allocate a delta snapshot read view");
+
+	mh_int_t k;
+	mh_foreach(snapshot_dirty, k) {
+		const struct mh_lstrptr_node_t *node =
+			mh_lstrptr_node(snapshot_dirty, k);
+		if ((intptr_t) node->val <= view->delta_base)
+			continue;
+		struct snapshot_change *change =
+			&view->changes[view->change_count++];
+		void *key = node->key;
+		u32 size = load_varint32(&key);
+		memcpy(&change->n, key, sizeof(change->n));
+		change->key = (u8 *) key + sizeof(change->n);
+		change->key_size = size - sizeof(change->n);
+
+		Index *pk = space_index(space_find(change->n), 0);
+		change->part_count = pk->key_def->part_count;
+		change->tuple = [pk findByKey: change->key
+				 :change->part_count];
+		if (change->tuple != NULL && change->tuple->flags & GHOST)
+			change->tuple = NULL;
+	}
+}
+
+/**
+ * Take a read view of all spaces, or of the tuples changed since
+ * delta_base if it's not 0, for mod_snapshot() to write from
+ * another thread. Must be followed by mod_snapshot_release()
+ * once the snapshot is written.
+ */
+void
+mod_snapshot_freeze(i64 delta_base)
+{
+	assert(snapshot_view == NULL);
+	/* --init-storage switch */
+	if (primary_indexes_enabled == false)
+		return;
+
+	struct snapshot_view *view = calloc(1, sizeof(*view));
+	if (view == NULL)
+		panic("can't allocate a snapshot read view");
+	view->delta_base = delta_base;
+	if (delta_base > 0) {
+		snapshot_view_add_changes(view);
+	} else {
+		space_foreach(snapshot_view_count_space, view);
+		view->spaces = calloc(view->space_size + 1,
+				      sizeof(*view->spaces));
+		if (view->spaces == NULL)
+			panic("can't allocate a snapshot read view");
+		space_foreach(snapshot_view_add_space, view);
+	}
+
+	tuple_begin_deferred_free();
+	snapshot_view = view;
+}
+
+void
+mod_snapshot_release(void)
+{
+	struct snapshot_view *view = snapshot_view;
+	if (view == NULL)
+		return;
+
+	snapshot_view = NULL;
+	for (int i = 0; i < view->space_count; i++)
+		free(view->spaces[i].tuples);
+	free(view->spaces);
+	free(view->changes);
+	free(view);
+	tuple_end_deferred_free();
+}
+
+/** A REPLACE or DELETE request of a delta snapshot. */
+struct delta_row {
+	u16 op;
+	u32 space;
+	u32 flags;
+	/* Tuple or key cardinality. */
+	u32 field_count;
+} __attribute__((packed));
+
+static void
+snapshot_write_change(struct log_io *l, struct fio_batch *batch,
+		      struct snapshot_change *change)
+{
+	struct delta_row row = { .space = change->n, .flags = 0 };
+	struct tuple *tuple = change->tuple;
+
+	if (tuple != NULL) {
+		row.op = REPLACE;
+		row.field_count = tuple->field_count;
+		delta_write_row(l, batch, &row, sizeof(row),
+				tuple->data, tuple->bsize);
+	} else {
+		row.op = DELETE;
+		row.field_count = change->part_count;
+		delta_write_row(l, batch, &row, sizeof(row),
+				change->key, change->key_size);
+	}
+}
+
+/**
+ * Write a part of the snapshot. The tuples of the read view, if
+ * any, are split into part_count ranges of about the same size,
+ * so that parts can be written at once. Without a read view, the
+ * snapshot can't be split. A delta snapshot is the changes since
+ * its base, and is written in one part.
+ */
+void
+mod_snapshot(struct log_io *l, struct fio_batch *batch,
+	     int part, int part_count)
+{
+	if (snapshot_view != NULL && snapshot_view->delta_base > 0) {
+		assert(part == 0 && part_count == 1);
+		for (size_t i = 0; i < snapshot_view->change_count; i++)
+			snapshot_write_change(l, batch,
+					      &snapshot_view->changes[i]);
+		return;
+	}
+	if (snapshot_view != NULL) {
+		size_t total = snapshot_view->tuple_count;
+		size_t begin = total * part / part_count;
+		size_t end = total * (part + 1) / part_count;
+		/* The number of tuples in the spaces before this one. */
+		size_t pos = 0;
+		for (int i = 0; i < snapshot_view->space_count; i++) {
+			struct snapshot_space_view *sv =
+				&snapshot_view->spaces[i];
+			size_t j = begin > pos ? begin - pos : 0;
+			for (; j < sv->tuple_count && pos + j < end; j++)
+				snapshot_write_tuple(l, batch, sv->n,
+						     sv->tuples[j]);
+			pos += sv->tuple_count;
+		}
+		return;
+	}
+	assert(part == 0 && part_count == 1);
+	(void) part;
+	(void) part_count;
+
 	/* --init-storage switch */
 	if (primary_indexes_enabled == false)
 		return;
@@ -536,6 +940,8 @@ void
 mod_info(struct tbuf *out)
 {
 	tbuf_printf(out, "  status: %s" CRLF, status);
+	if (failover_time >= 0)
+		tbuf_printf(out, "  failover_time: %.3f" CRLF, failover_time);
 }
 
 
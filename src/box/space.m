@@ -37,6 +37,9 @@
 #include <pickle.h>
 #include <palloc.h>
 #include <assoc.h>
+#include <signal.h>
+#include <tarantool_pthread.h>
+#include <unistd.h>
 
 static struct mh_i32ptr_t *spaces;
 
@@ -403,42 +406,113 @@ begin_build_primary_indexes(void)
 	}
 }
 
-void
-end_build_primary_indexes(void)
+enum { SPACE_BUILD_THREADS_MAX = 32 };
+
+/** A job for space_build_parallel(). */
+struct space_build {
+	struct space **spaces;
+	int space_count;
+	/** The next space to take, shared by all threads. */
+	int next;
+	void (*build)(struct space *space);
+};
+
+static void *
+space_build_thread(void *arg)
 {
-	mh_int_t i;
-	mh_foreach(spaces, i) {
-		struct space *space = mh_i32ptr_node(spaces, i)->val;
-		Index *index = space->index[0];
-		[index endBuild];
+	struct space_build *job = arg;
+	int n;
+
+	while ((n = __sync_fetch_and_add(&job->next, 1)) < job->space_count) {
+		struct space *space = job->spaces[n];
+		@try {
+			job->build(space);
+		} @catch (tnt_Exception *e) {
+			[e log];
+			panic("can't build indexes of space %d", space->no);
+		}
 	}
-	primary_indexes_enabled = true;
+	return NULL;
 }
 
-void
-build_secondary_indexes(void)
+/**
+ * Run an index build function on every space, using as many
+ * threads as there are CPUs. Spaces are independent, and
+ * index builds don't allocate from the slab or use the
+ * fiber, so they can run in parallel. The calling thread
+ * works too, and waits for all the others to finish.
+ */
+static void
+space_build_parallel(void (*build)(struct space *space))
 {
-	assert(primary_indexes_enabled == true);
-	assert(secondary_indexes_enabled == false);
+	struct space_build job = { .build = build };
+	pthread_t threads[SPACE_BUILD_THREADS_MAX];
+	int thread_count = 0;
 
+	job.spaces = malloc(mh_size(spaces) * sizeof(struct space *));
+	if (job.spaces == NULL)
+		panic("can't allocate the list of spaces");
 	mh_int_t i;
-	mh_foreach(spaces, i) {
-		struct space *space = mh_i32ptr_node(spaces, i)->val;
+	mh_foreach(spaces, i)
+		job.spaces[job.space_count++] = mh_i32ptr_node(spaces, i)->val;
+
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	int max_threads = MIN(MIN(ncpu, job.space_count),
+			      SPACE_BUILD_THREADS_MAX + 1) - 1;
+	/* It's fine to do with fewer threads, or no threads at all. */
+	while (thread_count < max_threads &&
+	       tt_pthread_create(&threads[thread_count], NULL,
+				 space_build_thread, &job) == 0)
+		thread_count++;
+
+	space_build_thread(&job);
+
+	for (int j = 0; j < thread_count; j++) {
+		if (tt_pthread_join(threads[j], NULL) != 0)
+			panic_syserror("index build: thread join failed");
+	}
+	free(job.spaces);
+}
 
-		if (space->key_count <= 1)
-			continue; /* no secondary keys */
+static void
+space_end_build_primary_index(struct space *space)
+{
+	Index *index = space->index[0];
+	[index endBuild];
+}
 
-		say_info("Building secondary keys in space %d...", space->no);
+void
+end_build_primary_indexes(void)
+{
+	space_build_parallel(space_end_build_primary_index);
+	primary_indexes_enabled = true;
+}
 
-		Index *pk = space->index[0];
-		for (int j = 1; j < space->key_count; j++) {
-			Index *index = space->index[j];
-			[index build: pk];
-		}
+static void
+space_build_secondary_indexes(struct space *space)
+{
+	if (space->key_count <= 1)
+		return; /* no secondary keys */
 
-		say_info("Space %d: done", space->no);
+	say_info("Building secondary keys in space %d...", space->no);
+
+	Index *pk = space->index[0];
+	for (int j = 1; j < space->key_count; j++) {
+		Index *index = space->index[j];
+		[index build: pk];
 	}
 
+	say_info("Space %d: done", space->no);
+}
+
+void
+build_secondary_indexes(void)
+{
+	assert(primary_indexes_enabled == true);
+	assert(secondary_indexes_enabled == false);
+
+	space_build_parallel(space_build_secondary_indexes);
+
 	/* enable secondary indexes now */
 	secondary_indexes_enabled = true;
 }
@@ -93,5 +93,7 @@ static inline size_t tuple_len(struct tuple *tuple)
 }
 
 void tuple_free(struct tuple *tuple);
+void tuple_begin_deferred_free(void);
+void tuple_end_deferred_free(void);
 #endif /* TARANTOOL_BOX_TUPLE_H_INCLUDED */
 
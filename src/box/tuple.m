@@ -28,6 +28,7 @@
  */
 #include "tuple.h"
 
+#include <stdlib.h>
 #include <pickle.h>
 #include <salloc.h>
 #include "tbuf.h"
@@ -48,6 +49,38 @@ tuple_alloc(size_t size)
 	return tuple;
 }
 
+/**
+ * While a snapshot is written from a read view, tuples
+ * released by the transaction processor must stay intact:
+ * they are only put aside and freed when the view is gone.
+ */
+static bool tuple_free_is_deferred;
+static struct tuple **deferred_tuples;
+static size_t deferred_count, deferred_size;
+
+/** Start deferring tuple_free() until tuple_end_deferred_free(). */
+void
+tuple_begin_deferred_free(void)
+{
+	assert(! tuple_free_is_deferred && deferred_count == 0);
+	tuple_free_is_deferred = true;
+}
+
+static void
+tuple_defer_free(struct tuple *tuple)
+{
+	if (deferred_count == deferred_size) {
+		size_t size = deferred_size ? deferred_size * 2 : 1024;
+		struct tuple **tuples = realloc(deferred_tuples,
+						size * sizeof(*tuples));
+		if (tuples == NULL)
+			panic("can't defer freeing of a tuple");
+		deferred_tuples = tuples;
+		deferred_size = size;
+	}
+	deferred_tuples[deferred_count++] = tuple;
+}
+
 /**
  * Free the tuple.
  * @pre tuple->refs  == 0
@@ -57,9 +90,29 @@ tuple_free(struct tuple *tuple)
 {
 	say_debug("tuple_free(%p)", tuple);
 	assert(tuple->refs == 0);
+	if (unlikely(tuple_free_is_deferred)) {
+		tuple_defer_free(tuple);
+		return;
+	}
 	sfree(tuple);
 }
 
+/**
+ * Free all tuples released while freeing was deferred and free
+ * tuples right away from now on.
+ */
+void
+tuple_end_deferred_free(void)
+{
+	assert(tuple_free_is_deferred);
+	tuple_free_is_deferred = false;
+	for (size_t i = 0; i < deferred_count; i++)
+		sfree(deferred_tuples[i]);
+	free(deferred_tuples);
+	deferred_tuples = NULL;
+	deferred_count = deferred_size = 0;
+}
+
 /**
  * Add count to tuple's reference counter.
  * When the counter goes down to 0, the tuple is destroyed.
@@ -27,9 +27,11 @@
  * SUCH DAMAGE.
  */
 #include "txn.h"
+#include "box.h"
 #include "tuple.h"
 #include "space.h"
 #include <recovery.h>
+#include <replication.h>
 #include <fiber.h>
 #include "archive.h"
 
@@ -65,6 +67,9 @@ txn_add_undo(struct txn *txn, struct space *space,
 {
 	/* txn_add_undo() must be done after txn_add_redo() */
 	assert(txn->op != 0);
+	/* Before any change, since it may fail. */
+	box_mark_dirty(space, old_tuple);
+	box_mark_dirty(space, new_tuple);
 	txn->new_tuple = new_tuple;
 	if (new_tuple == NULL && old_tuple == NULL) {
 		/*
@@ -108,6 +113,7 @@ txn_commit(struct txn *txn)
         arc_do_txn(txn);
 		if (res)
 			tnt_raise(LoggedError, :ER_WAL_IO);
+		replication_sync(lsn);
 	}
 }
 
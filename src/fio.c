@@ -30,6 +30,7 @@
 
 #include <sys/types.h>
 
+#include <fcntl.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
@@ -157,6 +158,93 @@ fio_truncate(int fd, off_t offset)
 	return rc;
 }
 
+int
+fio_preallocate(int fd, off_t len)
+{
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_KEEP_SIZE)
+	if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, len) == 0)
+		return 0;
+	if (errno == EOPNOTSUPP || errno == ENOSYS)
+		return 0; /* Not supported by the file system. */
+	say_syserror("fallocate, [%s]: len=%jd",
+		     fio_filename(fd), (intmax_t) len);
+	return -1;
+#else
+	(void) fd;
+	(void) len;
+	return 0;
+#endif
+}
+
+int
+fio_writeback(int fd, off_t offset, off_t len)
+{
+#if defined(HAVE_SYNC_FILE_RANGE)
+	if (sync_file_range(fd, offset, len, SYNC_FILE_RANGE_WRITE) == 0)
+		return 0;
+	if (errno == ENOSYS)
+		return 0;
+	say_syserror("sync_file_range, [%s]: offset=%jd, len=%jd",
+		     fio_filename(fd), (intmax_t) offset, (intmax_t) len);
+	return -1;
+#else
+	(void) fd;
+	(void) offset;
+	(void) len;
+	return 0;
+#endif
+}
+
+int
+fio_readahead(int fd, off_t offset, off_t len)
+{
+#if defined(HAVE_POSIX_FADVISE)
+	int rc = posix_fadvise(fd, offset, len, POSIX_FADV_WILLNEED);
+	if (rc == 0)
+		return 0;
+	errno = rc;
+	say_syserror("posix_fadvise, [%s]: offset=%jd, len=%jd",
+		     fio_filename(fd), (intmax_t) offset, (intmax_t) len);
+	return -1;
+#else
+	(void) fd;
+	(void) offset;
+	(void) len;
+	return 0;
+#endif
+}
+
+int
+fio_evict(int fd, off_t offset, off_t len)
+{
+#if defined(HAVE_SYNC_FILE_RANGE)
+	/* Dirty or in-flight pages are not dropped by fadvise. */
+	if (sync_file_range(fd, offset, len, SYNC_FILE_RANGE_WAIT_BEFORE |
+			    SYNC_FILE_RANGE_WRITE |
+			    SYNC_FILE_RANGE_WAIT_AFTER) != 0 &&
+	    errno != ENOSYS) {
+		say_syserror("sync_file_range, [%s]: offset=%jd, len=%jd",
+			     fio_filename(fd), (intmax_t) offset,
+			     (intmax_t) len);
+		return -1;
+	}
+#endif
+#if defined(HAVE_POSIX_FADVISE)
+	int rc = posix_fadvise(fd, offset, len, POSIX_FADV_DONTNEED);
+	if (rc == 0)
+		return 0;
+	errno = rc;
+	say_syserror("posix_fadvise, [%s]: offset=%jd, len=%jd",
+		     fio_filename(fd), (intmax_t) offset, (intmax_t) len);
+	return -1;
+#else
+	(void) fd;
+	(void) offset;
+	(void) len;
+	return 0;
+#endif
+}
+
 struct fio_batch *
 fio_batch_alloc(long max_iov)
 {
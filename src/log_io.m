@@ -29,17 +29,26 @@
 #include "log_io.h"
 #include <dirent.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "palloc.h"
 #include "fiber.h"
 #include "crc32.h"
 #include "fio.h"
+#include "tarantool_pthread.h"
+#include <third_party/lzf/lzf.h>
 
 const u32 default_version = 11;
+const u32 lzf_replication_version = 0x10000 | 11;
 const log_magic_t row_marker_v11 = 0xba0babed;
 const log_magic_t eof_marker_v11 = 0x10adab1e;
+const log_magic_t block_marker_v12 = 0xb10cb10c;
 const char inprogress_suffix[] = ".inprogress";
+const char spare_suffix[] = ".spare";
+const char index_suffix[] = ".index";
 const char v11[] = "0.11\n";
+const char v12[] = "0.12\n";
 
 void
 header_v11_sign(struct header_v11 *header)
@@ -69,7 +78,8 @@ row_v11_fill(struct row_v11 *row, u64 lsn, u16 tag, u64 cookie,
 
 struct log_dir snap_dir = {
 	.filetype = "SNAP\n",
-	.filename_ext = ".snap"
+	.filename_ext = ".snap",
+	.drop_cache = true
 };
 
 struct log_dir wal_dir = {
@@ -77,6 +87,17 @@ struct log_dir wal_dir = {
 	.filename_ext = ".xlog"
 };
 
+/**
+ * Delta snapshots: the tuples changed and deleted since the
+ * snapshot or delta snapshot named in the header, as REPLACE
+ * and DELETE rows. Kept next to snapshots.
+ */
+struct log_dir delta_dir = {
+	.filetype = "DELTA\n",
+	.filename_ext = ".delta",
+	.drop_cache = true
+};
+
 static int
 cmp_i64(const void *_a, const void *_b)
 {
@@ -86,63 +107,177 @@ cmp_i64(const void *_a, const void *_b)
 	return (*a > *b) ? 1 : -1;
 }
 
-static ssize_t
+/** The directory of the given stripe, 0 stands for dirname. */
+static const char *
+log_dir_stripe(struct log_dir *dir, int stripe)
+{
+	return stripe == 0 ? dir->dirname : dir->stripes[stripe - 1];
+}
+
+/**
+ * Add directories from a comma-separated list to the
+ * directories files of this type are spread over.
+ *
+ * @return 0 on success, -1 if there are too many
+ *         directories or a directory can't be accessed.
+ */
+int
+log_dir_add_stripes(struct log_dir *dir, const char *dirnames)
+{
+	char *list = strdup(dirnames);
+	char *saveptr = NULL;
+	int rc = -1;
+
+	if (list == NULL)
+		return -1;
+	for (char *name = strtok_r(list, ",", &saveptr); name != NULL;
+	     name = strtok_r(NULL, ",", &saveptr)) {
+		if (*name == '\0')
+			continue;
+		if (dir->stripe_count == LOG_DIR_STRIPES_MAX) {
+			say_error("too many directories in `%s'", dirnames);
+			goto out;
+		}
+		if (access(name, R_OK | W_OK | X_OK) != 0) {
+			say_syserror("can't access directory `%s'", name);
+			goto out;
+		}
+		dir->stripes[dir->stripe_count] = strdup(name);
+		if (dir->stripes[dir->stripe_count] == NULL)
+			goto out;
+		dir->stripe_count++;
+	}
+	rc = 0;
+out:
+	free(list);
+	return rc;
+}
+
+void
+log_dir_free_stripes(struct log_dir *dir)
+{
+	for (int i = 0; i < dir->stripe_count; i++)
+		free(dir->stripes[i]);
+	dir->stripe_count = 0;
+}
+
+/**
+ * Pick a stripe to create the next file in. The WAL writer
+ * and its helper thread both create files, hence the atomic.
+ */
+static int
+log_dir_next_stripe(struct log_dir *dir)
+{
+	if (dir->stripe_count == 0)
+		return 0;
+	unsigned stripe = __sync_fetch_and_add(&dir->next_stripe, 1);
+	return stripe % (dir->stripe_count + 1);
+}
+
+enum { STRIPE_BITS = 5 };
+
+/**
+ * Remember the stripe of the file starting with the LSN. The
+ * cache is shared by the WAL writer threads: an entry is one
+ * word, written and read atomically.
+ */
+static void
+log_dir_cache_stripe(struct log_dir *dir, i64 lsn, int stripe)
+{
+	if (dir->stripe_count == 0)
+		return;
+	i64 *entry = &dir->stripe_cache[lsn % LOG_DIR_STRIPE_CACHE];
+	(void) __sync_lock_test_and_set(entry, (lsn << STRIPE_BITS) | stripe);
+}
+
+/** The stripe of the file starting with the LSN, -1 if unknown. */
+static int
+log_dir_cached_stripe(struct log_dir *dir, i64 lsn)
+{
+	i64 *entry = &dir->stripe_cache[lsn % LOG_DIR_STRIPE_CACHE];
+	i64 value = __sync_fetch_and_add(entry, 0);
+	if (value == 0 || value >> STRIPE_BITS != lsn)
+		return -1;
+	return value & ((1 << STRIPE_BITS) - 1);
+}
+
+ssize_t
 scan_dir(struct log_dir *dir, i64 **ret_lsn)
 {
 	ssize_t result = -1;
 	size_t i = 0, size = 1024;
 	ssize_t ext_len = strlen(dir->filename_ext);
 	i64 *lsn = palloc(fiber->gc_pool, sizeof(i64) * size);
-	DIR *dh = opendir(dir->dirname);
+	const char *dirname = dir->dirname;
+	DIR *dh = NULL;
 
-	if (lsn == NULL || dh == NULL)
+	if (lsn == NULL)
 		goto out;
 
-	errno = 0;
-	struct dirent *dent;
-	while ((dent = readdir(dh)) != NULL) {
-
-		char *ext = strchr(dent->d_name, '.');
-		if (ext == NULL)
-		continue;
-
-		const char *suffix = strchr(ext + 1, '.');
-		/*
-		 * A valid ending is either .xlog or
-		 * .xlog.inprogress, given dir->filename_ext ==
-		 * 'xlog'.
-		 */
-		bool ext_is_ok;
-		if (suffix == NULL)
-			ext_is_ok = strcmp(ext, dir->filename_ext) == 0;
-		else
-			ext_is_ok = (strncmp(ext, dir->filename_ext,
-					     ext_len) == 0 &&
-				     strcmp(suffix, inprogress_suffix) == 0);
-		if (!ext_is_ok)
-			continue;
+	for (int stripe = 0; stripe <= dir->stripe_count; stripe++) {
+		dirname = log_dir_stripe(dir, stripe);
+		dh = opendir(dirname);
+		if (dh == NULL)
+			goto out;
 
-		lsn[i] = strtoll(dent->d_name, &ext, 10);
-		if (strncmp(ext, dir->filename_ext, ext_len) != 0) {
-			/* d_name doesn't parse entirely, ignore it */
-			say_warn("can't parse `%s', skipping", dent->d_name);
-			continue;
-		}
+		errno = 0;
+		struct dirent *dent;
+		while ((dent = readdir(dh)) != NULL) {
 
-		if (lsn[i] == LLONG_MAX || lsn[i] == LLONG_MIN) {
-			say_warn("can't parse `%s', skipping", dent->d_name);
-			continue;
-		}
+			char *ext = strchr(dent->d_name, '.');
+			if (ext == NULL)
+				continue;
 
-		i++;
-		if (i == size) {
-			i64 *n = palloc(fiber->gc_pool, sizeof(i64) * size * 2);
-			if (n == NULL)
-				goto out;
-			memcpy(n, lsn, sizeof(i64) * size);
-			lsn = n;
-			size = size * 2;
+			const char *suffix = strchr(ext + 1, '.');
+			/*
+			 * A valid ending is either .xlog or
+			 * .xlog.inprogress, given dir->filename_ext ==
+			 * 'xlog'.
+			 */
+			bool ext_is_ok;
+			if (suffix == NULL)
+				ext_is_ok = strcmp(ext, dir->filename_ext) == 0;
+			else
+				ext_is_ok = (strncmp(ext, dir->filename_ext,
+						     ext_len) == 0 &&
+					     strcmp(suffix,
+						    inprogress_suffix) == 0);
+			if (!ext_is_ok)
+				continue;
+
+			lsn[i] = strtoll(dent->d_name, &ext, 10);
+			if (strncmp(ext, dir->filename_ext, ext_len) != 0) {
+				/* d_name doesn't parse entirely, ignore it */
+				say_warn("can't parse `%s', skipping",
+					 dent->d_name);
+				errno = 0;
+				continue;
+			}
+
+			if (lsn[i] == LLONG_MAX || lsn[i] == LLONG_MIN) {
+				say_warn("can't parse `%s', skipping",
+					 dent->d_name);
+				/* Only a readdir() error ends the scan. */
+				errno = 0;
+				continue;
+			}
+			log_dir_cache_stripe(dir, lsn[i], stripe);
+
+			i++;
+			if (i == size) {
+				i64 *n = palloc(fiber->gc_pool,
+						sizeof(i64) * size * 2);
+				if (n == NULL)
+					goto out;
+				memcpy(n, lsn, sizeof(i64) * size);
+				lsn = n;
+				size = size * 2;
+			}
 		}
+		if (errno != 0)
+			goto out;
+		closedir(dh);
+		dh = NULL;
 	}
 
 	qsort(lsn, i, sizeof(i64), cmp_i64);
@@ -151,7 +286,7 @@ scan_dir(struct log_dir *dir, i64 **ret_lsn)
 	result = i;
 out:
 	if (errno != 0)
-		say_syserror("error reading directory `%s'", dir->dirname);
+		say_syserror("error reading directory `%s'", dirname);
 
 	if (dh != NULL)
 		closedir(dh);
@@ -198,16 +333,68 @@ find_including_file(struct log_dir *dir, i64 target_lsn)
 	return *lsn;
 }
 
-char *
-format_filename(struct log_dir *dir, i64 lsn, enum log_suffix suffix)
+/**
+ * Ask the OS to read in the file which follows the file
+ * starting with the given LSN, so that it's in memory by the
+ * time we're done with the current one. The files are those
+ * scan_dir() has found.
+ */
+void
+log_dir_readahead(struct log_dir *dir, const i64 *lsns, ssize_t count,
+		  i64 lsn)
+{
+	for (ssize_t i = 0; i < count; i++) {
+		if (lsns[i] <= lsn)
+			continue;
+		/* An .inprogress file is not worth it. */
+		int fd = open(format_filename(dir, lsns[i], NONE), O_RDONLY);
+		if (fd < 0)
+			return;
+		(void) fio_readahead(fd, 0, 0);
+		close(fd);
+		return;
+	}
+}
+
+static char *
+format_filename_in(const char *dirname, struct log_dir *dir, i64 lsn,
+		   enum log_suffix suffix)
 {
 	static __thread char filename[PATH_MAX + 1];
-	const char *suffix_str = suffix == INPROGRESS ? inprogress_suffix : "";
+	const char *suffix_str = "";
+	if (suffix == INPROGRESS)
+		suffix_str = inprogress_suffix;
+	else if (suffix == SPARE)
+		suffix_str = spare_suffix;
 	snprintf(filename, PATH_MAX, "%s/%020lld%s%s",
-		 dir->dirname, (long long)lsn, dir->filename_ext, suffix_str);
+		 dirname, (long long)lsn, dir->filename_ext, suffix_str);
 	return filename;
 }
 
+/**
+ * Format the name of a log file. If the directory is striped,
+ * return the name in the directory the file is found in, or,
+ * if there is no such file, in dirname. Files seen by
+ * scan_dir() or created by this process are not looked for.
+ */
+char *
+format_filename(struct log_dir *dir, i64 lsn, enum log_suffix suffix)
+{
+	if (dir->stripe_count == 0)
+		return format_filename_in(dir->dirname, dir, lsn, suffix);
+	int cached = log_dir_cached_stripe(dir, lsn);
+	if (cached >= 0)
+		return format_filename_in(log_dir_stripe(dir, cached),
+					  dir, lsn, suffix);
+	for (int stripe = 1; stripe <= dir->stripe_count; stripe++) {
+		char *filename = format_filename_in(dir->stripes[stripe - 1],
+						    dir, lsn, suffix);
+		if (access(filename, F_OK) == 0)
+			return filename;
+	}
+	return format_filename_in(dir->dirname, dir, lsn, suffix);
+}
+
 /* }}} */
 
 /* {{{ struct log_io_cursor */
@@ -252,6 +439,277 @@ row_reader_v11(FILE *f, struct palloc_pool *pool)
 	return m;
 }
 
+/**
+ * Same as row_reader_v11(), but for a file mapped into
+ * memory. The row is not copied: the returned tbuf points
+ * into the mapping.
+ *
+ * @param[in,out] pos  the offset of the row header, moved
+ *                     past the row on success.
+ */
+static struct tbuf *
+row_reader_v11_mapped(struct log_io_cursor *i, off_t *pos,
+		      struct palloc_pool *pool)
+{
+	if (*pos + sizeof(struct header_v11) > i->map_size)
+		return ROW_EOF;
+
+	struct header_v11 *header = (struct header_v11 *) (i->map + *pos);
+	u32 header_crc, data_crc;
+	/* The verifier thread may have checked the row already. */
+	bool is_verified = *pos + sizeof(struct header_v11) <= i->verified &&
+		*pos + sizeof(struct header_v11) + header->len <= i->verified;
+
+	/* header crc32c calculated on <lsn, tm, len, data_crc32c> */
+	header_crc = is_verified ? header->header_crc32c :
+		crc32_calc(0, (u8 *) header + offsetof(struct header_v11, lsn),
+			   sizeof(struct header_v11) - offsetof(struct header_v11, lsn));
+
+	if (header->header_crc32c != header_crc) {
+		say_error("header crc32c mismatch");
+		return NULL;
+	}
+
+	if (*pos + sizeof(struct header_v11) + header->len > i->map_size)
+		return ROW_EOF;
+
+	data_crc = is_verified ? header->data_crc32c :
+		crc32_calc(0, (u8 *) (header + 1), header->len);
+	if (header->data_crc32c != data_crc) {
+		say_error("data crc32c mismatch");
+		return NULL;
+	}
+
+	struct tbuf *m = palloc(pool, sizeof(*m));
+	m->data = header;
+	m->size = m->capacity = sizeof(struct header_v11) + header->len;
+	m->pool = pool;
+	*pos += m->size;
+
+	say_debug("read row v11 success lsn:%lld", (long long)header->lsn);
+	return m;
+}
+
+enum {
+	/**
+	 * Pages of a mapped file are read ahead, and given
+	 * back to the OS once read, in windows of this size.
+	 */
+	LOG_IO_MAP_WINDOW = 64 * 1024 * 1024,
+	/** Check rows in a separate thread in files this big. */
+	LOG_IO_VERIFY_MIN = 4 * 1024 * 1024,
+	/** The verifier publishes its progress this often. */
+	LOG_IO_VERIFY_BATCH = 1024 * 1024,
+};
+
+/**
+ * A thread which reads a mapped file ahead of the cursor and
+ * checks row checksums, so that the thread applying the rows
+ * finds the pages in memory and can skip the checks. The
+ * verifier stops at the first row which is damaged or not
+ * yet written: the cursor takes care of such rows itself.
+ */
+struct log_io_verifier {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	const char *map;
+	size_t map_size;
+	/** Rows before this offset are intact. */
+	off_t verified;
+	/** The cursor position. Always at a row boundary. */
+	off_t consumed;
+	bool is_shutdown;
+	/** The cursor position at the last sync, not locked. */
+	off_t synced;
+};
+
+/** Check the row at the given offset, return its size or 0. */
+static size_t
+row_v11_verify(const char *map, size_t map_size, off_t pos)
+{
+	const struct header_v11 *header;
+	log_magic_t magic;
+
+	if (pos + sizeof(magic) + sizeof(*header) > map_size)
+		return 0;
+	memcpy(&magic, map + pos, sizeof(magic));
+	if (magic != row_marker_v11)
+		return 0;
+	header = (const struct header_v11 *) (map + pos + sizeof(magic));
+	if (header->header_crc32c !=
+	    crc32_calc(0, (const u8 *) header + offsetof(struct header_v11, lsn),
+		       sizeof(*header) - offsetof(struct header_v11, lsn)))
+		return 0;
+	if (pos + sizeof(magic) + sizeof(*header) + header->len > map_size)
+		return 0;
+	if (header->data_crc32c !=
+	    crc32_calc(0, (const u8 *) (header + 1), header->len))
+		return 0;
+	return sizeof(magic) + sizeof(*header) + header->len;
+}
+
+static void *
+log_io_verifier_thread(void *arg)
+{
+	struct log_io_verifier *v = arg;
+
+	(void) tt_pthread_mutex_lock(&v->mutex);
+	off_t pos = v->verified;
+	while (! v->is_shutdown) {
+		/* The cursor has overtaken us: catch up. */
+		if (pos < v->consumed)
+			pos = v->verified = v->consumed;
+		/* Don't read ahead more than the cursor can use. */
+		if (pos - v->consumed >= LOG_IO_MAP_WINDOW * 2) {
+			(void) tt_pthread_cond_wait(&v->cond, &v->mutex);
+			continue;
+		}
+		(void) tt_pthread_mutex_unlock(&v->mutex);
+
+		off_t end = pos + LOG_IO_VERIFY_BATCH;
+		size_t size = 1;
+		while (pos < end &&
+		       (size = row_v11_verify(v->map, v->map_size, pos)) != 0)
+			pos += size;
+
+		(void) tt_pthread_mutex_lock(&v->mutex);
+		if (pos > v->verified)
+			v->verified = pos;
+		if (size == 0)
+			break;
+	}
+	(void) tt_pthread_mutex_unlock(&v->mutex);
+	return NULL;
+}
+
+static void
+log_io_verifier_start(struct log_io_cursor *i)
+{
+	struct log_io_verifier *v = calloc(1, sizeof(*v));
+	if (v == NULL)
+		return;
+	v->map = i->map;
+	v->map_size = i->map_size;
+	v->verified = v->consumed = v->synced = i->good_offset;
+	(void) tt_pthread_mutex_init(&v->mutex, NULL);
+	(void) tt_pthread_cond_init(&v->cond, NULL);
+	if (tt_pthread_create(&v->thread, NULL,
+			      log_io_verifier_thread, v) != 0) {
+		/* Not a problem: the cursor checks rows itself. */
+		(void) tt_pthread_mutex_destroy(&v->mutex);
+		(void) tt_pthread_cond_destroy(&v->cond);
+		free(v);
+		return;
+	}
+	i->verifier = v;
+}
+
+/**
+ * Tell the verifier where the cursor is, and find out how
+ * far the rows are checked. Called once in a while, to not
+ * contend on the mutex.
+ */
+static void
+log_io_verifier_sync(struct log_io_cursor *i)
+{
+	struct log_io_verifier *v = i->verifier;
+
+	if (i->good_offset - v->synced < LOG_IO_VERIFY_BATCH / 2)
+		return;
+	v->synced = i->good_offset;
+	(void) tt_pthread_mutex_lock(&v->mutex);
+	v->consumed = i->good_offset;
+	i->verified = v->verified;
+	(void) tt_pthread_cond_signal(&v->cond);
+	(void) tt_pthread_mutex_unlock(&v->mutex);
+}
+
+static void
+log_io_verifier_stop(struct log_io_cursor *i)
+{
+	struct log_io_verifier *v = i->verifier;
+
+	(void) tt_pthread_mutex_lock(&v->mutex);
+	v->is_shutdown = true;
+	(void) tt_pthread_cond_signal(&v->cond);
+	(void) tt_pthread_mutex_unlock(&v->mutex);
+	if (tt_pthread_join(v->thread, NULL) != 0)
+		panic_syserror("log_io verifier: thread join failed");
+	(void) tt_pthread_mutex_destroy(&v->mutex);
+	(void) tt_pthread_cond_destroy(&v->cond);
+	free(v);
+	i->verifier = NULL;
+	i->verified = 0;
+}
+
+/**
+ * Map the file into memory, or map it again if the file
+ * has grown, which happens when we follow a WAL being
+ * written. Private writable mapping: row handlers are
+ * allowed to modify a row.
+ *
+ * @return true if the mapping has changed.
+ */
+static bool
+log_io_cursor_map(struct log_io_cursor *i)
+{
+	struct stat st;
+	if (fstat(fileno(i->log->f), &st) != 0 ||
+	    st.st_size <= (off_t) i->map_size)
+		return false;
+	/* Don't map what can't be addressed. */
+	if ((off_t)(size_t) st.st_size != st.st_size)
+		return false;
+
+	if (i->verifier != NULL)
+		log_io_verifier_stop(i);
+	if (i->map != NULL)
+		munmap(i->map, i->map_size);
+	i->map_size = st.st_size;
+	i->map = mmap(NULL, i->map_size, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE, fileno(i->log->f), 0);
+	if (i->map == MAP_FAILED) {
+		say_syserror("mmap");
+		i->map = NULL;
+		i->map_size = 0;
+		return false;
+	}
+	i->map_released = 0;
+	(void) madvise(i->map, i->map_size, MADV_SEQUENTIAL);
+	return true;
+}
+
+bool
+log_io_cursor_is_complete(struct log_io_cursor *i)
+{
+	log_magic_t magic;
+	if (i->map == NULL || i->map_size < sizeof(magic))
+		return false;
+	memcpy(&magic, i->map + i->map_size - sizeof(magic), sizeof(magic));
+	return magic == eof_marker_v11;
+}
+
+/**
+ * Give back to the OS the pages of the rows we're done
+ * with, and ask it to read the next window ahead.
+ */
+static void
+log_io_cursor_advise(struct log_io_cursor *i)
+{
+	if (i->good_offset - i->map_released < LOG_IO_MAP_WINDOW)
+		return;
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	off_t end = i->good_offset - i->good_offset % page_size;
+	(void) madvise(i->map + i->map_released, end - i->map_released,
+		       MADV_DONTNEED);
+	i->map_released = end;
+	if ((size_t) end < i->map_size)
+		(void) madvise(i->map + end,
+			       MIN(i->map_size - end, LOG_IO_MAP_WINDOW * 2),
+			       MADV_WILLNEED);
+}
+
 void
 log_io_cursor_open(struct log_io_cursor *i, struct log_io *l)
 {
@@ -259,6 +717,27 @@ log_io_cursor_open(struct log_io_cursor *i, struct log_io *l)
 	i->row_count = 0;
 	i->good_offset = ftello(l->f);
 	i->eof_read  = false;
+	i->map = NULL;
+	i->map_size = 0;
+	i->map_released = 0;
+	i->verifier = NULL;
+	i->verified = 0;
+	i->keep_map = false;
+	/* Fall back to stdio if the file can't be mapped. */
+	if (l->mode == LOG_READ && ! l->is_compressed &&
+	    log_io_cursor_map(i)) {
+		(void) madvise(i->map,
+			       MIN(i->map_size, LOG_IO_MAP_WINDOW * 2),
+			       MADV_WILLNEED);
+		/*
+		 * A file which is being written is not checked
+		 * ahead. The live WAL has no .inprogress suffix
+		 * after its first row, but has no EOF marker yet.
+		 */
+		if (log_io_cursor_is_complete(i) &&
+		    i->map_size >= LOG_IO_VERIFY_MIN)
+			log_io_verifier_start(i);
+	}
 }
 
 void
@@ -266,6 +745,12 @@ log_io_cursor_close(struct log_io_cursor *i)
 {
 	struct log_io *l = i->log;
 	l->rows += i->row_count;
+	if (i->verifier != NULL)
+		log_io_verifier_stop(i);
+	if (i->map != NULL) {
+		munmap(i->map, i->map_size);
+		i->map = NULL;
+	}
 	/*
 	 * Since we don't close log_io
 	 * we must rewind log_io to last known
@@ -276,6 +761,76 @@ log_io_cursor_close(struct log_io_cursor *i)
 	prelease(fiber->gc_pool);
 }
 
+/** log_io_cursor_next() for a file mapped into memory. */
+static struct tbuf *
+log_io_cursor_next_mapped(struct log_io_cursor *i)
+{
+	struct log_io *l = i->log;
+	log_magic_t magic;
+	off_t pos = i->good_offset;
+
+	log_io_cursor_advise(i);
+	if (i->verifier != NULL)
+		log_io_verifier_sync(i);
+restart:
+	while (pos + sizeof(magic) <= i->map_size) {
+		memcpy(&magic, i->map + pos, sizeof(magic));
+		if (magic == row_marker_v11)
+			break;
+		pos++;
+	}
+	if (pos + sizeof(magic) > i->map_size) {
+		say_debug("eof while looking for magic");
+		goto eof;
+	}
+	off_t marker_offset = pos;
+	if (i->good_offset != marker_offset)
+		say_warn("skipped %jd bytes after 0x%08jx offset",
+			(intmax_t)(marker_offset - i->good_offset),
+			(uintmax_t)i->good_offset);
+	say_debug("magic found at 0x%08jx", (uintmax_t)marker_offset);
+
+	pos += sizeof(magic);
+	struct tbuf *row = row_reader_v11_mapped(i, &pos, fiber->gc_pool);
+	if (row == ROW_EOF)
+		goto eof;
+
+	if (row == NULL) {
+		if (l->dir->panic_if_error)
+			panic("failed to read row");
+		say_warn("failed to read row");
+		pos = marker_offset + 1;
+		goto restart;
+	}
+
+	i->good_offset = pos;
+	i->row_count++;
+
+	if (i->row_count % 100000 == 0)
+		say_info("%.1fM rows processed", i->row_count / 1000000.);
+
+	return row;
+eof:
+	/* The file may be still being written to. */
+	if (! i->keep_map && log_io_cursor_map(i)) {
+		pos = i->good_offset;
+		goto restart;
+	}
+	/* See the comment in log_io_cursor_next(). */
+	if (i->map_size == i->good_offset + sizeof(eof_marker_v11)) {
+		memcpy(&magic, i->map + i->good_offset, sizeof(magic));
+		if (magic == eof_marker_v11) {
+			i->good_offset += sizeof(magic);
+			i->eof_read = true;
+		} else if (magic != row_marker_v11) {
+			say_error("eof marker is corrupt: %lu",
+				  (unsigned long) magic);
+		}
+	}
+	/* No more rows. */
+	return NULL;
+}
+
 /**
  * Read logfile contents using designated format, panic if
  * the log is corrupted/unreadable.
@@ -302,6 +857,8 @@ log_io_cursor_next(struct log_io_cursor *i)
 	 */
 	prelease_after(fiber->gc_pool, 128 * 1024);
 
+	if (i->map != NULL)
+		return log_io_cursor_next_mapped(i);
 restart:
 	if (marker_offset > 0)
 		fseeko(l->f, marker_offset + 1, SEEK_SET);
@@ -425,8 +982,433 @@ inprogress_log_unlink(char *filename)
 	return 0;
 }
 
+/**
+ * Create a spare log file: a file with a header, which can
+ * be put to use later with spare_log_rename(), saving the
+ * cost of file creation at the time it's needed.
+ * A spare file is not visible to directory scans, and
+ * a stale spare file, if there is one, is overwritten.
+ *
+ * In case of error, writes a message to the server log
+ * and sets errno.
+ */
+struct log_io *
+spare_log_create(struct log_dir *dir)
+{
+	char *filename = format_filename_in(
+		log_dir_stripe(dir, log_dir_next_stripe(dir)), dir, 0, SPARE);
+	if (unlink(filename) != 0 && errno != ENOENT)
+		goto error;
+	int fd = open(filename,
+		      O_WRONLY | O_CREAT | O_EXCL | dir->open_wflags, 0664);
+	if (fd < 0)
+		goto error;
+	FILE *f = fdopen(fd, "w");
+	return log_io_open(dir, LOG_WRITE, filename, SPARE, f);
+error:
+	say_syserror("%s: failed to open `%s'", __func__, filename);
+	return NULL;
+}
+
+/**
+ * Give a spare log the name <lsn>.<ext>.inprogress. Like
+ * log_io_open_for_write(), never overwrites an existing file.
+ *
+ * @return 0 on success, -1 on error (the spare log is left
+ *         intact).
+ */
+int
+spare_log_rename(struct log_io *l, i64 lsn)
+{
+	assert(l->mode == LOG_WRITE && l->is_inprogress == false);
+
+	char *new_filename = format_filename(l->dir, lsn, NONE);
+	if (access(new_filename, F_OK) == 0) {
+		errno = EEXIST;
+		goto error;
+	}
+	/* A hard link can't cross file systems: stay in the same stripe. */
+	char dirname[PATH_MAX + 1];
+	strncpy(dirname, l->filename, PATH_MAX);
+	dirname[PATH_MAX] = '\0';
+	*strrchr(dirname, '/') = '\0';
+	new_filename = format_filename_in(dirname, l->dir, lsn, INPROGRESS);
+	/* Unlike rename(), link() fails if the target exists. */
+	if (link(l->filename, new_filename) != 0)
+		goto error;
+	if (unlink(l->filename) != 0)
+		say_syserror("can't unlink %s", l->filename);
+	say_info("creating `%s'", new_filename);
+	for (int stripe = 0; stripe <= l->dir->stripe_count; stripe++) {
+		if (strcmp(log_dir_stripe(l->dir, stripe), dirname) == 0)
+			log_dir_cache_stripe(l->dir, lsn, stripe);
+	}
+	strncpy(l->filename, new_filename, PATH_MAX);
+	l->is_inprogress = true;
+	return 0;
+error:
+	say_syserror("%s: failed to rename `%s' to `%s'", __func__,
+		     l->filename, new_filename);
+	return -1;
+}
+
+/**
+ * Close and remove a log which was never completed: an unused
+ * spare, or a snapshot which failed to save.
+ */
+void
+log_io_discard(struct log_io **lptr)
+{
+	struct log_io *l = *lptr;
+	if (unlink(l->filename) != 0)
+		say_syserror("can't unlink %s", l->filename);
+	if (l->index_fd != -1) {
+		char filename[PATH_MAX + 1];
+		snprintf(filename, sizeof(filename), "%s%s", l->filename,
+			 index_suffix);
+		(void) unlink(filename);
+		close(l->index_fd);
+	}
+	if (fclose(l->f) < 0)
+		say_syserror("can't close");
+	free(l->block_buf);
+	free(l->lzf_state);
+	free(l);
+	*lptr = NULL;
+}
+
+/* {{{ compressed logs */
+
+enum {
+	/** Blocks decompressed ahead of the reader. */
+	LOG_BLOCK_READAHEAD = 4,
+	/** Anything bigger is taken for a corrupt header. */
+	LOG_BLOCK_MAX = 1 << 30,
+};
+
+struct log_block {
+	char *data;
+	size_t size;
+};
+
+/**
+ * Turns a compressed log into the stream of rows of a plain
+ * one, for the row readers which work on a FILE. A thread reads
+ * and decompresses blocks ahead while the rows of the current
+ * block are being processed.
+ *
+ * The end of file marker is passed through as is. Seeks are
+ * only possible within the current block, which is enough to
+ * re-read a row: rows never span blocks.
+ */
+struct log_block_reader {
+	/** The compressed file. */
+	FILE *f;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	/** Blocks which are ready to be read, a ring. */
+	struct log_block ready[LOG_BLOCK_READAHEAD];
+	int ready_head;
+	int ready_count;
+	/** The thread has read the whole file. */
+	bool is_eof;
+	/** errno of the failure of the thread, if any. */
+	int error;
+	bool is_shutdown;
+	/** The block being read. */
+	struct log_block current;
+	size_t pos;
+	/** Offset of the current block in the stream of rows. */
+	off_t offset;
+};
+
+/**
+ * Read and decompress the next block.
+ *
+ * @return 0 on success, 1 at the end of file, -1 on error
+ *         (errno is set).
+ */
+static int
+log_block_read(FILE *f, struct log_block *block)
+{
+	struct block_header_v12 header;
+	char *buf = NULL;
+
+	if (fread(&header.marker, sizeof(header.marker), 1, f) != 1)
+		return ferror(f) ? -1 : 1;
+
+	if (header.marker == eof_marker_v11) {
+		block->data = malloc(sizeof(header.marker));
+		if (block->data == NULL)
+			return -1;
+		memcpy(block->data, &header.marker, sizeof(header.marker));
+		block->size = sizeof(header.marker);
+		return 0;
+	}
+	if (header.marker != block_marker_v12 ||
+	    fread((char *) &header + sizeof(header.marker),
+		  sizeof(header) - sizeof(header.marker), 1, f) != 1 ||
+	    header.header_crc32c !=
+	    crc32_calc(0, (u8 *) &header + offsetof(struct block_header_v12, len),
+		       sizeof(header) - offsetof(struct block_header_v12, len)) ||
+	    header.len > header.raw_len || header.raw_len > LOG_BLOCK_MAX) {
+		say_error("corrupt block header");
+		goto corrupt;
+	}
+	buf = malloc(header.len);
+	if (buf == NULL)
+		return -1;
+	if (fread(buf, header.len, 1, f) != 1) {
+		/* A truncated file: the rows end here. */
+		free(buf);
+		return ferror(f) ? -1 : 1;
+	}
+	if (crc32_calc(0, (u8 *) buf, header.len) != header.data_crc32c) {
+		say_error("block data crc32c mismatch");
+		goto corrupt;
+	}
+	if (header.len == header.raw_len) {
+		block->data = buf;
+	} else {
+		block->data = malloc(header.raw_len);
+		if (block->data == NULL) {
+			free(buf);
+			return -1;
+		}
+		if (lzf_decompress(buf, header.len, block->data,
+				   header.raw_len) != header.raw_len) {
+			free(block->data);
+			say_error("failed to decompress a block");
+			goto corrupt;
+		}
+		free(buf);
+	}
+	block->size = header.raw_len;
+	return 0;
+corrupt:
+	free(buf);
+	errno = EBADMSG;
+	return -1;
+}
+
+static void *
+log_block_reader_thread(void *arg)
+{
+	struct log_block_reader *r = arg;
+	int rc;
+
+	do {
+		(void) tt_pthread_mutex_lock(&r->mutex);
+		while (r->ready_count == LOG_BLOCK_READAHEAD && ! r->is_shutdown)
+			(void) tt_pthread_cond_wait(&r->cond, &r->mutex);
+		bool is_shutdown = r->is_shutdown;
+		(void) tt_pthread_mutex_unlock(&r->mutex);
+		if (is_shutdown)
+			break;
+
+		struct log_block block;
+		rc = log_block_read(r->f, &block);
+
+		(void) tt_pthread_mutex_lock(&r->mutex);
+		if (rc == 0) {
+			int tail = (r->ready_head + r->ready_count) %
+				LOG_BLOCK_READAHEAD;
+			r->ready[tail] = block;
+			r->ready_count++;
+		} else if (rc > 0) {
+			r->is_eof = true;
+		} else {
+			r->error = errno ? errno : EIO;
+		}
+		(void) tt_pthread_cond_signal(&r->cond);
+		(void) tt_pthread_mutex_unlock(&r->mutex);
+	} while (rc == 0);
+	return NULL;
+}
+
+/**
+ * Move on to the next block. If there's none, stay at the end
+ * of the current one, so that it can still be seeked in.
+ *
+ * @return -1 at the end of file or on error.
+ */
+static int
+log_block_reader_next(struct log_block_reader *r)
+{
+	struct log_block next;
+
+	(void) tt_pthread_mutex_lock(&r->mutex);
+	while (r->ready_count == 0 && ! r->is_eof && r->error == 0)
+		(void) tt_pthread_cond_wait(&r->cond, &r->mutex);
+	if (r->ready_count == 0) {
+		(void) tt_pthread_mutex_unlock(&r->mutex);
+		return -1;
+	}
+	next = r->ready[r->ready_head];
+	r->ready_head = (r->ready_head + 1) % LOG_BLOCK_READAHEAD;
+	r->ready_count--;
+	(void) tt_pthread_cond_signal(&r->cond);
+	(void) tt_pthread_mutex_unlock(&r->mutex);
+
+	r->offset += r->current.size;
+	free(r->current.data);
+	r->current = next;
+	r->pos = 0;
+	return 0;
+}
+
+static ssize_t
+log_block_reader_read(void *cookie, char *buf, size_t size)
+{
+	struct log_block_reader *r = cookie;
+	size_t done = 0;
+
+	while (done < size) {
+		if (r->pos == r->current.size &&
+		    log_block_reader_next(r) != 0)
+			break;
+		size_t n = MIN(size - done, r->current.size - r->pos);
+		memcpy(buf + done, r->current.data + r->pos, n);
+		r->pos += n;
+		done += n;
+	}
+	if (done == 0 && r->error != 0) {
+		errno = r->error;
+		return -1;
+	}
+	return done;
+}
+
+static int
+log_block_reader_seek(void *cookie, off64_t *offset, int whence)
+{
+	struct log_block_reader *r = cookie;
+	off_t target;
+
+	switch (whence) {
+	case SEEK_SET:
+		target = *offset;
+		break;
+	case SEEK_CUR:
+		target = r->offset + r->pos + *offset;
+		break;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+	if (target < r->offset ||
+	    target > r->offset + (off_t) r->current.size) {
+		errno = EINVAL;
+		return -1;
+	}
+	r->pos = target - r->offset;
+	*offset = target;
+	return 0;
+}
+
+/** Stop the thread and free the reader, but not the file. */
+static void
+log_block_reader_free(struct log_block_reader *r)
+{
+	(void) tt_pthread_mutex_lock(&r->mutex);
+	r->is_shutdown = true;
+	(void) tt_pthread_cond_signal(&r->cond);
+	(void) tt_pthread_mutex_unlock(&r->mutex);
+	(void) tt_pthread_join(r->thread, NULL);
+	(void) tt_pthread_mutex_destroy(&r->mutex);
+	(void) tt_pthread_cond_destroy(&r->cond);
+
+	for (int i = 0; i < r->ready_count; i++)
+		free(r->ready[(r->ready_head + i) % LOG_BLOCK_READAHEAD].data);
+	free(r->current.data);
+	free(r);
+}
+
+static int
+log_block_reader_close(void *cookie)
+{
+	struct log_block_reader *r = cookie;
+	FILE *f = r->f;
+
+	log_block_reader_free(r);
+	return fclose(f);
+}
+
+/**
+ * Replace the stream of a compressed log, positioned after the
+ * file header, with a stream of its rows.
+ */
+static int
+log_io_open_blocks(struct log_io *l)
+{
+#if defined(HAVE_FOPENCOOKIE)
+	struct log_block_reader *r = calloc(1, sizeof(*r));
+	if (r == NULL)
+		return -1;
+	r->f = l->f;
+	r->offset = ftello(l->f);
+	(void) tt_pthread_mutex_init(&r->mutex, NULL);
+	(void) tt_pthread_cond_init(&r->cond, NULL);
+	if (tt_pthread_create(&r->thread, NULL,
+			      log_block_reader_thread, r) != 0) {
+		(void) tt_pthread_mutex_destroy(&r->mutex);
+		(void) tt_pthread_cond_destroy(&r->cond);
+		free(r);
+		return -1;
+	}
+
+	cookie_io_functions_t io = {
+		.read = log_block_reader_read,
+		.write = NULL,
+		.seek = log_block_reader_seek,
+		.close = log_block_reader_close
+	};
+	FILE *f = fopencookie(r, "r", io);
+	if (f == NULL) {
+		log_block_reader_free(r);
+		return -1;
+	}
+	/* Row readers seek back within the current block only. */
+	setvbuf(f, NULL, _IONBF, 0);
+	l->f = f;
+	return 0;
+#else
+	(void) l;
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
+
+/* }}} */
+
 /* {{{ struct log_io */
 
+void
+log_io_finish(struct log_io *l)
+{
+	assert(l->mode == LOG_WRITE && ! l->is_finished);
+
+	fio_write(fileno(l->f), &eof_marker_v11, sizeof(log_magic_t));
+	if (l->preallocated) {
+		/* Give back the space we didn't use. */
+		off_t end = fio_lseek(fileno(l->f), 0, SEEK_CUR);
+		if (end != -1)
+			(void) fio_truncate(fileno(l->f), end);
+	}
+	/*
+	 * Sync the file before closing, since
+	 * otherwise we can end up with a partially
+	 * written file in case of a crash.
+	 * Do not sync if the file is opened with O_SYNC.
+	 */
+	if (! (l->dir->open_wflags & WAL_SYNC_FLAG))
+		log_io_sync(l);
+	if (l->is_inprogress && inprogress_log_rename(l) != 0)
+		panic("can't rename 'inprogress' WAL");
+	l->is_finished = true;
+}
+
 int
 log_io_close(struct log_io **lptr)
 {
@@ -434,22 +1416,19 @@ log_io_close(struct log_io **lptr)
 	int r;
 
 	if (l->mode == LOG_WRITE) {
-		fio_write(fileno(l->f), &eof_marker_v11, sizeof(log_magic_t));
-		/*
-		 * Sync the file before closing, since
-		 * otherwise we can end up with a partially
-		 * written file in case of a crash.
-		 * Do not sync if the file is opened with O_SYNC.
-		 */
-		if (! (l->dir->open_wflags & WAL_SYNC_FLAG))
-			log_io_sync(l);
-		if (l->is_inprogress && inprogress_log_rename(l) != 0)
-			panic("can't rename 'inprogress' WAL");
+		if (! l->is_finished)
+			log_io_finish(l);
+		if (l->dir->drop_cache)
+			(void) fio_evict(fileno(l->f), 0, 0);
 	}
 
+	if (l->index_fd != -1)
+		close(l->index_fd);
 	r = fclose(l->f);
 	if (r < 0)
 		say_syserror("can't close");
+	free(l->block_buf);
+	free(l->lzf_state);
 	free(l);
 	*lptr = NULL;
 	return r;
@@ -470,6 +1449,8 @@ log_io_atfork(struct log_io **lptr)
 		 */
 		close(fileno(l->f));
 		fclose(l->f);
+		if (l->index_fd != -1)
+			close(l->index_fd);
 		free(l);
 		*lptr = NULL;
 	}
@@ -478,21 +1459,285 @@ log_io_atfork(struct log_io **lptr)
 int
 log_io_sync(struct log_io *l)
 {
+#ifdef HAVE_FDATASYNC
+	/*
+	 * Appends change the file size, which fdatasync()
+	 * flushes too, while mtime updates are of no
+	 * interest to us.
+	 */
+	if (fdatasync(fileno(l->f)) < 0) {
+#else
 	if (fsync(fileno(l->f)) < 0) {
+#endif
 		say_syserror("%s: fsync failed", l->filename);
 		return -1;
 	}
 	return 0;
 }
 
+/**
+ * Reserve disk space for a file opened for write, to avoid
+ * block allocation on every append. The file size is not
+ * changed, so readers of a file which is being written
+ * do not see the reserved space.
+ */
+int
+log_io_preallocate(struct log_io *l, off_t size)
+{
+	assert(l->mode == LOG_WRITE);
+	if (fio_preallocate(fileno(l->f), size) != 0)
+		return -1;
+	l->preallocated = size;
+	return 0;
+}
+
+/**
+ * Account bytes appended to a file opened for write, and
+ * once there are at least 'threshold' of them, initiate
+ * their write-out, without waiting for it to complete.
+ * By the time the file is synced, only a small dirty tail
+ * is left to flush.
+ */
+void
+log_io_writeback(struct log_io *l, size_t bytes, size_t threshold)
+{
+	assert(l->mode == LOG_WRITE);
+	l->writeback_pending += bytes;
+	if (l->writeback_pending < threshold)
+		return;
+	int fd = fileno(l->f);
+	off_t end = fio_lseek(fd, 0, SEEK_CUR);
+	if (end == -1)
+		return;
+	/*
+	 * The previous range has been under write-out for
+	 * a while, so evicting it rarely has to wait.
+	 */
+	if (l->dir->drop_cache && l->writeback_offset > l->evict_offset) {
+		(void) fio_evict(fd, l->evict_offset,
+				 l->writeback_offset - l->evict_offset);
+		l->evict_offset = l->writeback_offset;
+	}
+	(void) fio_writeback(fd, l->writeback_offset,
+			     end - l->writeback_offset);
+	l->writeback_offset = end;
+	l->writeback_pending = 0;
+}
+
+/* {{{ WAL index */
+
+struct log_index_entry {
+	i64 lsn;
+	i64 offset;
+} __attribute__((packed));
+
+static void
+format_index_filename(char *buf, size_t size, struct log_io *l)
+{
+	snprintf(buf, size, "%s%s", l->filename, index_suffix);
+}
+
+/**
+ * If it is time to add an index entry, return the offset
+ * the next rows of a file opened for write go to, otherwise
+ * -1. The first row isn't indexed: it follows the header.
+ */
+off_t
+log_io_index_offset(struct log_io *l)
+{
+	assert(l->mode == LOG_WRITE);
+	if (l->no_index || l->is_inprogress ||
+	    l->index_pending < LOG_INDEX_STEP)
+		return -1;
+	return fio_lseek(fileno(l->f), 0, SEEK_CUR);
+}
+
+/**
+ * Account bytes of rows written to a file opened for write,
+ * the first of them with the given LSN. If offset is not -1,
+ * the rows were written at this offset and get an index
+ * entry.
+ *
+ * The entry is appended after the rows are written, so a
+ * reader never finds an entry for data which isn't there.
+ * The index is only a hint: after an error it's no longer
+ * written, and readers check entries against the file.
+ */
+void
+log_io_index_add(struct log_io *l, i64 lsn, off_t offset, size_t bytes)
+{
+	if (offset == -1) {
+		l->index_pending += bytes;
+		return;
+	}
+	l->index_pending = bytes;
+	if (l->index_fd == -1) {
+		char filename[PATH_MAX + 1];
+		format_index_filename(filename, sizeof(filename), l);
+		l->index_fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC |
+				   O_APPEND, 0664);
+		if (l->index_fd == -1) {
+			say_syserror("can't create `%s'", filename);
+			l->no_index = true;
+			return;
+		}
+	}
+	struct log_index_entry entry = { .lsn = lsn, .offset = offset };
+	if (fio_write(l->index_fd, &entry, sizeof(entry)) != sizeof(entry)) {
+		close(l->index_fd);
+		l->index_fd = -1;
+		l->no_index = true;
+	}
+}
+
+/** Check that a row with the given LSN starts at the offset. */
+static bool
+log_io_row_at(struct log_io *l, off_t offset, i64 lsn)
+{
+	struct {
+		log_magic_t marker;
+		struct header_v11 header;
+	} __attribute__((packed)) row;
+
+	if (pread(fileno(l->f), &row, sizeof(row), offset) != sizeof(row))
+		return false;
+	return row.marker == row_marker_v11 && row.header.lsn == lsn &&
+		row.header.header_crc32c ==
+		crc32_calc(0, (void *) &row.header.lsn,
+			   sizeof(row.header) -
+			   sizeof(row.header.header_crc32c));
+}
+
+/**
+ * Position a file opened for read at the indexed row with
+ * the greatest LSN not above the given one, so that the rows
+ * before it are not read. The position is left intact if
+ * the file has no index or the index doesn't match the file.
+ */
+void
+log_io_seek_lsn(struct log_io *l, i64 lsn)
+{
+	assert(l->mode == LOG_READ);
+	if (l->is_compressed)
+		return;
+
+	char filename[PATH_MAX + 1];
+	format_index_filename(filename, sizeof(filename), l);
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1)
+		return;
+
+	struct log_index_entry *index = NULL;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(*index))
+		goto out;
+	index = malloc(st.st_size);
+	if (index == NULL)
+		goto out;
+	/* The file may be being written: ignore a torn entry. */
+	ssize_t size = fio_read(fd, index, st.st_size);
+	if (size < (ssize_t) sizeof(*index))
+		goto out;
+	size_t count = size / sizeof(*index);
+
+	/* Find the first entry above the LSN. */
+	size_t lo = 0, hi = count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (index[mid].lsn <= lsn)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (; lo > 0; lo--) {
+		struct log_index_entry *entry = &index[lo - 1];
+		if (log_io_row_at(l, entry->offset, entry->lsn)) {
+			fseeko(l->f, entry->offset, SEEK_SET);
+			say_debug("`%s': skipped to LSN %" PRIi64,
+				  l->filename, entry->lsn);
+			break;
+		}
+	}
+out:
+	free(index);
+	close(fd);
+}
+
+/* }}} */
+
 int
 log_io_write_header(struct log_io *l)
 {
-	int ret = fprintf(l->f, "%s%s\n", l->dir->filetype, v11);
+	int ret = fprintf(l->f, "%s%s\n", l->dir->filetype,
+			  l->is_compressed ? v12 : v11);
 
 	return ret < 0 ? -1 : 0;
 }
 
+/**
+ * Add a "Key: value" line to the header of a file which has
+ * just been opened for write, before any rows.
+ */
+int
+log_io_append_header(struct log_io *l, const char *line)
+{
+	assert(l->mode == LOG_WRITE);
+	/* Overwrite the empty line which ends the header. */
+	if (fseeko(l->f, -1, SEEK_CUR) != 0)
+		return -1;
+	return fprintf(l->f, "%s\n\n", line) < 0 ? -1 : 0;
+}
+
+/**
+ * Compress a number of whole rows into a block and append it
+ * to a compressed log.
+ *
+ * @return 0 on success, -1 on error (errno is set).
+ */
+int
+log_io_write_block(struct log_io *l, const void *rows, size_t len)
+{
+	assert(l->is_compressed && len > 0);
+	if (len > LOG_BLOCK_MAX) {
+		errno = EFBIG;
+		return -1;
+	}
+	size_t size = sizeof(struct block_header_v12) +
+		LZF_MAX_COMPRESSED_SIZE(len);
+	if (l->block_buf_size < size) {
+		char *buf = realloc(l->block_buf, size);
+		if (buf == NULL)
+			return -1;
+		l->block_buf = buf;
+		l->block_buf_size = size;
+	}
+	if (l->lzf_state == NULL &&
+	    (l->lzf_state = malloc(sizeof(lzf_state))) == NULL)
+		return -1;
+
+	struct block_header_v12 *header = (struct block_header_v12 *)
+		l->block_buf;
+	char *data = l->block_buf + sizeof(*header);
+	/* Only keep the compressed data if it's smaller. */
+	unsigned data_len = lzf_compress(rows, len, data, len - 1,
+					 *(lzf_state *) l->lzf_state);
+	if (data_len == 0) {
+		memcpy(data, rows, len);
+		data_len = len;
+	}
+	header->marker = block_marker_v12;
+	header->len = data_len;
+	header->raw_len = len;
+	header->data_crc32c = crc32_calc(0, (u8 *) data, data_len);
+	header->header_crc32c =
+		crc32_calc(0, (u8 *) header + offsetof(struct block_header_v12, len),
+			   sizeof(*header) - offsetof(struct block_header_v12, len));
+
+	size = sizeof(*header) + data_len;
+	return fio_write(fileno(l->f), l->block_buf, size) ==
+		(ssize_t) size ? 0 : -1;
+}
+
 /**
  * Verify that file is of the given format.
  *
@@ -518,7 +1763,9 @@ log_io_verify_meta(struct log_io *l, const char **errmsg)
 		goto error;
 	}
 
-	if (strcmp(v11, version) != 0) {
+	if (strcmp(v12, version) == 0) {
+		l->is_compressed = true;
+	} else if (strcmp(v11, version) != 0) {
 		*errmsg = "unknown version";
 		goto error;
 	}
@@ -529,6 +1776,16 @@ log_io_verify_meta(struct log_io *l, const char **errmsg)
 		}
 		if (strcmp(buf, "\n") == 0 || strcmp(buf, "\r\n") == 0)
 			break;
+		if (sscanf(buf, "Parts: %d", &l->part_count) == 1 &&
+		    (l->part_count < 1 || l->part_count > LOG_PARTS_MAX)) {
+			*errmsg = "bad part count";
+			goto error;
+		}
+		if (sscanf(buf, "Base: %" SCNi64, &l->base_lsn) == 1 &&
+		    l->base_lsn <= 0) {
+			*errmsg = "bad base LSN";
+			goto error;
+		}
 	}
 	return 0;
 error:
@@ -560,11 +1817,17 @@ log_io_open(struct log_dir *dir, enum log_mode mode,
 	l->mode = mode;
 	l->dir = dir;
 	l->is_inprogress = suffix == INPROGRESS;
+	l->index_fd = -1;
 	if (mode == LOG_READ) {
 		if (log_io_verify_meta(l, &errmsg) != 0)
 			goto error;
+		if (l->is_compressed && log_io_open_blocks(l) != 0) {
+			errmsg = strerror(errno);
+			goto error;
+		}
 	} else { /* LOG_WRITE */
 		setvbuf(l->f, NULL, _IONBF, 0);
+		l->is_compressed = dir->compress;
 		if (log_io_write_header(l) != 0)
 			goto error;
 	}
@@ -612,7 +1875,17 @@ log_io_open_for_write(struct log_dir *dir, i64 lsn, enum log_suffix suffix)
 			goto error;
 		}
 	}
-	filename = format_filename(dir, lsn, suffix);
+	if (dir->stripe_count > 0) {
+		/* O_EXCL below only checks one of the stripes. */
+		filename = format_filename(dir, lsn, suffix);
+		if (access(filename, F_OK) == 0) {
+			errno = EEXIST;
+			goto error;
+		}
+	}
+	int stripe = log_dir_next_stripe(dir);
+	filename = format_filename_in(log_dir_stripe(dir, stripe),
+				      dir, lsn, suffix);
 	/*
 	 * Open the <lsn>.<suffix>.inprogress file. If it exists,
 	 * open will fail.
@@ -622,6 +1895,7 @@ log_io_open_for_write(struct log_dir *dir, i64 lsn, enum log_suffix suffix)
 	if (fd < 0)
 		goto error;
 	say_info("creating `%s'", filename);
+	log_dir_cache_stripe(dir, lsn, stripe);
 	FILE *f = fdopen(fd, "w");
 	return log_io_open(dir, LOG_WRITE, filename, suffix, f);
 error:
@@ -629,5 +1903,49 @@ error:
 	return NULL;
 }
 
+/**
+ * The name of a part of a snapshot written as several files:
+ * <lsn>.snap holds part 0 and the part count, the rest are
+ * <lsn>.snap.1 and so on.
+ */
+static char *
+format_part_filename(struct log_dir *dir, i64 lsn, int part,
+		     enum log_suffix suffix)
+{
+	static __thread char filename[PATH_MAX + 1];
+	snprintf(filename, PATH_MAX, "%s.%d%s",
+		 format_filename_in(dir->dirname, dir, lsn, NONE), part,
+		 suffix == INPROGRESS ? inprogress_suffix : "");
+	return filename;
+}
+
+struct log_io *
+log_io_open_part_for_read(struct log_dir *dir, i64 lsn, int part)
+{
+	assert(lsn != 0 && part > 0);
+
+	const char *filename = format_part_filename(dir, lsn, part, NONE);
+	FILE *f = fopen(filename, "r");
+	return log_io_open(dir, LOG_READ, filename, NONE, f);
+}
+
+/** Create <lsn>.snap.<part>.inprogress. */
+struct log_io *
+log_io_open_part_for_write(struct log_dir *dir, i64 lsn, int part)
+{
+	assert(lsn != 0 && part > 0);
+
+	char *filename = format_part_filename(dir, lsn, part, INPROGRESS);
+	int fd = open(filename,
+		      O_WRONLY | O_CREAT | O_EXCL | dir->open_wflags, 0664);
+	if (fd < 0) {
+		say_syserror("%s: failed to open `%s'", __func__, filename);
+		return NULL;
+	}
+	say_info("creating `%s'", filename);
+	FILE *f = fdopen(fd, "w");
+	return log_io_open(dir, LOG_WRITE, filename, INPROGRESS, f);
+}
+
 /* }}} */
 
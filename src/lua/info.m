@@ -38,6 +38,8 @@
 #include <say.h>
 #include <string.h>
 #include <recovery.h>
+#include <replication.h>
+#include <sio.h>
 
 static int
 lbox_info_recovery_lag(struct lua_State *L)
@@ -60,6 +62,54 @@ lbox_info_recovery_last_update_tstamp(struct lua_State *L)
 	return 1;
 }
 
+/** Apply statistics of a replica, nil on a master. */
+static int
+lbox_info_replica(struct lua_State *L)
+{
+	struct remote *remote = recovery_state->remote;
+	if (remote == NULL) {
+		lua_pushnil(L);
+		return 1;
+	}
+	lua_newtable(L);
+	lua_pushnumber(L, remote->apply_rate);
+	lua_setfield(L, -2, "apply_rate");
+	lua_pushnumber(L, remote->apply_latency);
+	lua_setfield(L, -2, "apply_latency");
+	lua_pushnumber(L, remote->wal_wait);
+	lua_setfield(L, -2, "wal_wait");
+	return 1;
+}
+
+/** Statistics of the replicas of this server, nil if none. */
+static int
+lbox_info_replicas(struct lua_State *L)
+{
+	int count = 0;
+	for (int i = 0; relay_stats != NULL && i < RELAY_STAT_MAX; i++) {
+		struct relay_stat *stat = &relay_stats[i];
+		if (stat->pid == 0)
+			continue;
+		if (count == 0)
+			lua_newtable(L);
+		lua_newtable(L);
+		lua_pushstring(L, sio_strfaddr(&stat->peer));
+		lua_setfield(L, -2, "peer");
+		luaL_pushnumber64(L, stat->lsn);
+		lua_setfield(L, -2, "lsn");
+		luaL_pushnumber64(L, stat->rows);
+		lua_setfield(L, -2, "rows");
+		luaL_pushnumber64(L, stat->bytes);
+		lua_setfield(L, -2, "bytes");
+		luaL_pushnumber64(L, stat->send_queue);
+		lua_setfield(L, -2, "send_queue");
+		lua_rawseti(L, -2, ++count);
+	}
+	if (count == 0)
+		lua_pushnil(L);
+	return 1;
+}
+
 static int
 lbox_info_lsn(struct lua_State *L)
 {
@@ -93,6 +143,8 @@ lbox_info_dynamic_meta [] =
 {
 	{"recovery_lag", lbox_info_recovery_lag},
 	{"recovery_last_update", lbox_info_recovery_last_update_tstamp},
+	{"replica", lbox_info_replica},
+	{"replicas", lbox_info_replicas},
 	{"lsn", lbox_info_lsn},
 	{"status", lbox_info_status},
 	{"uptime", lbox_info_uptime},
@@ -29,6 +29,9 @@
 #include "recovery.h"
 
 #include <fcntl.h>
+#if defined(HAVE_INOTIFY_INIT1)
+#include <sys/inotify.h>
+#endif
 
 #include "log_io.h"
 #include "fiber.h"
@@ -130,7 +133,13 @@ confirm_lsn(struct recovery_state *r, int64_t lsn, bool is_commit)
 
 	if (r->confirmed_lsn < lsn) {
 		if (is_commit) {
-			if (r->confirmed_lsn + 1 != lsn)
+			/*
+			 * A replica of some spaces skips the
+			 * LSNs of the rest.
+			 */
+			bool is_filtered = r->remote != NULL &&
+				r->remote->space_count > 0;
+			if (r->confirmed_lsn + 1 != lsn && !is_filtered)
 				say_warn("non consecutive LSN, confirmed: %jd, "
 					 " new: %jd, diff: %jd",
 					 (intmax_t) r->confirmed_lsn,
@@ -214,6 +223,8 @@ recovery_init(const char *snap_dirname, const char *wal_dirname,
 
 	r->snap_dir = &snap_dir;
 	r->snap_dir->dirname = strdup(snap_dirname);
+	r->delta_dir = &delta_dir;
+	r->delta_dir->dirname = strdup(snap_dirname);
 	r->wal_dir = &wal_dir;
 	r->wal_dir->dirname = strdup(wal_dirname);
 	r->wal_dir->open_wflags = r->wal_mode == WAL_FSYNC ? WAL_SYNC_FLAG : 0;
@@ -257,7 +268,9 @@ recovery_free()
 		wal_writer_stop(r);
 
 	free(r->snap_dir->dirname);
+	free(r->delta_dir->dirname);
 	free(r->wal_dir->dirname);
+	log_dir_free_stripes(r->wal_dir);
 	if (r->current_wal) {
 		/*
 		 * Possible if shutting down a replication
@@ -274,6 +287,25 @@ recovery_setup_panic(struct recovery_state *r, bool on_snap_error, bool on_wal_e
 {
 	r->wal_dir->panic_if_error = on_wal_error;
 	r->snap_dir->panic_if_error = on_snap_error;
+	r->delta_dir->panic_if_error = on_snap_error;
+}
+
+void
+recovery_setup_snap_compress(struct recovery_state *r, bool compress)
+{
+	r->snap_dir->compress = compress;
+	r->delta_dir->compress = compress;
+}
+
+/**
+ * Spread WALs over several directories, to put the load
+ * of WAL writes on several disks. Panic in case of error.
+ */
+void
+recovery_setup_wal_stripes(struct recovery_state *r, const char *dirnames)
+{
+	if (log_dir_add_stripes(r->wal_dir, dirnames) != 0)
+		panic("unacceptable value of 'wal_stripe_dirs'");
 }
 
 
@@ -301,21 +333,46 @@ recover_snap(struct recovery_state *r)
 		say_error("can't find/open snapshot");
 		goto error;
 	}
-	say_info("recover from `%s'", snap->filename);
-	struct log_io_cursor i;
-
-	log_io_cursor_open(&i, snap);
+	/*
+	 * A snapshot written in parts: open them all at once, so
+	 * that all disks start reading ahead, then apply the rows
+	 * in the order of parts.
+	 */
+	struct log_io *parts[LOG_PARTS_MAX] = { snap };
+	int part_count = MAX(snap->part_count, 1);
+	for (int k = 1; k < part_count; k++) {
+		parts[k] = log_io_open_part_for_read(r->snap_dir, lsn, k);
+		if (parts[k] == NULL) {
+			say_error("can't find/open snapshot part %d", k);
+			while (--k >= 0)
+				log_io_close(&parts[k]);
+			goto error;
+		}
+		if (! parts[k]->is_compressed)
+			(void) fio_readahead(fileno(parts[k]->f), 0, 0);
+	}
 
-	struct tbuf *row;
-	while ((row = log_io_cursor_next(&i))) {
-		if (r->row_handler(r->row_handler_param, row) < 0) {
-			say_error("can't apply row");
-			if (snap->dir->panic_if_error)
-				break;
+	struct tbuf *row = NULL;
+	for (int k = 0; k < part_count; k++) {
+		snap = parts[k];
+		say_info("recover from `%s'", snap->filename);
+		struct log_io_cursor i;
+
+		log_io_cursor_open(&i, snap);
+
+		while ((row = log_io_cursor_next(&i))) {
+			if (r->row_handler(r->row_handler_param, row) < 0) {
+				say_error("can't apply row");
+				if (snap->dir->panic_if_error)
+					break;
+			}
 		}
+		log_io_cursor_close(&i);
+		if (row != NULL)
+			break;
 	}
-	log_io_cursor_close(&i);
-	log_io_close(&snap);
+	for (int k = 0; k < part_count; k++)
+		log_io_close(&parts[k]);
 
 	if (row == NULL) {
 		r->lsn = r->confirmed_lsn = lsn;
@@ -331,6 +388,60 @@ error:
 	panic("snapshot recovery failed");
 }
 
+/**
+ * Apply the delta snapshots written since the snapshot just
+ * recovered, each on top of the previous one, so that WALs are
+ * read from the newest one on. Panic in case of error if
+ * panic_on_snap_error is set.
+ */
+void
+recover_deltas(struct recovery_state *r)
+{
+	i64 *lsn;
+	ssize_t count = scan_dir(r->delta_dir, &lsn);
+
+	for (ssize_t k = 0; k < count; k++) {
+		if (lsn[k] <= r->confirmed_lsn)
+			continue;
+		char *filename = format_filename(r->delta_dir, lsn[k], NONE);
+		/* An .inprogress file, never finished. */
+		if (access(filename, F_OK) != 0)
+			continue;
+		FILE *f = fopen(filename, "r");
+		struct log_io *delta = log_io_open(r->delta_dir, LOG_READ,
+						   filename, NONE, f);
+		if (delta == NULL) {
+			if (r->delta_dir->panic_if_error)
+				panic("can't open delta snapshot");
+			continue;
+		}
+		if (delta->base_lsn != r->confirmed_lsn) {
+			say_warn("`%s' is not based on LSN %" PRIi64
+				 ", skipping", delta->filename,
+				 r->confirmed_lsn);
+			log_io_close(&delta);
+			continue;
+		}
+		say_info("recover from `%s'", delta->filename);
+		struct log_io_cursor i;
+
+		log_io_cursor_open(&i, delta);
+		struct tbuf *row;
+		while ((row = log_io_cursor_next(&i))) {
+			if (r->row_handler(r->row_handler_param, row) < 0) {
+				say_error("can't apply row");
+				if (delta->dir->panic_if_error)
+					panic("delta snapshot recovery failed");
+			}
+		}
+		log_io_cursor_close(&i);
+		log_io_close(&delta);
+		set_lsn(r, lsn[k]);
+		say_info("delta snapshot recovered, confirmed lsn: %"
+			 PRIi64, r->confirmed_lsn);
+	}
+}
+
 #define LOG_EOF 0
 
 /**
@@ -386,7 +497,11 @@ recover_remaining_wals(struct recovery_state *r)
 	size_t rows_before;
 
 	current_lsn = r->confirmed_lsn + 1;
-	wal_greatest_lsn = greatest_lsn(r->wal_dir);
+	/* The list is kept to find the WAL to read ahead. */
+	i64 *wal_lsns;
+	ssize_t wal_count = scan_dir(r->wal_dir, &wal_lsns);
+	wal_greatest_lsn = wal_count <= 0 ? wal_count :
+		wal_lsns[wal_count - 1];
 
 	/* if the caller already opened WAL for us, recover from it first */
 	if (r->current_wal != NULL)
@@ -455,6 +570,10 @@ recover_remaining_wals(struct recovery_state *r)
 		assert(r->current_wal == NULL);
 		r->current_wal = next_wal;
 		say_info("recover from `%s'", r->current_wal->filename);
+		/* Read the next WAL in while this one is applied. */
+		if (current_lsn < wal_greatest_lsn)
+			log_dir_readahead(r->wal_dir, wal_lsns, wal_count,
+					  current_lsn);
 
 recover_current_wal:
 		rows_before = r->current_wal->rows;
@@ -512,6 +631,8 @@ recover_existing_wals(struct recovery_state *r)
 	r->current_wal = log_io_open_for_read(r->wal_dir, wal_lsn, NONE);
 	if (r->current_wal == NULL)
 		goto out;
+	/* Don't read the rows we already have. */
+	log_io_seek_lsn(r->current_wal, next_lsn);
 	if (recover_remaining_wals(r) < 0)
 		panic("recover failed");
 	say_info("WALs recovered, confirmed lsn: %" PRIi64, r->confirmed_lsn);
@@ -570,6 +691,11 @@ recovery_finalize(struct recovery_state *r)
  * This is used in local hot standby or replication
  * relay mode: look for changes in the wal_dir and apply them
  * locally or send to the replica.
+ *
+ * On Linux the WAL directories are watched with inotify(7), so
+ * that a new row or a new WAL is picked up as soon as the master
+ * writes it. The timer and the stat watcher remain as a fallback,
+ * when inotify is not available.
  */
 struct wal_watcher {
 	/**
@@ -584,16 +710,43 @@ struct wal_watcher {
 	ev_stat stat;
 	/** Path to the file being watched with 'stat'. */
 	char filename[PATH_MAX+1];
+#if defined(HAVE_INOTIFY_INIT1)
+	/**
+	 * Reads inotify events of all WAL directories,
+	 * fd is -1 if inotify is not used.
+	 */
+	ev_io inotify;
+#endif
 };
 
 static struct wal_watcher wal_watcher;
 
+/**
+ * With inotify, the directory timer is only a safety net, e.g.
+ * for a WAL directory on a network file system: it doesn't
+ * need to fire often.
+ */
+static const ev_tstamp WAL_WATCHER_FALLBACK_DELAY = 1.0;
+
 static void recovery_rescan_file(ev_stat *w, int revents __attribute__((unused)));
 
+static bool
+recovery_has_inotify(struct wal_watcher *watcher __attribute__((unused)))
+{
+#if defined(HAVE_INOTIFY_INIT1)
+	return watcher->inotify.fd >= 0;
+#else
+	return false;
+#endif
+}
+
 static void
 recovery_watch_file(struct wal_watcher *watcher, struct log_io *wal)
 {
 	strncpy(watcher->filename, wal->filename, PATH_MAX);
+	/* inotify reports changes in the file, nothing to start. */
+	if (recovery_has_inotify(watcher))
+		return;
 	ev_stat_init(&watcher->stat, recovery_rescan_file, watcher->filename, 0.);
 	ev_stat_start(&watcher->stat);
 }
@@ -641,6 +794,134 @@ recovery_rescan_file(ev_stat *w, int revents __attribute__((unused)))
 	}
 }
 
+#if defined(HAVE_INOTIFY_INIT1)
+
+/** Is this a name of a WAL, possibly an .inprogress one? */
+static bool
+recovery_is_wal_name(struct log_dir *dir, const char *name)
+{
+	const char *ext = strchr(name, '.');
+	if (ext == NULL || strncmp(ext, dir->filename_ext,
+				   strlen(dir->filename_ext)) != 0)
+		return false;
+	ext += strlen(dir->filename_ext);
+	return *ext == '\0' || strcmp(ext, inprogress_suffix) == 0;
+}
+
+/**
+ * The LSN a WAL file name starts with. A WAL keeps its LSN
+ * when it loses the '.inprogress' suffix, while the name it is
+ * open with doesn't change.
+ */
+static i64
+recovery_wal_name_lsn(const char *name)
+{
+	const char *base = strrchr(name, '/');
+	return strtoll(base ? base + 1 : name, NULL, 10);
+}
+
+/**
+ * Read all pending inotify events and do what the stat watcher
+ * and the directory timer would do: re-read the tail of the
+ * current WAL when it grows, rescan the directory when a WAL is
+ * created or renamed.
+ */
+static void
+recovery_inotify_cb(ev_io *w, int revents __attribute__((unused)))
+{
+	struct recovery_state *r = w->data;
+	struct wal_watcher *watcher = r->watcher;
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	bool rescan_file = false, rescan_dir = false;
+	ssize_t len;
+
+	while ((len = read(w->fd, buf, sizeof(buf))) > 0) {
+		for (char *pos = buf; pos < buf + len; ) {
+			struct inotify_event *event = (void *) pos;
+			pos += sizeof(*event) + event->len;
+
+			if (event->mask & IN_Q_OVERFLOW) {
+				/* Events were lost, look at everything. */
+				rescan_file = rescan_dir = true;
+				continue;
+			}
+			if (event->len == 0 ||
+			    !recovery_is_wal_name(r->wal_dir, event->name))
+				continue;
+			if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+				rescan_dir = true;
+			} else if (r->current_wal == NULL) {
+				/* A new WAL may have its header by now. */
+				rescan_dir = true;
+			} else {
+				/*
+				 * Rows appended to a newer WAL are read
+				 * when the current one ends.
+				 */
+				i64 lsn = recovery_wal_name_lsn(
+					r->current_wal->filename);
+				if (recovery_wal_name_lsn(event->name) == lsn)
+					rescan_file = true;
+			}
+		}
+	}
+	if (len < 0 && errno != EAGAIN && errno != EINTR)
+		say_syserror("inotify read");
+
+	if (rescan_file && r->current_wal != NULL)
+		recovery_rescan_file(&watcher->stat, 0);
+	if (rescan_dir)
+		recovery_rescan_dir(&watcher->dir_timer, 0);
+}
+
+/**
+ * Start watching all WAL directories with inotify.
+ *
+ * @return 0 on success, -1 if the caller has to poll instead.
+ */
+static int
+recovery_inotify_start(struct recovery_state *r, struct wal_watcher *watcher)
+{
+	const uint32_t mask = IN_MODIFY | IN_CREATE | IN_MOVED_TO;
+	struct log_dir *dir = r->wal_dir;
+
+	int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0) {
+		say_syserror("inotify_init1");
+		return -1;
+	}
+	if (inotify_add_watch(fd, dir->dirname, mask) < 0) {
+		say_syserror("inotify_add_watch, dir: %s", dir->dirname);
+		goto error;
+	}
+	for (int i = 0; i < dir->stripe_count; i++) {
+		if (inotify_add_watch(fd, dir->stripes[i], mask) < 0) {
+			say_syserror("inotify_add_watch, dir: %s",
+				     dir->stripes[i]);
+			goto error;
+		}
+	}
+	ev_io_init(&watcher->inotify, recovery_inotify_cb, fd, EV_READ);
+	watcher->inotify.data = r;
+	ev_io_start(&watcher->inotify);
+	return 0;
+error:
+	close(fd);
+	return -1;
+}
+
+static void
+recovery_inotify_stop(struct wal_watcher *watcher)
+{
+	if (watcher->inotify.fd < 0)
+		return;
+	ev_io_stop(&watcher->inotify);
+	close(watcher->inotify.fd);
+	watcher->inotify.fd = -1;
+}
+
+#endif /* defined(HAVE_INOTIFY_INIT1) */
+
 void
 recovery_follow_local(struct recovery_state *r, ev_tstamp wal_dir_rescan_delay)
 {
@@ -649,6 +930,14 @@ recovery_follow_local(struct recovery_state *r, ev_tstamp wal_dir_rescan_delay)
 
 	struct wal_watcher  *watcher = r->watcher= &wal_watcher;
 
+#if defined(HAVE_INOTIFY_INIT1)
+	watcher->inotify.fd = -1;
+	if (recovery_inotify_start(r, watcher) == 0) {
+		say_info("following `%s' with inotify", r->wal_dir->dirname);
+		wal_dir_rescan_delay = MAX(wal_dir_rescan_delay,
+					   WAL_WATCHER_FALLBACK_DELAY);
+	}
+#endif
 	ev_timer_init(&watcher->dir_timer, recovery_rescan_dir,
 		      wal_dir_rescan_delay, wal_dir_rescan_delay);
 	watcher->dir_timer.data = watcher->stat.data = r;
@@ -669,6 +958,9 @@ recovery_stop_local(struct recovery_state *r)
 	ev_timer_stop(&watcher->dir_timer);
 	if (ev_is_active(&watcher->stat))
 		ev_stat_stop(&watcher->stat);
+#if defined(HAVE_INOTIFY_INIT1)
+	recovery_inotify_stop(watcher);
+#endif
 
 	r->watcher = NULL;
 }
@@ -690,6 +982,21 @@ struct wal_write_request {
 /* Context of the WAL writer thread. */
 STAILQ_HEAD(wal_fifo, wal_write_request);
 
+enum {
+	/** Row size estimate used until the first WAL is closed. */
+	WAL_AVG_ROW_SIZE_DEFAULT = 128,
+	/** A cap on disk space preallocated for a single WAL. */
+	WAL_PREALLOCATE_MAX = 512 * 1024 * 1024,
+	/** Start write-out of WAL data every so many bytes. */
+	WAL_WRITEBACK_BYTES = 1024 * 1024,
+	/**
+	 * How many rotated WALs can wait to be closed.
+	 * When the queue is full, the writer closes a WAL
+	 * itself.
+	 */
+	WAL_CLOSE_QUEUE_MAX = 8,
+};
+
 struct wal_writer
 {
 	struct wal_fifo input;
@@ -699,8 +1006,31 @@ struct wal_writer
 	pthread_cond_t cond;
 	ev_async write_event;
 	struct fio_batch *batch;
+	/**
+	 * Average size of a WAL row, estimated from the
+	 * previous WAL file. Used to preallocate disk space
+	 * for the next file.
+	 */
+	size_t avg_row_size;
 	bool is_shutdown;
 	bool is_rollback;
+	/**
+	 * The helper thread takes file system work off the
+	 * WAL writer critical path: it creates a spare WAL
+	 * in advance, and closes rotated WALs.
+	 * The helper state is protected by the writer mutex.
+	 */
+	pthread_t helper_thread;
+	pthread_cond_t helper_cond;
+	bool is_helper_running;
+	bool is_helper_shutdown;
+	/** A pre-created WAL, to switch to on rotation. */
+	struct log_io *spare;
+	/** Set when the helper must create a new spare WAL. */
+	bool need_spare;
+	/** Rotated WALs, to be closed by the helper, oldest first. */
+	struct log_io *close_queue[WAL_CLOSE_QUEUE_MAX];
+	int close_queue_size;
 };
 
 static pthread_once_t wal_writer_once = PTHREAD_ONCE_INIT;
@@ -716,6 +1046,10 @@ static void
 wal_writer_child()
 {
 	log_io_atfork(&recovery_state->current_wal);
+	log_io_atfork(&wal_writer.spare);
+	for (int i = 0; i < wal_writer.close_queue_size; i++)
+		log_io_atfork(&wal_writer.close_queue[i]);
+	wal_writer.close_queue_size = 0;
 	if (wal_writer.batch) {
 		free(wal_writer.batch);
 		wal_writer.batch = NULL;
@@ -807,10 +1141,18 @@ wal_writer_init(struct wal_writer *writer)
 	(void) tt_pthread_mutexattr_destroy(&errorcheck);
 
 	(void) tt_pthread_cond_init(&writer->cond, NULL);
+	(void) tt_pthread_cond_init(&writer->helper_cond, NULL);
 
 	STAILQ_INIT(&writer->input);
 	STAILQ_INIT(&writer->commit);
 
+	writer->avg_row_size = WAL_AVG_ROW_SIZE_DEFAULT;
+	writer->is_helper_running = false;
+	writer->is_helper_shutdown = false;
+	writer->spare = NULL;
+	writer->need_spare = true;
+	writer->close_queue_size = 0;
+
 	ev_async_init(&writer->write_event, (void *)wal_schedule);
 	writer->write_event.data = writer;
 
@@ -828,12 +1170,16 @@ wal_writer_destroy(struct wal_writer *writer)
 {
 	(void) tt_pthread_mutex_destroy(&writer->mutex);
 	(void) tt_pthread_cond_destroy(&writer->cond);
+	(void) tt_pthread_cond_destroy(&writer->helper_cond);
 	free(writer->batch);
 }
 
 /** WAL writer thread routine. */
 static void *wal_writer_thread(void *worker_args);
 
+/** WAL helper thread routine. */
+static void *wal_helper_thread(void *worker_args);
+
 /**
  * Initialize WAL writer, start the thread.
  *
@@ -869,6 +1215,15 @@ wal_writer_start(struct recovery_state *r)
 		r->writer = NULL;
 		return -1;
 	}
+	/*
+	 * The helper is an optimization: the writer
+	 * can do without it.
+	 */
+	(void) tt_pthread_mutex_lock(&wal_writer.mutex);
+	if (tt_pthread_create(&wal_writer.helper_thread, NULL,
+			      wal_helper_thread, r) == 0)
+		wal_writer.is_helper_running = true;
+	(void) tt_pthread_mutex_unlock(&wal_writer.mutex);
 	return 0;
 }
 
@@ -890,6 +1245,18 @@ wal_writer_stop(struct recovery_state *r)
 		panic_syserror("WAL writer: thread join failed");
 	}
 
+	/* Let the helper close the remaining WALs, and stop it. */
+
+	(void) tt_pthread_mutex_lock(&writer->mutex);
+	bool is_helper_running = writer->is_helper_running;
+	writer->is_helper_shutdown = true;
+	(void) tt_pthread_cond_signal(&writer->helper_cond);
+	(void) tt_pthread_mutex_unlock(&writer->mutex);
+
+	if (is_helper_running &&
+	    tt_pthread_join(writer->helper_thread, NULL) != 0)
+		panic_syserror("WAL writer: helper thread join failed");
+
 	ev_async_stop(&writer->write_event);
 	wal_writer_destroy(writer);
 
@@ -914,6 +1281,94 @@ wal_writer_pop(struct wal_writer *writer, struct wal_fifo *input)
 	}
 }
 
+/**
+ * Update the average WAL row size estimate with the
+ * statistics of a WAL which is about to be closed.
+ */
+static void
+wal_update_avg_row_size(struct wal_writer *writer, struct log_io *wal)
+{
+	if (wal->rows == 0)
+		return;
+	off_t size = fio_lseek(fileno(wal->f), 0, SEEK_CUR);
+	if (size <= 0)
+		return;
+	/* The helper reads the estimate to preallocate a spare WAL. */
+	(void) tt_pthread_mutex_lock(&writer->mutex);
+	writer->avg_row_size = MAX(size / wal->rows, 1);
+	(void) tt_pthread_mutex_unlock(&writer->mutex);
+}
+
+/**
+ * Reserve disk space for a new WAL, enough to hold
+ * rows_per_wal rows of the average size. Only a hint:
+ * a failure is not an error.
+ */
+static void
+wal_opt_preallocate(struct wal_writer *writer, struct log_io *wal,
+		    int rows_per_wal)
+{
+	off_t size = (off_t) rows_per_wal * writer->avg_row_size;
+	(void) log_io_preallocate(wal, MIN(size, WAL_PREALLOCATE_MAX));
+}
+
+/**
+ * Take the spare WAL pre-created by the helper thread, if
+ * there is one, and give it the name of a WAL starting with
+ * the given LSN. Ask the helper to create the next spare.
+ *
+ * @return the new WAL or NULL, if there is no spare WAL.
+ */
+static struct log_io *
+wal_take_spare(struct wal_writer *writer, u64 lsn)
+{
+	(void) tt_pthread_mutex_lock(&writer->mutex);
+	struct log_io *l = writer->spare;
+	writer->spare = NULL;
+	(void) tt_pthread_mutex_unlock(&writer->mutex);
+
+	/*
+	 * Rename the spare before asking for the next one:
+	 * all spare WALs share the same file name.
+	 */
+	if (l != NULL && spare_log_rename(l, lsn) != 0)
+		log_io_discard(&l);
+
+	(void) tt_pthread_mutex_lock(&writer->mutex);
+	writer->need_spare = true;
+	(void) tt_pthread_cond_signal(&writer->helper_cond);
+	(void) tt_pthread_mutex_unlock(&writer->mutex);
+	return l;
+}
+
+/**
+ * Finish a rotated WAL and hand it over to the helper thread,
+ * which closes it off the critical path. Close the WAL right
+ * away if there is no helper or it lags too much behind.
+ *
+ * The WAL gets its EOF marker and is synced here, before the
+ * first row of the next WAL is written: otherwise a crash
+ * could leave a truncated or '.inprogress' WAL followed by a
+ * newer one, which recovery doesn't accept.
+ */
+static void
+wal_close_async(struct wal_writer *writer, struct log_io **wal)
+{
+	log_io_finish(*wal);
+
+	(void) tt_pthread_mutex_lock(&writer->mutex);
+	if (writer->is_helper_running &&
+	    writer->close_queue_size < WAL_CLOSE_QUEUE_MAX) {
+		writer->close_queue[writer->close_queue_size++] = *wal;
+		*wal = NULL;
+		(void) tt_pthread_cond_signal(&writer->helper_cond);
+	}
+	(void) tt_pthread_mutex_unlock(&writer->mutex);
+
+	if (*wal != NULL)
+		log_io_close(wal);
+}
+
 /**
  * If there is no current WAL, try to open it, and close the
  * previous WAL. We close the previous WAL only after opening
@@ -929,7 +1384,8 @@ wal_writer_pop(struct wal_writer *writer, struct wal_fifo *input)
  * @return 0 in case of success, -1 on error.
  */
 static int
-wal_opt_rotate(struct log_io **wal, int rows_per_wal, struct log_dir *dir, u64 lsn)
+wal_opt_rotate(struct wal_writer *writer, struct log_io **wal,
+	       int rows_per_wal, struct log_dir *dir, u64 lsn)
 {
 	struct log_io *l = *wal, *wal_to_close = NULL;
 
@@ -937,15 +1393,21 @@ wal_opt_rotate(struct log_io **wal, int rows_per_wal, struct log_dir *dir, u64 l
 
 	if (l != NULL && (l->rows >= rows_per_wal || lsn % rows_per_wal == 0)) {
 		/*
-		 * if l->rows == 1, log_io_close() does
+		 * if l->rows == 1, log_io_finish() does
 		 * inprogress_log_rename() for us.
 		 */
 		wal_to_close = l;
 		l = NULL;
+		wal_update_avg_row_size(writer, wal_to_close);
 	}
 	if (l == NULL) {
 		/* Open WAL with '.inprogress' suffix. */
-		l = log_io_open_for_write(dir, lsn, INPROGRESS);
+		l = wal_take_spare(writer, lsn);
+		if (l == NULL) {
+			l = log_io_open_for_write(dir, lsn, INPROGRESS);
+			if (l != NULL)
+				wal_opt_preallocate(writer, l, rows_per_wal);
+		}
 		/*
 		 * Close the file *after* we create the new WAL, since
 		 * this is when replication relays get an inotify alarm
@@ -960,7 +1422,7 @@ wal_opt_rotate(struct log_io **wal, int rows_per_wal, struct log_dir *dir, u64 l
 			 * A warning is written to the server
 			 * log file.
 			 */
-			log_io_close(&wal_to_close);
+			wal_close_async(writer, &wal_to_close);
 		}
 	} else if (l->rows == 1) {
 		/*
@@ -991,6 +1453,19 @@ wal_opt_sync(struct log_io *wal, double sync_delay)
 	}
 }
 
+/**
+ * Unless the WAL is opened with O_SYNC, push the written
+ * data to disk in the background, so that the next
+ * fsync() has only a small tail to wait for.
+ */
+static void
+wal_opt_writeback(struct log_io *wal, size_t bytes)
+{
+	if (wal->dir->open_wflags & WAL_SYNC_FLAG)
+		return;
+	log_io_writeback(wal, bytes, WAL_WRITEBACK_BYTES);
+}
+
 static struct wal_write_request *
 wal_fill_batch(struct log_io *wal, struct fio_batch *batch, int rows_per_wal,
 	       struct wal_write_request *req)
@@ -1033,14 +1508,18 @@ wal_write_to_disk(struct recovery_state *r, struct wal_writer *writer,
 	struct wal_write_request *write_end = req;
 
 	while (req) {
-		if (wal_opt_rotate(wal, r->rows_per_wal, r->wal_dir,
+		if (wal_opt_rotate(writer, wal, r->rows_per_wal, r->wal_dir,
 				   req->row.header.lsn) != 0)
 			break;
 		struct wal_write_request *batch_end;
+		off_t index_offset = log_io_index_offset(*wal);
 		batch_end = wal_fill_batch(*wal, batch, r->rows_per_wal, req);
 		write_end = wal_write_batch(*wal, batch, req, batch_end);
 		if (batch_end != write_end)
 			break;
+		log_io_index_add(*wal, req->row.header.lsn, index_offset,
+				 batch->bytes);
+		wal_opt_writeback(*wal, batch->bytes);
 		wal_opt_sync(*wal, r->wal_fsync_delay);
 		req = write_end;
 	}
@@ -1086,6 +1565,59 @@ wal_writer_thread(void *worker_args)
 	return NULL;
 }
 
+/**
+ * WAL helper thread main loop: close rotated WALs, and keep
+ * a spare WAL at hand. On shutdown, close all WALs in the
+ * queue and remove the unused spare.
+ */
+static void *
+wal_helper_thread(void *worker_args)
+{
+	struct recovery_state *r = worker_args;
+	struct wal_writer *writer = r->writer;
+
+	(void) tt_pthread_mutex_lock(&writer->mutex);
+	for (;;) {
+		if (writer->close_queue_size > 0) {
+			struct log_io *wal = writer->close_queue[0];
+			writer->close_queue_size--;
+			memmove(writer->close_queue, writer->close_queue + 1,
+				writer->close_queue_size *
+				sizeof(*writer->close_queue));
+			(void) tt_pthread_mutex_unlock(&writer->mutex);
+			log_io_close(&wal);
+			(void) tt_pthread_mutex_lock(&writer->mutex);
+			continue;
+		}
+		if (writer->is_helper_shutdown)
+			break;
+		if (writer->need_spare) {
+			writer->need_spare = false;
+			if (writer->spare != NULL)
+				continue;
+			off_t size = (off_t) r->rows_per_wal *
+				writer->avg_row_size;
+			(void) tt_pthread_mutex_unlock(&writer->mutex);
+			struct log_io *spare = spare_log_create(r->wal_dir);
+			if (spare != NULL)
+				(void) log_io_preallocate(spare,
+					MIN(size, WAL_PREALLOCATE_MAX));
+			(void) tt_pthread_mutex_lock(&writer->mutex);
+			assert(writer->spare == NULL);
+			writer->spare = spare;
+			continue;
+		}
+		(void) tt_pthread_cond_wait(&writer->helper_cond,
+					    &writer->mutex);
+	}
+	struct log_io *spare = writer->spare;
+	writer->spare = NULL;
+	(void) tt_pthread_mutex_unlock(&writer->mutex);
+	if (spare != NULL)
+		log_io_discard(&spare);
+	return NULL;
+}
+
 /**
  * WAL writer main entry point: queue a single request
  * to be written to disk and wait until this task is completed.
@@ -1130,96 +1662,381 @@ wal_write(struct recovery_state *r, i64 lsn, u64 cookie,
 
 /* {{{ SAVE SNAPSHOT and tarantool_box --cat */
 
+enum {
+	SNAP_BUF_SIZE = 1024 * 1024,
+	/** Write out and evict the snapshot in chunks of this size. */
+	SNAP_WRITEBACK_BYTES = 4 * 1024 * 1024,
+	/** The smallest batch when the rate is limited. */
+	SNAP_RATE_BATCH_MIN = 64 * 1024,
+	/**
+	 * The rate limiter lets through a burst of at most
+	 * 1/SNAP_RATE_TICKS of a second worth of data.
+	 */
+	SNAP_RATE_TICKS = 10,
+};
+
+/**
+ * Rows of the snapshot part being saved by this thread. A
+ * snapshot is written either by a child process or by threads,
+ * so no fiber state may be used here: rows are built in a plain
+ * malloc()ed buffer which is reused as soon as a batch is
+ * written out.
+ */
+static __thread struct snap_writer {
+	char *buf;
+	size_t buf_size;
+	size_t buf_used;
+	int rows;
+	/** Parts written at once share snap_io_rate_limit. */
+	int part_count;
+	/** Token bucket of snap_io_rate_limit, in bytes. */
+	double tokens;
+	ev_tstamp last;
+	/** errno of the first failed write, the rest is skipped. */
+	int error;
+} snap_writer;
+
+/**
+ * Wait until snap_io_rate_limit lets through the given number
+ * of bytes. The bucket refills continuously, so a throttled
+ * snapshot is written in small, evenly spaced batches rather
+ * than in a burst at the start of every second.
+ * ev_now_update() is not thread-safe, ev_time() is.
+ */
+static void
+snap_throttle(size_t bytes)
+{
+	double rate = recovery_state->snap_io_rate_limit;
+	if (rate <= 0)
+		return;
+	rate /= snap_writer.part_count;
+
+	double burst = rate / SNAP_RATE_TICKS;
+	ev_tstamp now = ev_time();
+	if (snap_writer.last == 0)
+		snap_writer.tokens = burst;
+	else
+		snap_writer.tokens += (now - snap_writer.last) * rate;
+	if (snap_writer.tokens > burst)
+		snap_writer.tokens = burst;
+	snap_writer.last = now;
+
+	snap_writer.tokens -= bytes;
+	if (snap_writer.tokens < 0)
+		usleep(-snap_writer.tokens / rate * 1000000);
+}
+
+/** How many bytes to accumulate before writing a batch. */
+static size_t
+snap_batch_size(void)
+{
+	size_t size = snap_writer.buf_size;
+	int rate = recovery_state->snap_io_rate_limit / snap_writer.part_count;
+	if (rate > 0)
+		size = MIN(size, (size_t) MAX(rate / SNAP_RATE_TICKS,
+					      SNAP_RATE_BATCH_MIN));
+	return size;
+}
+
 static void
-snap_write_batch(struct fio_batch *batch, int fd)
+snap_write_batch(struct fio_batch *batch, struct log_io *l)
 {
-	int rows_written = fio_batch_write(batch, fd);
-	if (rows_written != batch->rows) {
-		say_error("partial write: %d out of %d rows",
-			  rows_written, batch->rows);
-		panic_syserror("fio_batch_write");
+	if (batch->rows && snap_writer.error == 0) {
+		int rc;
+		snap_throttle(batch->bytes);
+		if (l->is_compressed) {
+			/* The rows of the batch are contiguous in the buffer. */
+			rc = log_io_write_block(l, snap_writer.buf,
+						snap_writer.buf_used);
+		} else {
+			int rows_written = fio_batch_write(batch, fileno(l->f));
+			rc = rows_written == batch->rows ? 0 : -1;
+		}
+		if (rc != 0) {
+			snap_writer.error = errno ? errno : EIO;
+			say_syserror("failed to write %d rows", batch->rows);
+		} else {
+			/* Keep the snapshot out of the page cache. */
+			log_io_writeback(l, batch->bytes,
+					 SNAP_WRITEBACK_BYTES);
+		}
 	}
+	fio_batch_start(batch, INT_MAX);
+	snap_writer.buf_used = 0;
 }
 
-void
-snapshot_write_row(struct log_io *l, struct fio_batch *batch,
-		   const void *metadata, size_t metadata_len,
-		   const void *data, size_t data_len)
+static void
+snap_write_row(struct log_io *l, struct fio_batch *batch, u16 tag,
+	       const void *metadata, size_t metadata_len,
+	       const void *data, size_t data_len)
 {
-	static int rows;
-	static int bytes;
-	ev_tstamp elapsed;
-	static ev_tstamp last = 0;
+	size_t row_size = sizeof(struct row_v11) + data_len + metadata_len;
 
-	struct row_v11 *row = palloc(fiber->gc_pool,
-				     sizeof(struct row_v11) +
-				     data_len + metadata_len);
+	if (snap_writer.error)
+		return;
+
+	if (snap_writer.buf_used + row_size > snap_batch_size()) {
+		snap_write_batch(batch, l);
+		if (row_size > snap_writer.buf_size) {
+			/* The batch is empty, nothing points to the buffer. */
+			char *buf = realloc(snap_writer.buf, row_size);
+			if (buf == NULL) {
+				snap_writer.error = ENOMEM;
+				say_error("can't allocate %zu bytes for a row",
+					  row_size);
+				return;
+			}
+			snap_writer.buf = buf;
+			snap_writer.buf_size = row_size;
+		}
+	}
+	struct row_v11 *row = (struct row_v11 *)
+		(snap_writer.buf + snap_writer.buf_used);
+	snap_writer.buf_used += row_size;
 
-	row_v11_fill(row, 0, SNAP, snapshot_cookie,
+	row_v11_fill(row, 0, tag, snapshot_cookie,
 		     metadata, metadata_len, data, data_len);
 	header_v11_sign(&row->header);
 
 	fio_batch_add(batch, row, row_v11_size(row));
 
-	if (++rows % 100000 == 0)
-		say_crit("%.1fM rows written", rows / 1000000.);
+	if (++snap_writer.rows % 100000 == 0)
+		say_crit("%.1fM rows written", snap_writer.rows / 1000000.);
 
-	if (fio_batch_is_full(batch)) {
-		snap_write_batch(batch, fileno(l->f));
-		fio_batch_start(batch, INT_MAX);
-		prelease_after(fiber->gc_pool, 128 * 1024);
-	}
+	if (fio_batch_is_full(batch))
+		snap_write_batch(batch, l);
+}
 
-	if (recovery_state->snap_io_rate_limit > 0) {
-		if (last == 0) {
-			ev_now_update();
-			last = ev_now();
-		}
-		bytes += row_v11_size(row);
-		while (bytes >= recovery_state->snap_io_rate_limit) {
+void
+snapshot_write_row(struct log_io *l, struct fio_batch *batch,
+		   const void *metadata, size_t metadata_len,
+		   const void *data, size_t data_len)
+{
+	snap_write_row(l, batch, SNAP, metadata, metadata_len,
+		       data, data_len);
+}
 
-			ev_now_update();
-			elapsed = ev_now() - last;
-			if (elapsed < 1)
-				usleep(((1 - elapsed) * 1000000));
+/**
+ * Write a row of a delta snapshot: a request, as in a WAL, the
+ * metadata starting with the request type.
+ */
+void
+delta_write_row(struct log_io *l, struct fio_batch *batch,
+		const void *metadata, size_t metadata_len,
+		const void *data, size_t data_len)
+{
+	snap_write_row(l, batch, XLOG, metadata, metadata_len,
+		       data, data_len);
+}
 
-			ev_now_update();
-			last = ev_now();
-			bytes -= recovery_state->snap_io_rate_limit;
-		}
+/** A part of a snapshot and the thread which writes it. */
+struct snap_part {
+	struct log_io *l;
+	int part;
+	int part_count;
+	snapshot_part_f f;
+	pthread_t thread;
+	/** 0 or errno of the failure. */
+	int error;
+};
+
+static void *
+snap_write_part(void *arg)
+{
+	struct snap_part *p = arg;
+	struct fio_batch *batch = fio_batch_alloc(sysconf(_SC_IOV_MAX));
+
+	memset(&snap_writer, 0, sizeof(snap_writer));
+	snap_writer.part_count = p->part_count;
+	snap_writer.buf = malloc(SNAP_BUF_SIZE);
+	if (batch == NULL || snap_writer.buf == NULL) {
+		say_error("Failed to save snapshot: can't allocate buffers");
+		p->error = ENOMEM;
+	} else {
+		snap_writer.buf_size = SNAP_BUF_SIZE;
+		fio_batch_start(batch, INT_MAX);
+		p->f(p->l, batch, p->part, p->part_count);
+		snap_write_batch(batch, p->l);
+		p->error = snap_writer.error;
 	}
+	free(batch);
+	free(snap_writer.buf);
+	snap_writer.buf = NULL;
+	return NULL;
 }
 
-void
-snapshot_save(struct recovery_state *r,
-	      void (*f) (struct log_io *, struct fio_batch *))
+/**
+ * Save a snapshot or a delta snapshot (base_lsn > 0) of the state
+ * as of the given LSN to a file of the given directory.
+ */
+static int
+snap_save(struct log_dir *dir, i64 lsn, i64 base_lsn, int part_count,
+	  snapshot_part_f f)
 {
-	struct log_io *snap;
-	snap = log_io_open_for_write(r->snap_dir, r->confirmed_lsn,
-				     INPROGRESS);
-	if (snap == NULL)
-		panic_status(errno, "Failed to save snapshot: failed to open file in write mode.");
-	struct fio_batch *batch = fio_batch_alloc(sysconf(_SC_IOV_MAX));
-	if (batch == NULL)
-		panic_syserror("fio_batch_alloc");
-	fio_batch_start(batch, INT_MAX);
+	struct snap_part parts[LOG_PARTS_MAX];
+	int error = 0, threads = 1;
+	char line[64];
+
+	assert(part_count >= 1 && part_count <= LOG_PARTS_MAX);
+	memset(parts, 0, sizeof(parts[0]) * part_count);
+	parts[0].l = log_io_open_for_write(dir, lsn, INPROGRESS);
+	if (parts[0].l == NULL) {
+		say_syserror("Failed to save snapshot: failed to open file in write mode.");
+		return -1;
+	}
+	if (part_count > 1) {
+		snprintf(line, sizeof(line), "Parts: %d", part_count);
+		if (log_io_append_header(parts[0].l, line) != 0)
+			error = errno;
+	}
+	if (base_lsn > 0 && error == 0) {
+		snprintf(line, sizeof(line), "Base: %" PRIi64, base_lsn);
+		if (log_io_append_header(parts[0].l, line) != 0)
+			error = errno;
+	}
+	for (int k = 1; k < part_count && error == 0; k++) {
+		parts[k].l = log_io_open_part_for_write(dir, lsn, k);
+		if (parts[k].l == NULL)
+			error = errno;
+	}
+	for (int k = 0; k < part_count; k++) {
+		parts[k].part = k;
+		parts[k].part_count = part_count;
+		parts[k].f = f;
+	}
 	/*
 	 * While saving a snapshot, snapshot name is set to
 	 * <lsn>.snap.inprogress. When done, the snapshot is
 	 * renamed to <lsn>.snap.
 	 */
-	say_info("saving snapshot `%s'",
-		 format_filename(r->snap_dir, r->confirmed_lsn,
-				 NONE));
-	f(snap, batch);
-
-	if (batch->rows)
-		snap_write_batch(batch, fileno(snap->f));
+	say_info("saving snapshot `%s'", format_filename(dir, lsn, NONE));
+	if (error == 0) {
+		for (; threads < part_count; threads++) {
+			error = tt_pthread_create(&parts[threads].thread, NULL,
+						  snap_write_part,
+						  &parts[threads]);
+			if (error != 0)
+				break;
+		}
+		/* This thread writes the first part. */
+		if (error == 0)
+			snap_write_part(&parts[0]);
+		for (int k = 1; k < threads; k++)
+			(void) tt_pthread_join(parts[k].thread, NULL);
+	}
+	for (int k = 0; k < part_count && error == 0; k++)
+		error = parts[k].error;
 
-	free(batch);
-	log_io_close(&snap);
+	if (error != 0) {
+		for (int k = 0; k < part_count; k++) {
+			if (parts[k].l != NULL)
+				log_io_discard(&parts[k].l);
+		}
+		errno = error;
+		return -1;
+	}
+	/* The first part makes the snapshot visible, close it last. */
+	for (int k = part_count - 1; k > 0; k--) {
+		if (log_io_close(&parts[k].l) != 0)
+			error = errno;
+	}
+	if (error != 0) {
+		log_io_discard(&parts[0].l);
+		errno = error;
+		return -1;
+	}
+	if (log_io_close(&parts[0].l) != 0)
+		return -1;
 
 	say_info("done");
+	return 0;
+}
+
+/**
+ * Save a snapshot of the state as of the given LSN. Safe to
+ * call from a thread other than the main one: the callback must
+ * then iterate over a read view which is stable while it runs.
+ *
+ * With part_count > 1, the rows are split into as many files,
+ * written by as many threads at once: part 0 goes to <lsn>.snap,
+ * which lists the number of parts in its header and is renamed
+ * into place last, the others to <lsn>.snap.<part>.
+ *
+ * @return 0 on success, -1 on error (errno is set).
+ */
+int
+snapshot_save(struct recovery_state *r, i64 lsn, int part_count,
+	      snapshot_part_f f)
+{
+	return snap_save(r->snap_dir, lsn, 0, part_count, f);
+}
+
+/**
+ * Save the changes made since the snapshot or delta snapshot
+ * at base_lsn to <lsn>.delta, which names the base in its
+ * header. The callback writes them with delta_write_row().
+ *
+ * @return 0 on success, -1 on error (errno is set).
+ */
+int
+snapshot_save_delta(struct recovery_state *r, i64 base_lsn, i64 lsn,
+		    snapshot_part_f f)
+{
+	assert(base_lsn > 0 && base_lsn < lsn);
+	return snap_save(r->delta_dir, lsn, base_lsn, 1, f);
+}
+
+/** The newest file of a directory which is not in progress. */
+static i64
+last_complete_lsn(struct log_dir *dir)
+{
+	i64 *lsn;
+	ssize_t count = scan_dir(dir, &lsn);
+
+	while (--count >= 0) {
+		if (access(format_filename(dir, lsn[count], NONE), F_OK) == 0)
+			return lsn[count];
+	}
+	return 0;
+}
+
+/**
+ * Find the snapshot the next delta snapshot would be based on:
+ * the newest full snapshot, or the last of the chain of delta
+ * snapshots on top of it, as recover_deltas() would apply them.
+ *
+ * @param[out] delta_count  the length of the chain
+ *
+ * @return the LSN of the snapshot, 0 if there is none.
+ */
+i64
+snapshot_last(struct recovery_state *r, int *delta_count)
+{
+	i64 base = last_complete_lsn(r->snap_dir);
+	*delta_count = 0;
+	if (base <= 0)
+		return 0;
+
+	i64 *lsn;
+	ssize_t count = scan_dir(r->delta_dir, &lsn);
+	for (ssize_t k = 0; k < count; k++) {
+		if (lsn[k] <= base)
+			continue;
+		char *filename = format_filename(r->delta_dir, lsn[k], NONE);
+		FILE *f = fopen(filename, "r");
+		if (f == NULL)
+			continue;
+		struct log_io *delta = log_io_open(r->delta_dir, LOG_READ,
+						   filename, NONE, f);
+		if (delta == NULL)
+			continue;
+		if (delta->base_lsn == base) {
+			base = lsn[k];
+			++*delta_count;
+		}
+		log_io_close(&delta);
+	}
+	return base;
 }
 
 /**
@@ -1243,6 +2060,10 @@ read_log(const char *filename,
 	} else if (strstr(filename, snap_dir.filename_ext)) {
 		dir = &snap_dir;
 		h = snap_handler;
+	} else if (strstr(filename, delta_dir.filename_ext)) {
+		/* Delta snapshots consist of WAL rows. */
+		dir = &delta_dir;
+		h = xlog_handler;
 	} else {
 		say_error("don't know how to read `%s'", filename);
 		return -1;
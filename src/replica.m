@@ -31,31 +31,90 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "log_io.h"
 #include "fiber.h"
 #include "pickle.h"
 #include "coio_buf.h"
+#include <third_party/lzf/lzf.h>
 
-static void
-remote_apply_row(struct recovery_state *r, struct tbuf *row);
+static i64
+remote_apply_rows(struct recovery_state *r, struct tbuf *row,
+		  struct iobuf *iobuf);
 
-static struct tbuf
-remote_read_row(struct ev_io *coio, struct iobuf *iobuf)
+/**
+ * Decompress the next block of a compressed stream, read into
+ * zbuf, to the input buffer.
+ */
+static void
+remote_read_block(struct ev_io *coio, struct iobuf *iobuf,
+		  struct iobuf *zbuf)
 {
 	struct ibuf *in = &iobuf->in;
-	ssize_t to_read = sizeof(struct header_v11) - ibuf_size(in);
+	struct ibuf *zin = &zbuf->in;
+	ssize_t to_read = sizeof(struct replication_block) - ibuf_size(zin);
 
 	if (to_read > 0) {
-		ibuf_reserve(in, cfg_readahead);
-		coio_breadn(coio, in, to_read);
+		ibuf_reserve(zin, cfg_readahead);
+		coio_breadn(coio, zin, to_read);
 	}
 
-	ssize_t request_len = ((struct header_v11 *)in->pos)->len + sizeof(struct header_v11);
-	to_read = request_len - ibuf_size(in);
+	struct replication_block *block = (void *) zin->pos;
+	if (block->raw_len > REPLICATION_BLOCK_MAX ||
+	    block->len > block->raw_len)
+		tnt_raise(SystemError, :"corrupt compressed block");
+	ssize_t block_len = block->len + sizeof(struct replication_block);
+	to_read = block_len - ibuf_size(zin);
 
 	if (to_read > 0)
-		coio_breadn(coio, in, to_read);
+		coio_breadn(coio, zin, to_read);
+
+	block = (void *) zin->pos;
+	ibuf_reserve(in, block->raw_len);
+	if (block->len == block->raw_len)
+		memcpy(in->end, block + 1, block->len);
+	else if (lzf_decompress(block + 1, block->len, in->end,
+				block->raw_len) != block->raw_len)
+		tnt_raise(SystemError, :"corrupt compressed block");
+	in->end += block->raw_len;
+	zin->pos += block_len;
+}
+
+/**
+ * Read until there are at least sz bytes of rows in the input
+ * buffer. A compressed stream is read to zbuf, and decompressed
+ * a block at a time.
+ */
+static void
+remote_readn(struct ev_io *coio, struct iobuf *iobuf, struct iobuf *zbuf,
+	     size_t sz)
+{
+	struct ibuf *in = &iobuf->in;
+
+	if (zbuf == NULL) {
+		ssize_t to_read = sz - ibuf_size(in);
+		if (to_read > 0) {
+			ibuf_reserve(in, cfg_readahead);
+			coio_breadn(coio, in, to_read);
+		}
+		return;
+	}
+	while (ibuf_size(in) < sz)
+		remote_read_block(coio, iobuf, zbuf);
+}
+
+static struct tbuf
+remote_read_row(struct ev_io *coio, struct iobuf *iobuf, struct iobuf *zbuf)
+{
+	struct ibuf *in = &iobuf->in;
+
+	remote_readn(coio, iobuf, zbuf, sizeof(struct header_v11));
+
+	ssize_t request_len = ((struct header_v11 *)in->pos)->len + sizeof(struct header_v11);
+	remote_readn(coio, iobuf, zbuf, request_len);
 
 	struct tbuf row = {
 		.size = request_len, .capacity = request_len,
@@ -65,25 +124,129 @@ remote_read_row(struct ev_io *coio, struct iobuf *iobuf)
 	return row;
 }
 
+/**
+ * Take the next row from the input buffer if it's there
+ * completely, without reading from the socket.
+ */
+static bool
+remote_buffered_row(struct iobuf *iobuf, struct tbuf *row)
+{
+	struct ibuf *in = &iobuf->in;
+
+	if (ibuf_size(in) < sizeof(struct header_v11))
+		return false;
+	ssize_t request_len = ((struct header_v11 *)in->pos)->len + sizeof(struct header_v11);
+	if (ibuf_size(in) < request_len)
+		return false;
+
+	*row = (struct tbuf) {
+		.size = request_len, .capacity = request_len,
+		.data = in->pos, .pool = fiber->gc_pool
+	};
+	in->pos += request_len;
+	return true;
+}
+
+/**
+ * Connect and subscribe to the rows from initial_lsn on, or to
+ * the snapshot of the master and all rows after it, if join is
+ * set.
+ */
 static void
-remote_connect(struct ev_io *coio, struct sockaddr_in *remote_addr,
-	       i64 initial_lsn, const char **err)
+remote_connect(struct ev_io *coio, struct remote *remote,
+	       i64 initial_lsn, bool join, const char **err)
 {
+	i64 lsn = initial_lsn;
+	if (remote->compress)
+		lsn |= REPLICATION_LZF_FLAG;
+	if (join)
+		lsn |= REPLICATION_JOIN_FLAG;
+	if (remote->heartbeat)
+		lsn |= REPLICATION_HEARTBEAT_FLAG;
+	if (remote->ack)
+		lsn |= REPLICATION_ACK_FLAG;
+	if (remote->space_count > 0)
+		lsn |= REPLICATION_SPACES_FLAG;
+
 	*err = "can't connect to master";
-	coio_connect(coio, remote_addr);
+	coio_connect(coio, &remote->addr);
 
 	*err = "can't write version";
-	coio_write(coio, &initial_lsn, sizeof(initial_lsn));
+	struct iovec iov[3] = {
+		{ .iov_base = &lsn, .iov_len = sizeof(lsn) },
+		{ .iov_base = &remote->space_count,
+		  .iov_len = sizeof(remote->space_count) },
+		{ .iov_base = remote->spaces,
+		  .iov_len = remote->space_count * sizeof(*remote->spaces) },
+	};
+	coio_writev(coio, iov, remote->space_count > 0 ? 3 : 1, 0);
 
 	u32 version;
 	*err = "can't read version";
 	coio_readn(coio, &version, sizeof(version));
 	*err = NULL;
-	if (version != default_version)
+	if (remote->heartbeat &&
+	    (version & REPLICATION_HEARTBEAT_VERSION) == 0) {
+		/* It has no rows for the flagged LSN, ask again. */
+		say_warn("the master can't send heartbeats, the lag "
+			 "is not updated while it's idle");
+		remote->heartbeat = false;
+		evio_close(coio);
+		remote_connect(coio, remote, initial_lsn, join, err);
+		return;
+	}
+	if (remote->ack && (version & REPLICATION_ACK_VERSION) == 0) {
+		/* It has no rows for the flagged LSN, ask again. */
+		say_warn("the master can't take confirmations of written "
+			 "rows, it doesn't wait for this replica");
+		remote->ack = false;
+		evio_close(coio);
+		remote_connect(coio, remote, initial_lsn, join, err);
+		return;
+	}
+	if (remote->compress &&
+	    (version & ~(REPLICATION_JOIN_VERSION |
+			 REPLICATION_HEARTBEAT_VERSION |
+			 REPLICATION_ACK_VERSION |
+			 REPLICATION_SPACES_VERSION)) == default_version) {
+		/* It has no rows for the flagged LSN, ask again. */
+		say_warn("the master can't compress the replication "
+			 "stream, replicating uncompressed");
+		remote->compress = false;
+		evio_close(coio);
+		remote_connect(coio, remote, initial_lsn, join, err);
+		return;
+	}
+	if (remote->space_count > 0 &&
+	    (version & REPLICATION_SPACES_VERSION) == 0) {
+		*err = "the master can't send the rows of some spaces "
+			"only, unset replication_spaces";
+		tnt_raise(SystemError, :"remote version mismatch");
+	}
+	if (join && (version & REPLICATION_JOIN_VERSION) == 0) {
+		*err = "the master can't send its snapshot, "
+			"copy one from it to the snapshot directory";
+		tnt_raise(SystemError, :"remote version mismatch");
+	}
+	u32 expected = remote->compress ? lzf_replication_version :
+		default_version;
+	if (join)
+		expected |= REPLICATION_JOIN_VERSION;
+	if (remote->heartbeat)
+		expected |= REPLICATION_HEARTBEAT_VERSION;
+	if (remote->ack)
+		expected |= REPLICATION_ACK_VERSION;
+	if (remote->space_count > 0)
+		expected |= REPLICATION_SPACES_VERSION;
+	if (version != expected)
 		tnt_raise(SystemError, :"remote version mismatch");
 
 	say_crit("successfully connected to master");
-	say_crit("starting replication from lsn: %" PRIi64, initial_lsn);
+	if (join)
+		say_crit("joining the master, receiving its snapshot");
+	else
+		say_crit("starting replication from lsn: %" PRIi64,
+			 initial_lsn);
 }
 
 static void
@@ -92,6 +255,8 @@ pull_from_remote(va_list ap)
 	struct recovery_state *r = va_arg(ap, struct recovery_state *);
 	struct ev_io coio;
 	struct iobuf *iobuf = NULL;
+	/* The compressed stream, if the master compresses it. */
+	struct iobuf *zbuf = NULL;
 	bool warning_said = false;
 	const int reconnect_delay = 1;
 
@@ -104,28 +269,49 @@ pull_from_remote(va_list ap)
 			if (! evio_is_connected(&coio)) {
 				if (iobuf == NULL)
 					iobuf = iobuf_create(fiber->name);
-				remote_connect(&coio, &r->remote->addr,
-					       r->confirmed_lsn + 1, &err);
+				if (zbuf != NULL) {
+					iobuf_destroy(zbuf);
+					zbuf = NULL;
+				}
+				/* Drop what is left from the last connection. */
+				iobuf->in.pos = iobuf->in.end;
+				iobuf_gc(iobuf);
+				/* A new replica, with no snapshot. */
+				bool join = r->confirmed_lsn == 0;
+				remote_connect(&coio, r->remote,
+					       r->confirmed_lsn + 1, join, &err);
+				if (r->remote->compress)
+					zbuf = iobuf_create(fiber->name);
 				warning_said = false;
 			}
 			err = "can't read row";
-			struct tbuf row = remote_read_row(&coio, iobuf);
+			struct tbuf row = remote_read_row(&coio, iobuf, zbuf);
 			fiber_setcancellable(false);
 			err = NULL;
 
-			r->remote->recovery_lag = ev_now() - header_v11(&row)->tm;
-			r->remote->recovery_last_update_tstamp = ev_now();
-
-			remote_apply_row(r, &row);
+			i64 lsn = remote_apply_rows(r, &row, iobuf);
+			if (lsn > 0 && r->remote->ack) {
+				/* The master may be waiting for it. */
+				err = "can't confirm rows";
+				coio_write(&coio, &lsn, sizeof(lsn));
+				err = NULL;
+			}
 
 			iobuf_gc(iobuf);
+			if (zbuf != NULL)
+				iobuf_gc(zbuf);
 			fiber_gc();
 		} @catch (FiberCancelException *e) {
 			iobuf_destroy(iobuf);
+			if (zbuf != NULL)
+				iobuf_destroy(zbuf);
 			evio_close(&coio);
 			@throw;
 		} @catch (tnt_Exception *e) {
 			[e log];
+			if (r->remote->is_joining)
+				panic("lost the master while receiving its "
+				      "snapshot, restart to join again");
 			if (! warning_said) {
 				if (err != NULL)
 					say_info("%s", err);
@@ -138,21 +324,155 @@ pull_from_remote(va_list ap)
 	}
 }
 
+/** Apply a single row, in a fiber of its own. */
 static void
-remote_apply_row(struct recovery_state *r, struct tbuf *row)
+remote_apply_row(va_list ap)
 {
-	i64 lsn = header_v11(row)->lsn;
+	struct recovery_state *r = va_arg(ap, struct recovery_state *);
+	struct tbuf row = *va_arg(ap, struct tbuf *);
+	struct remote *remote = r->remote;
+	i64 lsn = header_v11(&row)->lsn;
+
+	assert(*(uint16_t*)(row.data + sizeof(struct header_v11)) == XLOG);
+
+	/* Log the row with the LSN it has on the master. */
+	r->lsn = lsn - 1;
+	if (r->row_handler(r->row_handler_param, &row) < 0)
+		panic("replication failure: can't apply row");
+
+	if (--remote->rows_in_flight == 0)
+		fiber_wakeup(remote->reader);
+}
 
-	assert(*(uint16_t*)(row->data + sizeof(struct header_v11)) == XLOG);
+/**
+ * Apply a row of the snapshot of the master, or the JOIN_EOF
+ * row which ends it, right away: there is nothing to log.
+ */
+static void
+remote_apply_snap_row(struct recovery_state *r, struct tbuf *row)
+{
+	u16 tag = *(u16 *)(row->data + sizeof(struct header_v11));
 
+	assert(r->remote->rows_in_flight == 0);
+	r->remote->is_joining = tag != JOIN_EOF;
 	if (r->row_handler(r->row_handler_param, row) < 0)
 		panic("replication failure: can't apply row");
+}
+
+/** A heartbeat of an idle master: the replica is up to date. */
+static void
+remote_heartbeat(struct remote *remote, struct tbuf *row)
+{
+	remote->recovery_lag = ev_now() - header_v11(row)->tm;
+	remote->recovery_last_update_tstamp = ev_now();
+}
+
+/**
+ * Account a burst of rows, and update the averages once a
+ * second, or so.
+ */
+static void
+remote_update_stat(struct remote *remote, int rows,
+		   ev_tstamp apply, ev_tstamp wal)
+{
+	if (rows > 0) {
+		remote->window.rows += rows;
+		remote->window.bursts++;
+		remote->window.apply += apply;
+		remote->window.wal += wal;
+	}
+	ev_tstamp period = ev_now() - remote->window.tstamp;
+	if (period < 1.0)
+		return;
+	remote->apply_rate = remote->window.rows / period;
+	if (remote->window.bursts > 0) {
+		remote->apply_latency = remote->window.apply /
+			remote->window.bursts;
+		remote->wal_wait = remote->window.wal / remote->window.bursts;
+	} else {
+		remote->apply_latency = remote->wal_wait = 0;
+	}
+	memset(&remote->window, 0, sizeof(remote->window));
+	remote->window.tstamp = ev_now();
+}
+
+/**
+ * Apply the row just read, and all rows which came with it and
+ * are in the input buffer already.
+ *
+ * Every row is applied in a fiber of its own. The changes are
+ * made in memory in order, right away, while the fibers wait
+ * for their WAL writes together: the WAL writer gets the whole
+ * burst at once, and writes it as one batch.
+ *
+ * @return the LSN of the last row written to the WAL, 0 if none.
+ */
+static i64
+remote_apply_rows(struct recovery_state *r, struct tbuf *row,
+		  struct iobuf *iobuf)
+{
+	struct remote *remote = r->remote;
+	ev_tstamp start = ev_time();
+	int rows = 0;
+	i64 lsn = 0;
 
-	set_lsn(r, lsn);
+	do {
+		u16 tag = *(u16 *)(row->data + sizeof(struct header_v11));
+		if (tag == HEARTBEAT) {
+			remote_heartbeat(remote, row);
+			continue;
+		}
+		if (tag != XLOG) {
+			remote_apply_snap_row(r, row);
+			continue;
+		}
+		lsn = header_v11(row)->lsn;
+		remote->recovery_lag = ev_now() - header_v11(row)->tm;
+		remote->rows_in_flight++;
+		rows++;
+		struct fiber *f = fiber_create("replica/apply",
+					       remote_apply_row);
+		fiber_call(f, r, row);
+	} while (remote_buffered_row(iobuf, row));
+	ev_tstamp applied = ev_time();
+
+	/* The rows point to the input buffer, wait till they're done. */
+	while (remote->rows_in_flight > 0)
+		fiber_yield();
+	if (lsn > 0) {
+		set_lsn(r, lsn);
+		remote->recovery_last_update_tstamp = ev_now();
+	}
+	ev_tstamp written = ev_time();
+	remote_update_stat(remote, rows, written - start, written - applied);
+	return lsn;
+}
+
+int
+remote_parse_spaces(const char *list, u32 *spaces)
+{
+	const char *pos = list;
+	int count = 0;
+
+	for (;;) {
+		char *end;
+		errno = 0;
+		long long space = strtoll(pos, &end, 10);
+		if (end == pos || errno != 0 || space < 0 ||
+		    space > UINT32_MAX || count == REPLICATION_SPACES_MAX)
+			return -1;
+		spaces[count++] = space;
+		pos = end + strspn(end, " ");
+		if (*pos == '\0')
+			return count;
+		if (*pos++ != ',')
+			return -1;
+	}
 }
 
 void
-recovery_follow_remote(struct recovery_state *r, const char *addr)
+recovery_follow_remote(struct recovery_state *r, const char *addr,
+		       bool compress, const char *spaces)
 {
 	char name[FIBER_NAME_MAXLEN];
 	char ip_addr[32];
@@ -188,6 +508,17 @@ recovery_follow_remote(struct recovery_state *r, const char *addr)
 	remote.addr.sin_port = htons(port);
 	memcpy(&remote.cookie, &remote.addr, MIN(sizeof(remote.cookie), sizeof(remote.addr)));
 	remote.reader = f;
+	remote.compress = compress;
+	remote.heartbeat = true;
+	if (spaces != NULL) {
+		static u32 space_list[REPLICATION_SPACES_MAX];
+		/* Checked with the configuration. */
+		remote.space_count = remote_parse_spaces(spaces, space_list);
+		remote.spaces = space_list;
+	}
+	/* A replica of some spaces has no rows of the rest to confirm. */
+	remote.ack = remote.space_count == 0;
+	remote.window.tstamp = ev_now();
 	r->remote = &remote;
 	fiber_call(f, r);
 }
@@ -38,15 +38,22 @@
 #include <sys/socket.h>
 #include <sys/wait.h>
 #include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <limits.h>
 #include <fcntl.h>
+#include <poll.h>
 
 #include "fiber.h"
 #include "recovery.h"
 #include "log_io.h"
 #include "evio.h"
+#include "iobuf.h"
+#include "rlist.h"
+#include "coio.h"
+#include <third_party/lzf/lzf.h>
 
 /** Replication topology
  * ----------------------
@@ -68,8 +75,23 @@
  * process, through the master's end of the socket pair.
  *
  * The spawner listens on the receiving end of the socket pair and
- * for every received socket creates a replication relay, which is
- * then responsible for sending write ahead logs to the replica.
+ * passes every received socket to the fan-out relay, a single
+ * process which reads the write ahead log once for all replicas.
+ * It keeps the newest rows in a ring buffer in memory, and each
+ * replica is sent rows from the ring at its own pace.
+ *
+ * A replica which asks for rows the ring doesn't have, or falls
+ * so far behind that its rows are evicted from the ring, gets a
+ * fiber in the fan-out relay, which sends the rows from the write
+ * ahead log files, and returns the replica to the ring once it
+ * has the next row. Replicas which are served by the fan-out
+ * relay share its event loop and cost no process of their own.
+ *
+ * A replica which asks for a compressed stream or the snapshot
+ * of the master is handed back to the spawner. The spawner then
+ * creates a replication relay for it: a process which handles
+ * this one client connection and reads write ahead logs from
+ * disk on its own.
  *
  * Upon shutdown, the master closes its end of the socket pair.
  * The spawner then reads EOF from its end, terminates all
@@ -77,6 +99,13 @@
  */
 static int master_to_spawner_socket;
 
+struct relay_stat *relay_stats;
+/**
+ * Relays write a byte to the pipe when a replica confirms rows,
+ * to wake up the main process.
+ */
+static int relay_ack_pipe[2] = { -1, -1 };
+
 /** Accept a new connection on the replication port: push the accepted socket
  * to the spawner.
  */
@@ -99,6 +128,8 @@ static struct spawner {
 	sig_atomic_t killed;
 	/** child process count */
 	sig_atomic_t child_count;
+	/** the socket pair with the fan-out relay, -1 if none */
+	int fanout_sock;
 } spawner;
 
 /** Initialize spawner process.
@@ -125,11 +156,18 @@ static void
 spawner_sigchld_handler(int signal __attribute__((unused)));
 
 /** Create a replication relay.
+ *
+ * @param lsn the LSN to start from, 0 if the relay has to
+ *            read it from the client.
  *
  * @return 0 on success, -1 on error
  */
 static int
-spawner_create_replication_relay(int client_sock);
+spawner_create_replication_relay(int client_sock, i64 lsn);
+
+/** Pass a new client to the fan-out relay, create it if necessary. */
+static void
+spawner_subscribe(int client_sock);
 
 /** Shut down all relays when shutting down the spawner. */
 static void
@@ -137,7 +175,129 @@ spawner_shutdown_children();
 
 /** Initialize replication relay process. */
 static void
-replication_relay_loop(int client_sock);
+replication_relay_loop(int client_sock, i64 lsn);
+
+/** The main loop of the fan-out relay process. */
+static void
+fanout_loop(int sock);
+
+/*
+ * ------------------------------------------------------------------------
+ * replica statistics
+ * ------------------------------------------------------------------------
+ */
+
+/**
+ * Take a free slot for the statistics of the replica on the
+ * socket. With too many replicas, count in the unlisted
+ * statistics of the caller, which are not shown.
+ */
+static struct relay_stat *
+relay_stat_acquire(int client_sock, i64 lsn, struct relay_stat *unlisted)
+{
+	struct relay_stat *stat = unlisted;
+	for (int i = 0; relay_stats != NULL && i < RELAY_STAT_MAX; i++) {
+		if (__sync_bool_compare_and_swap(&relay_stats[i].pid, 0,
+						 getpid())) {
+			stat = &relay_stats[i];
+			break;
+		}
+	}
+	socklen_t addrlen = sizeof(stat->peer);
+	getpeername(client_sock, (struct sockaddr *) &stat->peer, &addrlen);
+	stat->lsn = lsn;
+	stat->ack_lsn = 0;
+	stat->rows = stat->bytes = stat->send_queue = 0;
+	return stat;
+}
+
+static void
+relay_stat_release(struct relay_stat *stat)
+{
+	if (stat >= relay_stats && stat < relay_stats + RELAY_STAT_MAX)
+		stat->pid = 0;
+}
+
+/** Free the slots of a relay which has exited. Async-signal-safe. */
+static void
+relay_stat_release_pid(pid_t pid)
+{
+	for (int i = 0; relay_stats != NULL && i < RELAY_STAT_MAX; i++) {
+		if (relay_stats[i].pid == pid)
+			relay_stats[i].pid = 0;
+	}
+}
+
+/** Bytes sent to the socket, but not yet to the replica. */
+static u64
+relay_socket_queue(int sock)
+{
+	int size = 0;
+#ifdef TIOCOUTQ
+	if (ioctl(sock, TIOCOUTQ, &size) < 0)
+		size = 0;
+#else
+	(void) sock;
+#endif
+	return size;
+}
+
+/** Confirmations of a replica, as they are read from the socket. */
+struct relay_ack {
+	/** An LSN split between two reads. */
+	char buf[sizeof(i64)];
+	size_t size;
+};
+
+/**
+ * Read the LSNs the replica has written, and tell the main
+ * process about the last one.
+ *
+ * @return what recv() returns
+ */
+static ssize_t
+relay_recv_ack(int sock, struct relay_ack *ack, struct relay_stat *stat)
+{
+	char buf[64 * sizeof(i64)];
+	memcpy(buf, ack->buf, ack->size);
+	ssize_t r = recv(sock, buf + ack->size, sizeof(buf) - ack->size, 0);
+	if (r <= 0)
+		return r;
+	size_t size = ack->size + r;
+	size_t end = size - size % sizeof(i64);
+	ack->size = size - end;
+	memcpy(ack->buf, buf + end, ack->size);
+	if (end == 0)
+		return r;
+
+	i64 lsn;
+	memcpy(&lsn, buf + end - sizeof(lsn), sizeof(lsn));
+	stat->ack_lsn = lsn;
+	/* The pipe is not empty if the write fails with EAGAIN. */
+	if (write(relay_ack_pipe[1], "", 1) < 0 && errno != EAGAIN)
+		say_syserror("write");
+	return r;
+}
+
+void
+replication_info(struct tbuf *out)
+{
+	bool is_first = true;
+
+	for (int i = 0; relay_stats != NULL && i < RELAY_STAT_MAX; i++) {
+		struct relay_stat *stat = &relay_stats[i];
+		if (stat->pid == 0)
+			continue;
+		if (is_first)
+			tbuf_printf(out, "  replicas:" CRLF);
+		is_first = false;
+		tbuf_printf(out, "    - { peer: \"%s\", lsn: %" PRIi64
+			    ", rows: %" PRIu64 ", bytes: %" PRIu64
+			    ", send_queue: %" PRIu64 " }" CRLF,
+			    sio_strfaddr(&stat->peer), stat->lsn,
+			    stat->rows, stat->bytes, stat->send_queue);
+	}
+}
 
 /*
  * ------------------------------------------------------------------------
@@ -155,6 +315,12 @@ replication_check_config(struct tarantool_cfg *config)
 			  config->replication_port);
 		return -1;
 	}
+	if (config->replication_sync_quorum < 0 ||
+	    config->replication_sync_quorum > RELAY_STAT_MAX) {
+		say_error("invalid replication_sync_quorum value: %"PRId32,
+			  config->replication_sync_quorum);
+		return -1;
+	}
 
 	return 0;
 }
@@ -167,6 +333,17 @@ replication_prefork()
 		/* replication is not needed, do nothing */
 		return;
 	}
+	/* Shared with all relays, which the spawner forks. */
+	relay_stats = mmap(NULL, RELAY_STAT_MAX * sizeof(*relay_stats),
+			   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+			   -1, 0);
+	if (relay_stats == MAP_FAILED)
+		panic_syserror("mmap");
+	if (pipe(relay_ack_pipe) != 0)
+		panic_syserror("pipe");
+	sio_setfl(relay_ack_pipe[0], O_NONBLOCK, 1);
+	sio_setfl(relay_ack_pipe[1], O_NONBLOCK, 1);
+
 	int sockpair[2];
 	/*
 	 * Create UNIX sockets to communicate between the main and
@@ -183,6 +360,7 @@ replication_prefork()
 	if (pid != 0) {
 		/* parent process: tarantool */
 		close(sockpair[1]);
+		close(relay_ack_pipe[1]);
 		master_to_spawner_socket = sockpair[0];
 		sio_setfl(master_to_spawner_socket, O_NONBLOCK, 1);
 	} else {
@@ -190,6 +368,7 @@ replication_prefork()
 		ev_loop(EVLOOP_NONBLOCK);
 		/* child process: spawner */
 		close(sockpair[0]);
+		close(relay_ack_pipe[0]);
 		/*
 		 * Move to an own process group, to not receive
 		 * signals from the controlling tty.
@@ -199,6 +378,133 @@ replication_prefork()
 	}
 }
 
+/*
+ * ------------------------------------------------------------------------
+ * semi-synchronous replication
+ * ------------------------------------------------------------------------
+ */
+
+/** A fiber waiting for replicas to confirm an LSN. */
+struct sync_waiter {
+	struct rlist link;
+	struct fiber *fiber;
+	i64 lsn;
+	/** Confirmed, or not to be waited for any more. */
+	bool is_done;
+};
+
+static struct {
+	/** Fibers waiting for the quorum. */
+	struct rlist waiters;
+	/**
+	 * Not 0 if the quorum wasn't reached in time: the LSN
+	 * which timed out. Commits don't wait till the replicas
+	 * catch up with it. It doesn't move with the commits
+	 * made meanwhile, or under steady load the replicas
+	 * would never catch up.
+	 */
+	i64 degraded_lsn;
+	/** Reads relay_ack_pipe. */
+	struct ev_io ack_ev;
+} semisync;
+
+/**
+ * The newest LSN written by at least quorum replicas, 0 if none.
+ * Each slot has the confirmations of one replica, whether it is
+ * served by the fan-out relay or by a relay of its own. A
+ * replica of some spaces only doesn't confirm rows, and never
+ * counts.
+ */
+static i64
+replication_sync_lsn(int quorum)
+{
+	i64 acks[RELAY_STAT_MAX];
+	int count = 0;
+
+	for (int i = 0; i < RELAY_STAT_MAX; i++) {
+		i64 lsn = relay_stats[i].ack_lsn;
+		if (relay_stats[i].pid == 0 || lsn == 0)
+			continue;
+		/* Keep the newest first. */
+		int j = count++;
+		for (; j > 0 && acks[j - 1] < lsn; j--)
+			acks[j] = acks[j - 1];
+		acks[j] = lsn;
+	}
+	return count < quorum ? 0 : acks[quorum - 1];
+}
+
+/** Stop waiting for the fibers waiting for the LSN or an older one. */
+static void
+replication_sync_release(i64 lsn)
+{
+	struct sync_waiter *waiter, *next;
+	waiter = rlist_first_entry(&semisync.waiters, struct sync_waiter, link);
+	for (; &waiter->link != &semisync.waiters; waiter = next) {
+		next = rlist_next_entry(waiter, link);
+		if (waiter->lsn > lsn)
+			continue;
+		rlist_del_entry(waiter, link);
+		waiter->is_done = true;
+		fiber_wakeup(waiter->fiber);
+	}
+}
+
+/** A libev callback invoked when a replica has confirmed rows. */
+static void
+replication_sync_ack(struct ev_io *w, int revents __attribute__((unused)))
+{
+	char buf[128];
+	while (read(w->fd, buf, sizeof(buf)) > 0)
+		;
+
+	int quorum = cfg.replication_sync_quorum;
+	i64 lsn = quorum == 0 ? INT64_MAX : replication_sync_lsn(quorum);
+	if (semisync.degraded_lsn != 0 && lsn >= semisync.degraded_lsn) {
+		say_info("replicas have caught up, waiting for them again");
+		semisync.degraded_lsn = 0;
+	}
+	replication_sync_release(lsn);
+}
+
+void
+replication_sync(i64 lsn)
+{
+	int quorum = cfg.replication_sync_quorum;
+	/*
+	 * Rows of local recovery are not written to the WAL, and
+	 * rows of the master are not waited for on a replica.
+	 */
+	if (quorum == 0 || ! ev_is_active(&semisync.ack_ev) ||
+	    recovery_state->wal_mode == WAL_NONE ||
+	    recovery_state->remote != NULL)
+		return;
+	if (semisync.degraded_lsn != 0)
+		return;
+	if (replication_sync_lsn(quorum) >= lsn)
+		return;
+
+	/*
+	 * Commits don't wait for each other: each waits for its
+	 * own LSN, and one confirmation lets go all the commits
+	 * it covers.
+	 */
+	struct sync_waiter waiter = { .fiber = fiber, .lsn = lsn };
+	rlist_add_tail_entry(&semisync.waiters, &waiter, link);
+	ev_tstamp deadline = ev_now() + cfg.replication_sync_timeout;
+	while (! waiter.is_done && ev_now() < deadline)
+		fiber_yield_timeout(deadline - ev_now());
+	if (waiter.is_done)
+		return;
+
+	rlist_del_entry(&waiter, link);
+	say_warn("%d replicas haven't written lsn %" PRIi64 " in %.3f sec, "
+		 "not waiting for them till they catch up", quorum, lsn,
+		 cfg.replication_sync_timeout);
+	semisync.degraded_lsn = lsn;
+	replication_sync_release(INT64_MAX);
+}
+
 /**
  * Create a fiber which accepts client connections and pushes them
  * to replication spawner.
@@ -216,6 +522,11 @@ replication_init(const char *bind_ipaddr, int replication_port)
 			  replication_port, replication_on_accept, NULL);
 
 	evio_service_start(&replication);
+
+	rlist_init(&semisync.waiters);
+	ev_io_init(&semisync.ack_ev, replication_sync_ack, relay_ack_pipe[0],
+		   EV_READ);
+	ev_io_start(&semisync.ack_ev);
 }
 
 
@@ -247,19 +558,21 @@ replication_on_accept(struct evio_service *service __attribute__((unused)),
 }
 
 
-/** Send a file descriptor to the spawner. */
-static void
-replication_send_socket(ev_io *watcher, int events __attribute__((unused)))
+/**
+ * Send a file descriptor along with a message over a UNIX socket.
+ *
+ * @return 0 on success, -1 on error
+ */
+static int
+replication_send_fd(int sock, void *data, size_t size, int fd)
 {
-	int client_sock = (intptr_t) watcher->data;
 	struct msghdr msg;
 	struct iovec iov[1];
 	char control_buf[CMSG_SPACE(sizeof(int))];
 	struct cmsghdr *control_message = NULL;
-	int cmd_code = 0;
 
-	iov[0].iov_base = &cmd_code;
-	iov[0].iov_len = sizeof(cmd_code);
+	iov[0].iov_base = data;
+	iov[0].iov_len = size;
 
 	memset(&msg, 0, sizeof(msg));
 
@@ -274,11 +587,26 @@ replication_send_socket(ev_io *watcher, int events __attribute__((unused)))
 	control_message->cmsg_len = CMSG_LEN(sizeof(int));
 	control_message->cmsg_level = SOL_SOCKET;
 	control_message->cmsg_type = SCM_RIGHTS;
-	*((int *) CMSG_DATA(control_message)) = client_sock;
+	*((int *) CMSG_DATA(control_message)) = fd;
 
-	/* Send the client socket to the spawner. */
-	if (sendmsg(master_to_spawner_socket, &msg, 0) < 0)
+	/* Don't die of SIGPIPE if the other side has exited. */
+	if (sendmsg(sock, &msg, MSG_NOSIGNAL) < 0) {
 		say_syserror("sendmsg");
+		return -1;
+	}
+	return 0;
+}
+
+/** Send a file descriptor to the spawner. */
+static void
+replication_send_socket(ev_io *watcher, int events __attribute__((unused)))
+{
+	int client_sock = (intptr_t) watcher->data;
+	int cmd_code = 0;
+
+	/* Send the client socket to the spawner. */
+	replication_send_fd(master_to_spawner_socket, &cmd_code,
+			    sizeof(cmd_code), client_sock);
 
 	ev_io_stop(watcher);
 	free(watcher);
@@ -305,6 +633,7 @@ spawner_init(int sock)
 
 	/* init replicator process context */
 	spawner.sock = sock;
+	spawner.fanout_sock = -1;
 
 	/* init signals */
 	memset(&sa, 0, sizeof(sa));
@@ -353,18 +682,23 @@ spawner_unpack_cmsg(struct msghdr *msg)
 	return -1;
 }
 
-/** Replication spawner process main loop. */
-static void
-spawner_main_loop()
+/**
+ * Receive a message and a file descriptor sent with
+ * replication_send_fd().
+ *
+ * @return the message length, 0 on EOF, -1 on error.
+ */
+static ssize_t
+replication_recv_fd(int sock, void *data, size_t size, int *fd)
 {
 	struct msghdr msg;
 	struct iovec iov[1];
 	char control_buf[CMSG_SPACE(sizeof(int))];
-	int cmd_code = 0;
-	int client_sock;
 
-	iov[0].iov_base = &cmd_code;
-	iov[0].iov_len = sizeof(cmd_code);
+	iov[0].iov_base = data;
+	iov[0].iov_len = size;
+
+	memset(&msg, 0, sizeof(msg));
 
 	msg.msg_name = NULL;
 	msg.msg_namelen = 0;
@@ -373,18 +707,59 @@ spawner_main_loop()
 	msg.msg_control = control_buf;
 	msg.msg_controllen = sizeof(control_buf);
 
+	ssize_t msglen = recvmsg(sock, &msg, 0);
+	if (msglen > 0)
+		*fd = spawner_unpack_cmsg(&msg);
+	return msglen;
+}
+
+/** Replication spawner process main loop. */
+static void
+spawner_main_loop()
+{
+	int cmd_code = 0;
+	int client_sock;
+	i64 lsn;
+	ssize_t msglen;
+
 	while (!spawner.killed) {
-		int msglen = recvmsg(spawner.sock, &msg, 0);
-		if (msglen > 0) {
-			client_sock = spawner_unpack_cmsg(&msg);
-			spawner_create_replication_relay(client_sock);
-		} else if (msglen == 0) { /* orderly master shutdown */
-			say_info("Exiting: master shutdown");
-			break;
-		} else { /* msglen == -1 */
+		struct pollfd fds[2] = {
+			{ .fd = spawner.sock, .events = POLLIN },
+			{ .fd = spawner.fanout_sock, .events = POLLIN },
+		};
+		if (poll(fds, spawner.fanout_sock >= 0 ? 2 : 1, -1) < 0) {
 			if (errno != EINTR)
-				say_syserror("recvmsg");
-			/* continue, the error may be temporary */
+				say_syserror("poll");
+			continue;
+		}
+		if (fds[0].revents) {
+			msglen = replication_recv_fd(spawner.sock, &cmd_code,
+						     sizeof(cmd_code),
+						     &client_sock);
+			if (msglen > 0) {
+				spawner_subscribe(client_sock);
+			} else if (msglen == 0) { /* orderly master shutdown */
+				say_info("Exiting: master shutdown");
+				break;
+			} else { /* msglen == -1 */
+				if (errno != EINTR)
+					say_syserror("recvmsg");
+				/* continue, the error may be temporary */
+			}
+		}
+		if (spawner.fanout_sock >= 0 && fds[1].revents) {
+			/* A replica the fan-out relay can't serve. */
+			msglen = replication_recv_fd(spawner.fanout_sock,
+						     &lsn, sizeof(lsn),
+						     &client_sock);
+			if (msglen > 0) {
+				spawner_create_replication_relay(client_sock,
+								 lsn);
+			} else if (msglen == 0 || errno != EINTR) {
+				say_warn("the fan-out relay has exited");
+				close(spawner.fanout_sock);
+				spawner.fanout_sock = -1;
+			}
 		}
 	}
 	spawner_shutdown();
@@ -396,6 +771,8 @@ spawner_shutdown()
 {
 	/* close socket */
 	close(spawner.sock);
+	if (spawner.fanout_sock >= 0)
+		close(spawner.fanout_sock);
 
 	/* kill all children */
 	spawner_shutdown_children();
@@ -429,18 +806,20 @@ spawner_sigchld_handler(int signo __attribute__((unused)))
 			return;
 		default:
 			spawner.child_count--;
+			relay_stat_release_pid(pid);
 		}
 	} while (spawner.child_count > 0);
 }
 
 /** Create replication client handler process. */
 static int
-spawner_create_replication_relay(int client_sock)
+spawner_create_replication_relay(int client_sock, i64 lsn)
 {
 	pid_t pid = fork();
 
 	if (pid < 0) {
 		say_syserror("fork");
+		close(client_sock);
 		return -1;
 	}
 
@@ -448,7 +827,9 @@ spawner_create_replication_relay(int client_sock)
 		ev_default_fork();
 		ev_loop(EVLOOP_NONBLOCK);
 		close(spawner.sock);
-		replication_relay_loop(client_sock);
+		if (spawner.fanout_sock >= 0)
+			close(spawner.fanout_sock);
+		replication_relay_loop(client_sock, lsn);
 	} else {
 		spawner.child_count++;
 		close(client_sock);
@@ -458,6 +839,56 @@ spawner_create_replication_relay(int client_sock)
 	return 0;
 }
 
+/** Create the fan-out relay process. */
+static int
+spawner_create_fanout()
+{
+	int sockpair[2];
+	if (socketpair(PF_LOCAL, SOCK_STREAM, 0, sockpair) != 0) {
+		say_syserror("socketpair");
+		return -1;
+	}
+	pid_t pid = fork();
+
+	if (pid < 0) {
+		say_syserror("fork");
+		close(sockpair[0]);
+		close(sockpair[1]);
+		return -1;
+	}
+
+	if (pid == 0) {
+		ev_default_fork();
+		ev_loop(EVLOOP_NONBLOCK);
+		close(spawner.sock);
+		close(sockpair[0]);
+		fanout_loop(sockpair[1]);
+	} else {
+		spawner.child_count++;
+		close(sockpair[1]);
+		spawner.fanout_sock = sockpair[0];
+		say_info("created the fan-out relay: pid = %d", (int) pid);
+	}
+	return 0;
+}
+
+static void
+spawner_subscribe(int client_sock)
+{
+	int cmd_code = 0;
+
+	if (spawner.fanout_sock < 0 && spawner_create_fanout() != 0)
+		goto fallback;
+	if (replication_send_fd(spawner.fanout_sock, &cmd_code,
+				sizeof(cmd_code), client_sock) != 0)
+		goto fallback;
+	close(client_sock);
+	return;
+fallback:
+	/* Let the replica be served the old way. */
+	spawner_create_replication_relay(client_sock, 0);
+}
+
 /** Replicator spawner shutdown: kill and wait for children. */
 static void
 spawner_shutdown_children()
@@ -528,17 +959,48 @@ retry:
 	}
 }
 
+/**
+ * Rows are not sent one by one: they are copied to the relay
+ * output buffer, which is written with a single writev() when
+ * it grows big enough, or when there is nothing more to read
+ * and the relay is about to wait for new rows.
+ */
+enum { RELAY_FLUSH_SIZE = 128 * 1024, RELAY_IOV_MAX = 512 };
+
+static struct iobuf *relay_iobuf;
+
+static struct relay_stat *relay_stat;
+
+/** The replica has asked for a compressed stream. */
+static bool relay_compress;
+/** The replica takes heartbeats. */
+static bool relay_heartbeat;
+static ev_tstamp relay_last_send;
+static const ev_tstamp RELAY_HEARTBEAT_INTERVAL = 1.0;
+/** The replica confirms the rows it has written. */
+static bool relay_ack;
+static struct relay_ack relay_ack_buf;
+static lzf_state relay_lzf_state;
+static char relay_lzf_buf[LZF_MAX_COMPRESSED_SIZE(REPLICATION_BLOCK_MAX)];
+
 /** A libev callback invoked when a relay client socket is ready
- * for read. This currently only happens when the client closes
- * its socket, and we get an EOF.
+ * for read: the client has confirmed rows, or closed its socket,
+ * and we get an EOF.
  */
 static void
 replication_relay_recv(struct ev_io *w, int __attribute__((unused)) revents)
 {
 	int client_sock = (int) (intptr_t) w->data;
-	u8 data;
+	ssize_t rc;
 
-	int rc = recv(client_sock, &data, sizeof(data), 0);
+	if (relay_ack) {
+		rc = relay_recv_ack(client_sock, &relay_ack_buf, relay_stat);
+		if (rc > 0 || (rc < 0 && errno == EINTR))
+			return;
+	} else {
+		u8 data;
+		rc = recv(client_sock, &data, sizeof(data), 0);
+	}
 
 	if (rc == 0 || (rc < 0 && errno == ECONNRESET)) {
 		say_info("the client has closed its replication socket, exiting");
@@ -550,53 +1012,296 @@ replication_relay_recv(struct ev_io *w, int __attribute__((unused)) revents)
 	exit(EXIT_FAILURE);
 }
 
-
-/** Send a single row to the client. */
-static int
-replication_relay_send_row(void *param, struct tbuf *t)
+/** Write the whole vector to the client, exit if it's gone. */
+static void
+replication_relay_writev(int client_sock, struct iovec *iov, int iovcnt)
 {
-	int client_sock = (int) (intptr_t) param;
-	u8 *data = t->data;
-	ssize_t bytes, len = t->size;
-	while (len > 0) {
-		bytes = write(client_sock, data, len);
-		if (bytes < 0) {
+	struct iovec *end = iov + iovcnt;
+	size_t iov_len = 0;
+
+	while (iov < end) {
+		sio_add_to_iov(iov, -(ssize_t) iov_len);
+		ssize_t nwr = writev(client_sock, iov, MIN(end - iov, IOV_MAX));
+		sio_add_to_iov(iov, iov_len);
+		if (nwr < 0) {
+			if (errno == EINTR)
+				continue;
 			if (errno == EPIPE) {
 				/* socket closed on opposite site */
 				goto shutdown_handler;
 			}
-			panic_syserror("write");
+			panic_syserror("writev");
 		}
-		len -= bytes;
-		data += bytes;
+		iov += sio_move_iov(iov, nwr, &iov_len);
+		relay_stat->bytes += nwr;
+		relay_last_send = ev_now();
 	}
-
-	say_debug("send row: %" PRIu32 " bytes %s", t->size, tbuf_to_hex(t));
-	return 0;
+	return;
 shutdown_handler:
 	say_info("the client has closed its replication socket, exiting");
 	exit(EXIT_SUCCESS);
 }
 
+/** Send a part of the stream as compressed blocks. */
+static void
+replication_relay_write_compressed(int client_sock, void *data, size_t size)
+{
+	while (size > 0) {
+		struct replication_block block;
+		block.raw_len = MIN(size, REPLICATION_BLOCK_MAX);
+		block.len = lzf_compress(data, block.raw_len, relay_lzf_buf,
+					 block.raw_len - 1, relay_lzf_state);
+		struct iovec iov[2] = {
+			{ .iov_base = &block, .iov_len = sizeof(block) },
+			{ .iov_base = relay_lzf_buf, .iov_len = block.len },
+		};
+		if (block.len == 0) {
+			/* Doesn't shrink, send it as is. */
+			block.len = iov[1].iov_len = block.raw_len;
+			iov[1].iov_base = data;
+		}
+		replication_relay_writev(client_sock, iov, 2);
+		data += block.raw_len;
+		size -= block.raw_len;
+	}
+}
+
+/** Send everything accumulated in the output buffer. */
+static void
+replication_relay_flush(int client_sock)
+{
+	struct obuf *out = &relay_iobuf->out;
 
-/** The main loop of replication client service process. */
+	if (relay_compress) {
+		for (int i = 0; i < obuf_iovcnt(out); i++)
+			replication_relay_write_compressed(client_sock,
+							   out->iov[i].iov_base,
+							   out->iov[i].iov_len);
+	} else {
+		replication_relay_writev(client_sock, out->iov,
+					 obuf_iovcnt(out));
+	}
+	say_debug("sent %zu bytes", obuf_size(out));
+	iobuf_gc(relay_iobuf);
+}
+
+/** The spaces a replica has subscribed to. */
+struct relay_filter {
+	u32 count;
+	u32 spaces[REPLICATION_SPACES_MAX];
+};
+
+/** The replica needs the rows of some spaces only. */
+static struct relay_filter *relay_filter;
+
+/**
+ * Check if the row is of a space the replica has subscribed to.
+ * The space number is the first field of a snapshot row, and of
+ * every request in the WAL, so the row is not decoded.
+ */
+static bool
+relay_filter_match(struct relay_filter *filter, struct tbuf *t)
+{
+	if (filter == NULL)
+		return true;
+	size_t offset = sizeof(struct header_v11);
+	u16 tag = *(u16 *)(t->data + offset);
+	/* The tag and the cookie, and the operation of a request. */
+	if (tag == XLOG)
+		offset += sizeof(u16) + sizeof(u64) + sizeof(u16);
+	else if (tag == SNAP)
+		offset += sizeof(u16) + sizeof(u64);
+	else
+		return true;
+	if (t->size < offset + sizeof(u32))
+		return true;
+	u32 space = *(u32 *)(t->data + offset);
+	for (u32 i = 0; i < filter->count; i++) {
+		if (filter->spaces[i] == space)
+			return true;
+	}
+	return false;
+}
+
+/** A row which is filtered out only advances the LSN. */
 static void
-replication_relay_loop(int client_sock)
+relay_stat_skip(struct relay_stat *stat, struct tbuf *t)
+{
+	stat->lsn = MAX(stat->lsn, header_v11(t)->lsn);
+}
+
+/** Count a row sent to the replica. */
+static void
+relay_stat_row(struct relay_stat *stat, struct tbuf *t)
+{
+	stat->rows++;
+	/* Snapshot rows have no LSN. */
+	stat->lsn = MAX(stat->lsn, header_v11(t)->lsn);
+}
+
+/** Queue a single row for the client. */
+static int
+replication_relay_send_row(void *param, struct tbuf *t)
+{
+	int client_sock = (int) (intptr_t) param;
+
+	if (! relay_filter_match(relay_filter, t)) {
+		relay_stat_skip(relay_stat, t);
+		return 0;
+	}
+	relay_stat_row(relay_stat, t);
+	obuf_dup(&relay_iobuf->out, t->data, t->size);
+	if (obuf_size(&relay_iobuf->out) >= RELAY_FLUSH_SIZE)
+		replication_relay_flush(client_sock);
+	return 0;
+}
+
+/**
+ * A libev callback invoked before the relay blocks waiting
+ * for events: all rows available by now are read, send them.
+ */
+static void
+replication_relay_prepare(struct ev_prepare *w,
+			  int __attribute__((unused)) revents)
+{
+	replication_relay_flush((int) (intptr_t) w->data);
+}
+
+
+/**
+ * Send the rows of WALs starting from the given LSN, without
+ * copying them: the files are mapped into memory and rows are
+ * passed to writev() in place. The rows on disk are what is sent
+ * to a replica, except for the markers between them, so
+ * sendfile() can't be used.
+ *
+ * Stops at a file which can't be mapped or has no EOF marker
+ * yet, or, if closed_only is set, at the last WAL, which may be
+ * still being written, or at a WAL which isn't complete when it
+ * is mapped. Rows which don't match the filter, if there is one,
+ * are skipped.
+ *
+ * @return the LSN to continue from.
+ */
+static i64
+relay_send_wals(struct log_dir *dir, i64 lsn, bool closed_only,
+		void (*writev)(void *, struct iovec *, int), void *ctx,
+		struct relay_stat *stat, struct relay_filter *filter)
+{
+	struct iovec iov[RELAY_IOV_MAX];
+	int iovcnt = 0;
+	size_t bytes = 0;
+
+	for (;;) {
+		i64 file_lsn = find_including_file(dir, lsn);
+		if (file_lsn <= 0 ||
+		    (closed_only && file_lsn >= greatest_lsn(dir)))
+			break;
+		struct log_io *l = log_io_open_for_read(dir, file_lsn, NONE);
+		if (l == NULL)
+			break;
+		log_io_seek_lsn(l, lsn);
+
+		struct log_io_cursor i;
+		struct tbuf *row;
+		bool eof_read;
+		log_io_cursor_open(&i, l);
+		@try {
+			/*
+			 * The old WAL gets its EOF marker after
+			 * the next one is created: it may still
+			 * grow and be mapped again, unmapping the
+			 * queued rows.
+			 */
+			bool is_closed = ! closed_only ||
+				log_io_cursor_is_complete(&i);
+			/* The queued rows point into the mapping. */
+			i.keep_map = true;
+			while (i.map != NULL && is_closed) {
+				row = log_io_cursor_next(&i);
+				if (row == NULL) {
+					/*
+					 * Send the queued rows, then
+					 * see if the file has grown.
+					 */
+					writev(ctx, iov, iovcnt);
+					iovcnt = 0;
+					bytes = 0;
+					if (i.eof_read || ! i.keep_map)
+						break;
+					i.keep_map = false;
+					continue;
+				}
+				i.keep_map = true;
+				if (header_v11(row)->lsn < lsn)
+					continue;
+				lsn = header_v11(row)->lsn + 1;
+				if (! relay_filter_match(filter, row)) {
+					relay_stat_skip(stat, row);
+					continue;
+				}
+				iov[iovcnt].iov_base = row->data;
+				iov[iovcnt++].iov_len = row->size;
+				bytes += row->size;
+				relay_stat_row(stat, row);
+				/*
+				 * The rows stay mapped until the
+				 * cursor is closed, or is let map
+				 * the grown file again.
+				 */
+				if (iovcnt == RELAY_IOV_MAX ||
+				    bytes >= RELAY_FLUSH_SIZE) {
+					writev(ctx, iov, iovcnt);
+					iovcnt = 0;
+					bytes = 0;
+				}
+			}
+			writev(ctx, iov, iovcnt);
+			eof_read = i.eof_read;
+		} @finally {
+			iovcnt = 0;
+			bytes = 0;
+			log_io_cursor_close(&i);
+			log_io_close(&l);
+		}
+		if (! eof_read)
+			break;
+	}
+	return lsn;
+}
+
+static void
+replication_relay_write_wal(void *ctx, struct iovec *iov, int iovcnt)
+{
+	replication_relay_writev((int) (intptr_t) ctx, iov, iovcnt);
+}
+
+/**
+ * Send the rows of WALs which are complete: the rest is sent row
+ * by row by the recovery.
+ */
+static i64
+replication_relay_send_closed_wals(int client_sock, i64 lsn)
+{
+	return relay_send_wals(recovery_state->wal_dir, lsn, true,
+			       replication_relay_write_wal,
+			       (void *)(intptr_t) client_sock, relay_stat,
+			       relay_filter);
+}
+
+/**
+ * Set process title and fiber name of a relay, and restore
+ * the signal handlers set by the spawner.
+ */
+static void
+replication_relay_init(const char *name)
 {
-	char name[FIBER_NAME_MAXLEN];
 	struct sigaction sa;
-	struct tbuf *ver;
-	i64 lsn;
-	ssize_t r;
 
 	/* Set process title and fiber name.
 	 * Even though we use only the main fiber, the logger
 	 * uses the current fiber name.
 	 */
-	struct sockaddr_in peer;
-	socklen_t addrlen = sizeof(peer);
-	getpeername(client_sock, ((struct sockaddr*)&peer), &addrlen);
-	snprintf(name, sizeof(name), "relay/%s", sio_strfaddr(&peer));
 	fiber_set_name(fiber, name);
 	set_proc_title("%s%s", name, custom_proc_title);
 
@@ -616,23 +1321,173 @@ replication_relay_loop(int client_sock)
 	sa.sa_handler = SIG_IGN;
 	if (sigaction(SIGPIPE, &sa, NULL) == -1)
 		say_syserror("sigaction");
+}
+
+/** The version to answer a replica subscribing from the LSN with. */
+static u32
+replication_version(i64 lsn)
+{
+	u32 version = lsn & REPLICATION_LZF_FLAG ?
+		lzf_replication_version : default_version;
+	if (lsn & REPLICATION_JOIN_FLAG)
+		version |= REPLICATION_JOIN_VERSION;
+	if (lsn & REPLICATION_HEARTBEAT_FLAG)
+		version |= REPLICATION_HEARTBEAT_VERSION;
+	if (lsn & REPLICATION_ACK_FLAG)
+		version |= REPLICATION_ACK_VERSION;
+	if (lsn & REPLICATION_SPACES_FLAG)
+		version |= REPLICATION_SPACES_VERSION;
+	return version;
+}
+
+/** A row with a tag and no data, as it is sent to a replica. */
+static struct tbuf
+replication_tag_row(struct row_v11 *row, i64 lsn, u16 tag)
+{
+	row_v11_fill(row, lsn, tag, 0, NULL, 0, NULL, 0);
+	header_v11_sign(&row->header);
+	return (struct tbuf) {
+		.data = &row->header,
+		.size = row_v11_size(row) - sizeof(row->marker),
+	};
+}
+
+/**
+ * A libev callback invoked every RELAY_HEARTBEAT_INTERVAL:
+ * update the send queue, and send a heartbeat if the relay has
+ * been idle.
+ */
+static void
+replication_relay_heartbeat(struct ev_timer *w,
+			    int __attribute__((unused)) revents)
+{
+	int client_sock = (int) (intptr_t) w->data;
+
+	relay_stat->send_queue = obuf_size(&relay_iobuf->out) +
+		relay_socket_queue(client_sock);
+	if (! relay_heartbeat ||
+	    ev_now() - relay_last_send < RELAY_HEARTBEAT_INTERVAL)
+		return;
+	struct row_v11 row;
+	struct tbuf t = replication_tag_row(&row, relay_stat->lsn, HEARTBEAT);
+	/* Sent by replication_relay_prepare(). */
+	obuf_dup(&relay_iobuf->out, t.data, t.size);
+}
+
+/**
+ * Send the newest snapshot to a new replica, followed by a
+ * JOIN_EOF row with its LSN.
+ *
+ * @return the LSN to continue from.
+ */
+static i64
+replication_relay_send_snapshot(int client_sock)
+{
+	say_info("sending the snapshot to a new replica");
+	/* Rows go to replication_relay_send_row(). */
+	recover_snap(recovery_state);
+
+	struct row_v11 eof;
+	struct tbuf t = replication_tag_row(&eof, recovery_state->confirmed_lsn,
+					    JOIN_EOF);
+	replication_relay_send_row((void *)(intptr_t) client_sock, &t);
+	say_info("the snapshot is sent, lsn: %" PRIi64,
+		 recovery_state->confirmed_lsn);
+	return recovery_state->confirmed_lsn + 1;
+}
 
-	r = read(client_sock, &lsn, sizeof(lsn));
-	if (r != sizeof(lsn)) {
-		if (r < 0) {
+/** Read exactly size bytes from a blocking socket, or panic. */
+static void
+replication_relay_readn(int client_sock, void *buf, size_t size)
+{
+	while (size > 0) {
+		ssize_t r = read(client_sock, buf, size);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0)
 			panic_syserror("read");
-		}
-		panic("invalid LSN request size: %zu", r);
+		if (r == 0)
+			panic("the replica has closed its socket "
+			      "in the middle of the handshake");
+		buf = (char *) buf + r;
+		size -= r;
 	}
-	say_info("starting replication from lsn: %"PRIi64, lsn);
+}
+
+/** Read the spaces the replica has subscribed to. */
+static void
+replication_relay_read_filter(int client_sock, struct relay_filter *filter)
+{
+	replication_relay_readn(client_sock, &filter->count,
+				sizeof(filter->count));
+	if (filter->count == 0 || filter->count > REPLICATION_SPACES_MAX)
+		panic("invalid number of spaces to replicate: %" PRIu32,
+		      filter->count);
+	replication_relay_readn(client_sock, filter->spaces,
+				filter->count * sizeof(*filter->spaces));
+}
+
+/** The main loop of replication client service process. */
+static void
+replication_relay_loop(int client_sock, i64 lsn)
+{
+	char name[FIBER_NAME_MAXLEN];
+	ssize_t r;
+
+	struct sockaddr_in peer;
+	socklen_t addrlen = sizeof(peer);
+	getpeername(client_sock, ((struct sockaddr*)&peer), &addrlen);
+	snprintf(name, sizeof(name), "relay/%s", sio_strfaddr(&peer));
+	replication_relay_init(name);
 
-	ver = tbuf_alloc(fiber->gc_pool);
-	tbuf_append(ver, &default_version, sizeof(default_version));
-	replication_relay_send_row((void *)(intptr_t) client_sock, ver);
+	relay_iobuf = iobuf_create("relay");
+
+	if (lsn == 0) {
+		r = read(client_sock, &lsn, sizeof(lsn));
+		if (r != sizeof(lsn)) {
+			if (r < 0) {
+				panic_syserror("read");
+			}
+			panic("invalid LSN request size: %zu", r);
+		}
+		u32 version = replication_version(lsn);
+		obuf_dup(&relay_iobuf->out, &version, sizeof(version));
+	} else {
+		/*
+		 * The fan-out relay has done the handshake, and
+		 * the socket is still non-blocking.
+		 */
+		int flags = fcntl(client_sock, F_GETFL, 0);
+		if (flags < 0 ||
+		    fcntl(client_sock, F_SETFL, flags & ~O_NONBLOCK) < 0)
+			panic_syserror("fcntl");
+	}
+	bool compress = (lsn & REPLICATION_LZF_FLAG) != 0;
+	bool join = (lsn & REPLICATION_JOIN_FLAG) != 0;
+	relay_heartbeat = (lsn & REPLICATION_HEARTBEAT_FLAG) != 0;
+	relay_ack = (lsn & REPLICATION_ACK_FLAG) != 0;
+	if (lsn & REPLICATION_SPACES_FLAG) {
+		/* The spaces follow the LSN, nobody has read them yet. */
+		static struct relay_filter filter;
+		replication_relay_read_filter(client_sock, &filter);
+		relay_filter = &filter;
+	}
+	lsn &= ~REPLICATION_LSN_FLAGS;
+	static struct relay_stat unlisted;
+	relay_stat = relay_stat_acquire(client_sock, lsn - 1, &unlisted);
+	if (! join)
+		say_info("starting %sreplication from lsn: %"PRIi64,
+			 compress ? "compressed " : "", lsn);
 
 	/* init libev events handlers */
 	ev_default_loop(0);
 
+	/* Flush the output buffer whenever the relay is idle. */
+	struct ev_prepare flush_ev;
+	ev_prepare_init(&flush_ev, replication_relay_prepare);
+	flush_ev.data = (void *)(intptr_t) client_sock;
+	ev_prepare_start(&flush_ev);
+
 	/*
 	 * Init a read event: when replica closes its end
 	 * of the socket, we can read EOF and shutdown the
@@ -643,10 +1498,27 @@ replication_relay_loop(int client_sock)
 	ev_io_init(&sock_read_ev, replication_relay_recv, client_sock, EV_READ);
 	ev_io_start(&sock_read_ev);
 
+	struct ev_timer heartbeat_ev;
+	ev_timer_init(&heartbeat_ev, replication_relay_heartbeat,
+		      RELAY_HEARTBEAT_INTERVAL, RELAY_HEARTBEAT_INTERVAL);
+	heartbeat_ev.data = (void *)(intptr_t) client_sock;
+	ev_timer_start(&heartbeat_ev);
+
 	/* Initialize the recovery process */
 	recovery_init(cfg.snap_dir, cfg.wal_dir,
 		      replication_relay_send_row, (void *)(intptr_t) client_sock,
 		      INT32_MAX, RECOVER_READONLY);
+	if (cfg.wal_stripe_dirs != NULL)
+		recovery_setup_wal_stripes(recovery_state, cfg.wal_stripe_dirs);
+	/* The handshake goes first, and is not compressed. */
+	replication_relay_flush(client_sock);
+	relay_compress = compress;
+	if (join)
+		lsn = replication_relay_send_snapshot(client_sock);
+	i64 start_lsn = lsn;
+	/* Compressed rows are not sent from the files in place. */
+	if (! relay_compress)
+		lsn = replication_relay_send_closed_wals(client_sock, lsn);
 	/*
 	 * Note that recovery starts with lsn _NEXT_ to
 	 * the confirmed one.
@@ -654,8 +1526,9 @@ replication_relay_loop(int client_sock)
 	recovery_state->lsn = recovery_state->confirmed_lsn = lsn - 1;
 	recover_existing_wals(recovery_state);
 	/* Found nothing. */
-	if (recovery_state->lsn == lsn - 1)
-		say_error("can't find WAL containing record with lsn: %" PRIi64, lsn);
+	if (recovery_state->lsn == start_lsn - 1)
+		say_error("can't find WAL containing record with lsn: %" PRIi64,
+			  start_lsn);
 	recovery_follow_local(recovery_state, 0.1);
 
 	ev_loop(0);
@@ -664,3 +1537,628 @@ replication_relay_loop(int client_sock)
 	exit(EXIT_SUCCESS);
 }
 
+/*-----------------------------------------------------------------------------*/
+/* fan-out relay                                                               */
+/*-----------------------------------------------------------------------------*/
+
+/**
+ * The ring buffer of the fan-out relay: the newest rows read from
+ * the write ahead log, in the same format as they are sent to
+ * replicas. Offsets are absolute: they only grow, and the position
+ * in the buffer is the offset modulo the ring size.
+ */
+enum { FANOUT_RING_SIZE = 16 * 1024 * 1024 };
+
+static struct fanout_ring {
+	char *buf;
+	/** The offset of the oldest row in the ring. */
+	u64 tail;
+	/** The offset of the end of the newest row. */
+	u64 head;
+	/** The LSN of the newest row in the ring. */
+	i64 lsn;
+	/**
+	 * The LSN of the newest row which is not in the ring
+	 * any more, or which the ring has never had.
+	 */
+	i64 evicted_lsn;
+} ring;
+
+/** A replica served by the fan-out relay. */
+struct fanout_replica {
+	/** Link in the list of all replicas. */
+	struct rlist link;
+	int sock;
+	/** Reads the handshake, and then an EOF. */
+	struct ev_io in;
+	/** Active while the socket buffer is full. */
+	struct ev_io out;
+	/** The requested LSN and how many bytes of it are read. */
+	i64 lsn;
+	size_t lsn_read;
+	/**
+	 * Bytes to send before the rows in the ring: the server
+	 * version, or the rest of a row evicted from the ring
+	 * before it was sent completely.
+	 */
+	char *rest;
+	size_t rest_size;
+	size_t rest_sent;
+	/** The offset of the first row not sent completely. */
+	u64 row;
+	/** The offset of the next byte to send. */
+	u64 pos;
+	/**
+	 * Not 0 if the replica has to be sent rows from files,
+	 * or by a relay of its own: the LSN to start with.
+	 */
+	i64 fallback_lsn;
+	struct relay_stat *stat;
+	struct relay_stat unlisted;
+	struct relay_ack ack;
+	/** When anything was last sent, for heartbeats. */
+	ev_tstamp last_send;
+	/** Sends the rows the ring doesn't have from files. */
+	struct fiber *catchup;
+	/** Closed while catching up, for the fiber to free. */
+	bool is_dropped;
+};
+
+static struct rlist fanout_replicas;
+/** The socket pair with the spawner. */
+static int fanout_sock;
+
+/** Copy data out of the ring. */
+static void
+fanout_ring_read(u64 offset, void *data, size_t size)
+{
+	size_t pos = offset % FANOUT_RING_SIZE;
+	size_t part = MIN(size, FANOUT_RING_SIZE - pos);
+	memcpy(data, ring.buf + pos, part);
+	memcpy(data + part, ring.buf, size - part);
+}
+
+/** Copy data into the ring. */
+static void
+fanout_ring_write(u64 offset, const void *data, size_t size)
+{
+	size_t pos = offset % FANOUT_RING_SIZE;
+	size_t part = MIN(size, FANOUT_RING_SIZE - pos);
+	memcpy(ring.buf + pos, data, part);
+	memcpy(ring.buf, data + part, size - part);
+}
+
+/** Find the end and the LSN of a row in the ring. */
+static u64
+fanout_row_end(u64 row, i64 *lsn)
+{
+	struct header_v11 header;
+	fanout_ring_read(row, &header, sizeof(header));
+	if (lsn != NULL)
+		*lsn = header.lsn;
+	return row + sizeof(header) + header.len;
+}
+
+static void
+fanout_replica_drop(struct fanout_replica *replica)
+{
+	if (replica->catchup != NULL) {
+		/* Its write fails, or it sees the flag on wake up. */
+		ev_io_stop(&replica->in);
+		shutdown(replica->sock, SHUT_RDWR);
+		replica->is_dropped = true;
+		return;
+	}
+	ev_io_stop(&replica->in);
+	ev_io_stop(&replica->out);
+	close(replica->sock);
+	rlist_del_entry(replica, link);
+	if (replica->stat != NULL)
+		relay_stat_release(replica->stat);
+	free(replica->rest);
+	free(replica);
+}
+
+/** Give the replica back to the spawner, for a relay of its own. */
+static void
+fanout_replica_handoff(struct fanout_replica *replica)
+{
+	if (replica->ack.size != 0) {
+		/* The relay would take the rest of an LSN for an LSN. */
+		say_info("the replica is in the middle of a confirmation, "
+			 "closing its socket for it to reconnect");
+		fanout_replica_drop(replica);
+		return;
+	}
+	say_info("sending rows from lsn %" PRIi64 " to a relay of its own",
+		 replica->fallback_lsn & ~REPLICATION_LSN_FLAGS);
+	/* The relay must know what else the replica has asked for. */
+	i64 lsn = replica->fallback_lsn |
+		(replica->lsn & REPLICATION_LSN_FLAGS);
+	replication_send_fd(fanout_sock, &lsn, sizeof(lsn), replica->sock);
+	fanout_replica_drop(replica);
+}
+
+/** Make room for the bytes which must be sent before the ring. */
+static void *
+fanout_replica_alloc_rest(struct fanout_replica *replica, size_t size)
+{
+	assert(replica->rest_sent == replica->rest_size);
+	free(replica->rest);
+	replica->rest = malloc(size);
+	if (replica->rest == NULL)
+		panic("can't allocate %zu bytes", size);
+	replica->rest_size = size;
+	replica->rest_sent = 0;
+	return replica->rest;
+}
+
+/** Save the rest of a row which is being evicted from the ring. */
+static void
+fanout_replica_set_rest(struct fanout_replica *replica,
+			u64 offset, size_t size)
+{
+	fanout_ring_read(offset, fanout_replica_alloc_rest(replica, size),
+			 size);
+}
+
+/**
+ * Remove the oldest row from the ring. Replicas which haven't
+ * sent it yet will continue with files.
+ */
+static void
+fanout_ring_evict()
+{
+	i64 lsn;
+	u64 end = fanout_row_end(ring.tail, &lsn);
+	struct fanout_replica *replica;
+
+	rlist_foreach_entry(replica, &fanout_replicas, link) {
+		if (replica->lsn_read < sizeof(replica->lsn) ||
+		    replica->fallback_lsn != 0 || replica->row != ring.tail)
+			continue;
+		if (replica->pos > replica->row) {
+			/* Finish the row, the relay starts with the next one. */
+			fanout_replica_set_rest(replica, replica->pos,
+						end - replica->pos);
+			replica->fallback_lsn = lsn + 1;
+		} else {
+			replica->fallback_lsn = lsn;
+		}
+	}
+	ring.tail = end;
+	ring.evicted_lsn = lsn;
+}
+
+/** The row handler of the fan-out relay: append a row to the ring. */
+static int
+fanout_ring_append(void *param __attribute__((unused)), struct tbuf *t)
+{
+	i64 lsn = header_v11(t)->lsn;
+
+	while (ring.tail < ring.head &&
+	       ring.head + t->size - ring.tail > FANOUT_RING_SIZE)
+		fanout_ring_evict();
+
+	if (t->size > FANOUT_RING_SIZE) {
+		/* Doesn't fit at all: nobody is sent it from the ring. */
+		struct fanout_replica *replica;
+		rlist_foreach_entry(replica, &fanout_replicas, link) {
+			if (replica->lsn_read == sizeof(replica->lsn) &&
+			    replica->fallback_lsn == 0)
+				replica->fallback_lsn = lsn;
+		}
+		ring.evicted_lsn = ring.lsn = lsn;
+		return 0;
+	}
+	fanout_ring_write(ring.head, t->data, t->size);
+	ring.head += t->size;
+	ring.lsn = lsn;
+	return 0;
+}
+
+/**
+ * A replica which asks for a compressed stream, the snapshot or
+ * the rows of some spaces only is served by a relay of its own.
+ */
+static bool
+fanout_replica_is_plain(struct fanout_replica *replica)
+{
+	/* Heartbeats and confirmations are handled here too. */
+	return (replica->lsn & (REPLICATION_LZF_FLAG |
+				REPLICATION_JOIN_FLAG |
+				REPLICATION_SPACES_FLAG)) == 0;
+}
+
+/** Start sending from the row with the LSN, if the ring has it. */
+static bool
+fanout_replica_seek(struct fanout_replica *replica, i64 lsn)
+{
+	if (lsn <= ring.evicted_lsn || lsn > ring.lsn + 1)
+		return false;
+	u64 row = ring.tail;
+	i64 row_lsn;
+	while (row < ring.head) {
+		u64 end = fanout_row_end(row, &row_lsn);
+		if (row_lsn >= lsn)
+			break;
+		row = end;
+	}
+	replica->row = replica->pos = row;
+	return true;
+}
+
+/** What the catch-up fiber of a replica writes with. */
+struct fanout_catchup {
+	struct fanout_replica *replica;
+	struct ev_io coio;
+};
+
+static void
+fanout_catchup_write_wal(void *ctx, struct iovec *iov, int iovcnt)
+{
+	struct fanout_catchup *catchup = ctx;
+	struct fanout_replica *replica = catchup->replica;
+
+	if (replica->is_dropped)
+		tnt_raise(SystemError, :"the replica is gone");
+	replica->stat->bytes += coio_writev(&catchup->coio, iov, iovcnt, 0);
+	replica->last_send = ev_now();
+}
+
+/**
+ * The fiber of a replica which needs rows the ring doesn't
+ * have: send them from the WAL files, sharing the event loop
+ * with all other replicas, and go back to the ring once it has
+ * the next row.
+ */
+static void
+fanout_replica_catchup(va_list ap)
+{
+	struct fanout_catchup catchup;
+	catchup.replica = va_arg(ap, struct fanout_replica *);
+	struct fanout_replica *replica = catchup.replica;
+	i64 lsn = replica->fallback_lsn;
+	bool error_said = false;
+
+	coio_init(&catchup.coio, replica->sock);
+	say_info("sending rows from lsn %" PRIi64 " from files", lsn);
+	@try {
+		while (! replica->is_dropped &&
+		       ! fanout_replica_seek(replica, lsn)) {
+			i64 next = relay_send_wals(recovery_state->wal_dir,
+						   lsn, false,
+						   fanout_catchup_write_wal,
+						   &catchup, replica->stat,
+						   NULL);
+			fiber_gc();
+			if (next != lsn) {
+				lsn = next;
+				continue;
+			}
+			/* The ring reader is yet to read the rows. */
+			if (lsn <= ring.evicted_lsn && ! error_said) {
+				say_error("can't find WAL containing record "
+					  "with lsn: %" PRIi64, lsn);
+				error_said = true;
+			}
+			fiber_sleep(0.1);
+		}
+	} @catch (tnt_Exception *e) {
+		if (! replica->is_dropped)
+			[e log];
+		replica->is_dropped = true;
+	}
+	replica->catchup = NULL;
+	if (replica->is_dropped) {
+		fanout_replica_drop(replica);
+		return;
+	}
+	say_info("sending rows from lsn %" PRIi64 " from memory", lsn);
+	replica->fallback_lsn = 0;
+}
+
+/** The ring doesn't have the rows the replica needs. */
+static void
+fanout_replica_fallback(struct fanout_replica *replica)
+{
+	if (replica->catchup != NULL)
+		return;
+	if (fanout_replica_is_plain(replica)) {
+		@try {
+			replica->catchup = fiber_create("relay/catchup",
+							fanout_replica_catchup);
+			fiber_call(replica->catchup, replica);
+			return;
+		} @catch (tnt_Exception *e) {
+			/* Too many fibers, fork. */
+			replica->catchup = NULL;
+		}
+	}
+	fanout_replica_handoff(replica);
+}
+
+/**
+ * Send as much as the socket takes: the rest of the previous
+ * row, then the rows in the ring.
+ */
+static void
+fanout_replica_send(struct fanout_replica *replica)
+{
+	for (;;) {
+		struct iovec iov[3];
+		int iovcnt = 0;
+
+		if (replica->rest_sent < replica->rest_size) {
+			iov[iovcnt].iov_base = replica->rest + replica->rest_sent;
+			iov[iovcnt++].iov_len = replica->rest_size -
+				replica->rest_sent;
+		}
+		if (replica->fallback_lsn == 0 && replica->pos < ring.head) {
+			size_t pos = replica->pos % FANOUT_RING_SIZE;
+			size_t size = ring.head - replica->pos;
+			size_t part = MIN(size, FANOUT_RING_SIZE - pos);
+			iov[iovcnt].iov_base = ring.buf + pos;
+			iov[iovcnt++].iov_len = part;
+			if (part < size) {
+				iov[iovcnt].iov_base = ring.buf;
+				iov[iovcnt++].iov_len = size - part;
+			}
+		}
+		if (iovcnt == 0)
+			break;
+
+		ssize_t nwr = writev(replica->sock, iov, iovcnt);
+		if (nwr < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				ev_io_start(&replica->out);
+				return;
+			}
+			if (errno != EPIPE && errno != ECONNRESET)
+				say_syserror("writev");
+			say_info("the client has closed its replication socket");
+			fanout_replica_drop(replica);
+			return;
+		}
+		size_t rest = MIN((size_t) nwr,
+				  replica->rest_size - replica->rest_sent);
+		replica->rest_sent += rest;
+		replica->pos += nwr - rest;
+		replica->stat->bytes += nwr;
+		replica->last_send = ev_now();
+		while (replica->row < ring.head) {
+			i64 lsn;
+			u64 end = fanout_row_end(replica->row, &lsn);
+			if (end > replica->pos)
+				break;
+			replica->row = end;
+			replica->stat->rows++;
+			replica->stat->lsn = lsn;
+		}
+	}
+	ev_io_stop(&replica->out);
+	if (replica->fallback_lsn != 0)
+		fanout_replica_fallback(replica);
+}
+
+static void
+fanout_replica_out_cb(struct ev_io *w, int revents __attribute__((unused)))
+{
+	fanout_replica_send(w->data);
+}
+
+/** Start following the write ahead log with the first replica. */
+static void
+fanout_start_reader(i64 lsn)
+{
+	ring.buf = malloc(FANOUT_RING_SIZE);
+	if (ring.buf == NULL)
+		panic("can't allocate the fan-out ring");
+	ring.lsn = ring.evicted_lsn = lsn - 1;
+
+	recovery_init(cfg.snap_dir, cfg.wal_dir,
+		      fanout_ring_append, NULL,
+		      INT32_MAX, RECOVER_READONLY);
+	if (cfg.wal_stripe_dirs != NULL)
+		recovery_setup_wal_stripes(recovery_state, cfg.wal_stripe_dirs);
+	recovery_state->lsn = recovery_state->confirmed_lsn = lsn - 1;
+	recover_existing_wals(recovery_state);
+	recovery_follow_local(recovery_state, 0.1);
+}
+
+/** The handshake is read: find the requested row in the ring. */
+static void
+fanout_replica_subscribe(struct fanout_replica *replica)
+{
+	i64 lsn = replica->lsn & ~REPLICATION_LSN_FLAGS;
+	bool is_plain = fanout_replica_is_plain(replica);
+	say_info("starting replication from lsn: %"PRIi64, lsn);
+
+	if (ring.buf == NULL && is_plain)
+		fanout_start_reader(lsn);
+
+	replica->stat = relay_stat_acquire(replica->sock, lsn - 1,
+					   &replica->unlisted);
+	u32 version = replication_version(replica->lsn);
+	memcpy(fanout_replica_alloc_rest(replica, sizeof(version)),
+	       &version, sizeof(version));
+
+	if (! is_plain) {
+		/*
+		 * The ring has plain rows from the WAL: a relay
+		 * of its own compresses the stream, sends the
+		 * snapshot or filters the rows, the flags tell it
+		 * to. Whatever follows the LSN is for the relay.
+		 */
+		ev_io_stop(&replica->in);
+		replica->fallback_lsn = replica->lsn;
+	} else if (! fanout_replica_seek(replica, lsn)) {
+		/* The ring doesn't have it, or the LSN is yet to come. */
+		replica->fallback_lsn = lsn;
+	}
+	fanout_replica_send(replica);
+}
+
+/**
+ * Read the requested LSN, and then the confirmations of the
+ * replica, if it sends them, till it closes the socket.
+ */
+static void
+fanout_replica_in_cb(struct ev_io *w, int revents __attribute__((unused)))
+{
+	struct fanout_replica *replica = w->data;
+	ssize_t r;
+
+	if (replica->lsn_read < sizeof(replica->lsn)) {
+		r = read(replica->sock,
+			 (char *) &replica->lsn + replica->lsn_read,
+			 sizeof(replica->lsn) - replica->lsn_read);
+		if (r > 0) {
+			replica->lsn_read += r;
+			if (replica->lsn_read == sizeof(replica->lsn))
+				fanout_replica_subscribe(replica);
+			return;
+		}
+	} else if (replica->lsn & REPLICATION_ACK_FLAG) {
+		r = relay_recv_ack(replica->sock, &replica->ack,
+				   replica->stat);
+		if (r > 0)
+			return;
+	} else {
+		u8 data;
+		r = recv(replica->sock, &data, sizeof(data), 0);
+	}
+	if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+		      errno == EINTR))
+		return;
+	if (r == 0 || (r < 0 && errno == ECONNRESET))
+		say_info("the client has closed its replication socket");
+	else if (r < 0)
+		say_syserror("recv");
+	else
+		say_error("unexpected data on the replication socket");
+	fanout_replica_drop(replica);
+}
+
+/** Accept a replica passed by the spawner. */
+static void
+fanout_accept(struct ev_io *w, int revents __attribute__((unused)))
+{
+	int cmd_code = 0;
+	int client_sock;
+
+	ssize_t msglen = replication_recv_fd(w->fd, &cmd_code,
+					     sizeof(cmd_code), &client_sock);
+	if (msglen == 0) {
+		say_info("Exiting: spawner shutdown");
+		exit(EXIT_SUCCESS);
+	}
+	if (msglen < 0) {
+		if (errno != EINTR && errno != EAGAIN)
+			say_syserror("recvmsg");
+		return;
+	}
+	struct fanout_replica *replica = calloc(1, sizeof(*replica));
+	int flags = fcntl(client_sock, F_GETFL, 0);
+	if (replica == NULL || flags < 0 ||
+	    fcntl(client_sock, F_SETFL, flags | O_NONBLOCK) < 0) {
+		say_syserror("can't accept a replica");
+		free(replica);
+		close(client_sock);
+		return;
+	}
+	replica->sock = client_sock;
+	ev_io_init(&replica->in, fanout_replica_in_cb, client_sock, EV_READ);
+	ev_io_init(&replica->out, fanout_replica_out_cb, client_sock, EV_WRITE);
+	replica->in.data = replica->out.data = replica;
+	rlist_add_tail_entry(&fanout_replicas, replica, link);
+	ev_io_start(&replica->in);
+}
+
+/**
+ * A libev callback invoked before the relay blocks waiting for
+ * events: send the rows read by now to all replicas.
+ */
+static void
+fanout_prepare(struct ev_prepare *w __attribute__((unused)),
+	       int revents __attribute__((unused)))
+{
+	struct fanout_replica *replica, *next;
+	replica = rlist_first_entry(&fanout_replicas,
+				    struct fanout_replica, link);
+	for (; &replica->link != &fanout_replicas; replica = next) {
+		next = rlist_next_entry(replica, link);
+		if (replica->lsn_read == sizeof(replica->lsn) &&
+		    replica->catchup == NULL &&
+		    !ev_is_active(&replica->out))
+			fanout_replica_send(replica);
+	}
+}
+
+/**
+ * A libev callback invoked every RELAY_HEARTBEAT_INTERVAL:
+ * update the send queues, and send a heartbeat to the replicas
+ * which have got all rows and have been idle.
+ */
+static void
+fanout_heartbeat(struct ev_timer *w __attribute__((unused)),
+		 int revents __attribute__((unused)))
+{
+	struct fanout_replica *replica, *next;
+	replica = rlist_first_entry(&fanout_replicas,
+				    struct fanout_replica, link);
+	for (; &replica->link != &fanout_replicas; replica = next) {
+		next = rlist_next_entry(replica, link);
+		if (replica->lsn_read < sizeof(replica->lsn) ||
+		    replica->fallback_lsn != 0)
+			continue;
+		replica->stat->send_queue = ring.head - replica->pos +
+			replica->rest_size - replica->rest_sent +
+			relay_socket_queue(replica->sock);
+		if (! (replica->lsn & REPLICATION_HEARTBEAT_FLAG) ||
+		    replica->pos < ring.head ||
+		    replica->rest_sent < replica->rest_size ||
+		    ev_now() - replica->last_send < RELAY_HEARTBEAT_INTERVAL)
+			continue;
+		struct row_v11 row;
+		struct tbuf t = replication_tag_row(&row, replica->stat->lsn,
+						    HEARTBEAT);
+		memcpy(fanout_replica_alloc_rest(replica, t.size),
+		       t.data, t.size);
+		fanout_replica_send(replica);
+	}
+}
+
+static void
+fanout_loop(int sock)
+{
+	char name[FIBER_NAME_MAXLEN];
+	snprintf(name, sizeof(name), "relay/fanout");
+	replication_relay_init(name);
+
+	fanout_sock = sock;
+	rlist_init(&fanout_replicas);
+
+	/* init libev events handlers */
+	ev_default_loop(0);
+
+	struct ev_io accept_ev;
+	ev_io_init(&accept_ev, fanout_accept, sock, EV_READ);
+	ev_io_start(&accept_ev);
+
+	struct ev_prepare flush_ev;
+	ev_prepare_init(&flush_ev, fanout_prepare);
+	ev_prepare_start(&flush_ev);
+
+	struct ev_timer heartbeat_ev;
+	ev_timer_init(&heartbeat_ev, fanout_heartbeat,
+		      RELAY_HEARTBEAT_INTERVAL, RELAY_HEARTBEAT_INTERVAL);
+	ev_timer_start(&heartbeat_ev);
+
+	ev_loop(0);
+
+	say_crit("exiting the fan-out relay loop");
+	exit(EXIT_SUCCESS);
+}
@@ -51,6 +51,7 @@
 #include <iproto.h>
 #include <latch.h>
 #include <recovery.h>
+#include <log_io.h>
 #include <crc32.h>
 #include <palloc.h>
 #include <salloc.h>
@@ -90,6 +91,15 @@ core_check_config(struct tarantool_cfg *conf)
 		out_warning(0, "wal_mode %s is not recognized", conf->wal_mode);
 		return -1;
 	}
+	if (conf->snap_parts < 1 || conf->snap_parts > LOG_PARTS_MAX) {
+		out_warning(0, "snap_parts must be between 1 and %d",
+			    LOG_PARTS_MAX);
+		return -1;
+	}
+	if (conf->deltas_per_snap < 0) {
+		out_warning(0, "deltas_per_snap must not be negative");
+		return -1;
+	}
 	return 0;
 }
 
@@ -312,12 +322,108 @@ tarantool_uptime(void)
 	return ev_now() - start_time;
 }
 
+/**
+ * A snapshot saved by a thread from a read view of the data,
+ * used instead of a forked child when cfg.snap_fork is false.
+ */
+static struct {
+	pthread_t thread;
+	/** Signalled by the thread when the snapshot is saved. */
+	ev_async done;
+	/** The fiber of 'save snapshot', if any, waiting for us. */
+	struct fiber *waiter;
+	i64 lsn;
+	/** The base of a delta snapshot, 0 for a full one. */
+	i64 delta_base;
+	/** 0 or errno of the failure. */
+	int status;
+	bool is_running;
+} snapshot_thread;
+
+static void *
+snapshot_thread_f(void *arg __attribute__((unused)))
+{
+	int rc;
+	if (snapshot_thread.delta_base > 0)
+		rc = snapshot_save_delta(recovery_state,
+					 snapshot_thread.delta_base,
+					 snapshot_thread.lsn, mod_snapshot);
+	else
+		rc = snapshot_save(recovery_state, snapshot_thread.lsn,
+				   cfg.snap_parts, mod_snapshot);
+	if (rc != 0)
+		snapshot_thread.status = errno ? errno : EIO;
+	else
+		snapshot_thread.status = 0;
+	ev_async_send(&snapshot_thread.done);
+	return NULL;
+}
+
+static void
+snapshot_thread_done(struct ev_async *watcher __attribute__((unused)),
+		     int events __attribute__((unused)))
+{
+	if (! snapshot_thread.is_running)
+		return;
+	tt_pthread_join(snapshot_thread.thread, NULL);
+	snapshot_thread.is_running = false;
+	mod_snapshot_release();
+	if (snapshot_thread.status != 0)
+		say_error("failed to save snapshot: %s",
+			  strerror(snapshot_thread.status));
+
+	struct fiber *waiter = snapshot_thread.waiter;
+	if (waiter != NULL) {
+		snapshot_thread.waiter = NULL;
+		fiber_call(waiter);
+	}
+}
+
+/**
+ * Save a snapshot without fork(): the data is frozen in a read
+ * view, which costs a pointer per tuple instead of copying the
+ * page tables and then every page changed while the child runs.
+ */
+static int
+snapshot_in_thread(void *ev)
+{
+	static bool is_initialized = false;
+	if (! is_initialized) {
+		ev_async_init(&snapshot_thread.done, snapshot_thread_done);
+		ev_async_start(&snapshot_thread.done);
+		is_initialized = true;
+	}
+
+	snapshot_thread.delta_base = mod_snapshot_delta_base();
+	mod_snapshot_freeze(snapshot_thread.delta_base);
+	snapshot_thread.lsn = recovery_state->confirmed_lsn;
+	snapshot_thread.status = 0;
+	int e = tt_pthread_create(&snapshot_thread.thread, NULL,
+				  snapshot_thread_f, NULL);
+	if (e != 0) {
+		mod_snapshot_release();
+		return e;
+	}
+	snapshot_thread.is_running = true;
+	/* Nobody is waiting for the status of a signal. */
+	if (ev != NULL)
+		return 0;
+
+	snapshot_thread.waiter = fiber;
+	fiber_yield();
+	return snapshot_thread.status;
+}
+
 int
 snapshot(void *ev, int events __attribute__((unused)))
 {
-	if (snapshot_pid)
+	if (snapshot_pid || snapshot_thread.is_running)
 		return EINPROGRESS;
 
+	if (! cfg.snap_fork)
+		return snapshot_in_thread(ev);
+
+	i64 delta_base = mod_snapshot_delta_base();
 	pid_t p = fork();
 	if (p < 0) {
 		say_syserror("fork");
@@ -354,7 +460,25 @@ snapshot(void *ev, int events __attribute__((unused)))
 	 * parent stdio buffers at exit().
 	 */
 	close_all_xcpt(1, sayfd);
-	snapshot_save(recovery_state, mod_snapshot);
+	if (delta_base > 0) {
+		mod_snapshot_freeze(delta_base);
+		if (snapshot_save_delta(recovery_state, delta_base,
+					recovery_state->confirmed_lsn,
+					mod_snapshot) != 0)
+			panic_status(errno, "failed to save snapshot");
+		exit(EXIT_SUCCESS);
+	}
+	/*
+	 * Parts are written by threads, which need a read
+	 * view to split the data between them. It costs
+	 * the child a pointer per tuple and nothing to the
+	 * parent.
+	 */
+	if (cfg.snap_parts > 1)
+		mod_snapshot_freeze(0);
+	if (snapshot_save(recovery_state, recovery_state->confirmed_lsn,
+			  cfg.snap_parts, mod_snapshot) != 0)
+		panic_status(errno, "failed to save snapshot");
 
 	exit(EXIT_SUCCESS);
 	return 0;
@@ -819,7 +943,9 @@ main(int argc, char **argv)
 		initialize_minimal();
 		mod_init();
 		set_lsn(recovery_state, 1);
-		snapshot_save(recovery_state, mod_snapshot);
+		if (snapshot_save(recovery_state, recovery_state->confirmed_lsn,
+				  1, mod_snapshot) != 0)
+			panic_status(errno, "failed to save snapshot");
 		exit(EXIT_SUCCESS);
 	}
 
@@ -108,7 +108,8 @@ class Server(object):
         for re in self.re_vardir_cleanup:
             trash += glob.glob(os.path.join(self.vardir, re))
 
-        for filename in trash:
+        # A file may match several patterns.
+        for filename in set(trash):
             os.remove(filename)
 
         if full:
@@ -36,6 +36,8 @@ class TarantoolServer(Server):
         self.default_init_lua_name = "init.lua"
         # append additional cleanup patterns
         self.re_vardir_cleanup += ['*.snap',
+                                   '*.snap.[0-9]*',
+                                   '*.delta',
                                    '*.xlog',
                                    '*.inprogress',
                                    '*.cfg',
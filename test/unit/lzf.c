@@ -0,0 +1,85 @@
+#include <third_party/lzf/lzf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+
+#define PLAN		14
+
+static lzf_state state;
+
+/** Compress and decompress, return the compressed size. */
+static unsigned
+roundtrip(const char *data, unsigned len, int *is_equal)
+{
+	unsigned max = LZF_MAX_COMPRESSED_SIZE(len);
+	char *z = malloc(max);
+	char *out = malloc(len + 1);
+	unsigned zlen = lzf_compress(data, len, z, max, state);
+	*is_equal = zlen > 0 &&
+		lzf_decompress(z, zlen, out, len) == len &&
+		memcmp(data, out, len) == 0;
+	free(z);
+	free(out);
+	return zlen;
+}
+
+int
+main(void)
+{
+	enum { SIZE = 256 * 1024 };
+	char *text = malloc(SIZE);
+	char *noise = malloc(SIZE);
+	char *z = malloc(LZF_MAX_COMPRESSED_SIZE(SIZE));
+	char *out = malloc(SIZE);
+	int is_equal;
+	unsigned zlen;
+
+	plan(PLAN);
+
+	for (int i = 0; i < SIZE; i++)
+		text[i] = "tarantool: a tuple storage. "[i % 28] + i / 1000 % 3;
+	srand(1);
+	for (int i = 0; i < SIZE; i++)
+		noise[i] = rand();
+
+	is(lzf_compress(text, 0, z, 16, state), 0, "empty input");
+
+	zlen = roundtrip("a", 1, &is_equal);
+	ok(is_equal, "one byte");
+
+	zlen = roundtrip("abcabcabcabcabcabcabcabcabcabcabcabc", 36, &is_equal);
+	ok(is_equal, "short repeated string");
+	ok(zlen < 36, "short repeated string is compressed");
+
+	zlen = roundtrip(text, SIZE, &is_equal);
+	ok(is_equal, "text");
+	ok(zlen < SIZE / 4, "text is compressed");
+
+	memset(out, 'x', SIZE);
+	zlen = roundtrip(out, SIZE, &is_equal);
+	ok(is_equal, "long run of a single byte");
+	ok(zlen < SIZE / 64, "long run is compressed");
+
+	zlen = roundtrip(noise, SIZE, &is_equal);
+	ok(is_equal, "incompressible data");
+	ok(zlen <= LZF_MAX_COMPRESSED_SIZE(SIZE), "worst case size");
+	is(lzf_compress(noise, SIZE, z, SIZE, state), 0,
+	   "no room for incompressible data");
+
+	zlen = lzf_compress(text, SIZE, z, LZF_MAX_COMPRESSED_SIZE(SIZE),
+			    state);
+	is(lzf_decompress(z, zlen, out, SIZE - 1), 0,
+	   "no room for the decompressed data");
+	is(lzf_decompress(z, zlen - 1, out, SIZE) == SIZE, 0,
+	   "truncated input");
+	z[1] = 0xff;
+	ok(lzf_decompress(z, zlen, out, SIZE) != SIZE ||
+	   memcmp(out, text, SIZE) != 0, "corrupt input");
+
+	free(text);
+	free(noise);
+	free(z);
+	free(out);
+	return check_plan();
+}
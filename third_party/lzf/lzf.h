@@ -0,0 +1,80 @@
+#ifndef TARANTOOL_LZF_H_INCLUDED
+#define TARANTOOL_LZF_H_INCLUDED
+/*
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * A codec for the LZF format of liblzf by Marc Lehmann: a fast
+ * LZ77 variant with an 8KB window and no entropy coding. The
+ * stream is a sequence of chunks, each starting with a control
+ * byte:
+ *
+ *   000LLLLL <L+1 literal bytes>
+ *   LLLooooo oooooooo           back reference, L in 1..6
+ *   111ooooo LLLLLLLL oooooooo  back reference, L + 7
+ *
+ * A back reference copies L+2 bytes starting o+1 bytes back
+ * from the current output position.
+ */
+
+#include <stdint.h>
+
+enum { LZF_HLOG = 14 };
+
+/** Scratch space of the compressor, not shared between threads. */
+typedef const uint8_t *lzf_state[1 << LZF_HLOG];
+
+/**
+ * The worst case of compressed size: incompressible data grows
+ * by a control byte per 32 bytes.
+ */
+#define LZF_MAX_COMPRESSED_SIZE(len) ((len) + (len) / 32 + 1)
+
+/**
+ * Compress in_len bytes at in_data into out_data.
+ *
+ * @return the size of the compressed data, or 0 if it doesn't
+ *         fit into out_len bytes or in_len is 0.
+ */
+unsigned
+lzf_compress(const void *in_data, unsigned in_len,
+	     void *out_data, unsigned out_len, lzf_state state);
+
+/**
+ * Decompress in_len bytes at in_data into out_data.
+ *
+ * @return the size of the decompressed data, or 0 if the input
+ *         is corrupt or the output doesn't fit into out_len
+ *         bytes.
+ */
+unsigned
+lzf_decompress(const void *in_data, unsigned in_len,
+	       void *out_data, unsigned out_len);
+
+#endif /* TARANTOOL_LZF_H_INCLUDED */
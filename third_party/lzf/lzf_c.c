@@ -0,0 +1,136 @@
+/*
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include "lzf.h"
+
+#include <string.h>
+
+enum {
+	/** The longest back reference: 7 + 255 + 2. */
+	LZF_MAX_REF = 264,
+	/** The farthest back reference. */
+	LZF_MAX_OFF = 1 << 13,
+	/** The longest literal run. */
+	LZF_MAX_LIT = 1 << 5,
+};
+
+static inline unsigned
+lzf_hash(const uint8_t *p)
+{
+	uint32_t v = (uint32_t) p[0] << 16 | (uint32_t) p[1] << 8 | p[2];
+	return (v * 2654435761U) >> (32 - LZF_HLOG);
+}
+
+unsigned
+lzf_compress(const void *in_data, unsigned in_len,
+	     void *out_data, unsigned out_len, lzf_state htab)
+{
+	const uint8_t *ip = in_data;
+	const uint8_t *in_end = ip + in_len;
+	uint8_t *out = out_data;
+	uint8_t *op = out;
+	uint8_t *out_end = out + out_len;
+	/* Where the control byte of the current literal run goes. */
+	uint8_t *lit_ctrl;
+	unsigned lit = 0;
+
+	if (in_len == 0 || out_len == 0)
+		return 0;
+	memset(htab, 0, sizeof(lzf_state));
+	lit_ctrl = op++;
+
+	while (ip + 2 < in_end) {
+		unsigned h = lzf_hash(ip);
+		const uint8_t *ref = htab[h];
+		htab[h] = ip;
+
+		if (ref != NULL && ip - ref <= (long) LZF_MAX_OFF &&
+		    ref[0] == ip[0] && ref[1] == ip[1] && ref[2] == ip[2]) {
+			unsigned off = ip - ref - 1;
+			unsigned max_len = in_end - ip;
+			unsigned len = 3;
+			if (max_len > LZF_MAX_REF)
+				max_len = LZF_MAX_REF;
+			while (len < max_len && ref[len] == ip[len])
+				len++;
+
+			/* Close the literal run, or drop its empty slot. */
+			if (lit > 0)
+				*lit_ctrl = lit - 1;
+			else
+				op--;
+			if (op + 3 + 1 > out_end)
+				return 0;
+			unsigned l = len - 2;
+			if (l < 7) {
+				*op++ = (l << 5) | (off >> 8);
+			} else {
+				*op++ = (7 << 5) | (off >> 8);
+				*op++ = l - 7;
+			}
+			*op++ = off & 0xff;
+
+			/* Index the positions inside the match, too. */
+			const uint8_t *end = ip + len;
+			for (ip++; ip < end && ip + 2 < in_end; ip++)
+				htab[lzf_hash(ip)] = ip;
+			ip = end;
+
+			lit = 0;
+			lit_ctrl = op++;
+			continue;
+		}
+		if (op >= out_end)
+			return 0;
+		*op++ = *ip++;
+		if (++lit == LZF_MAX_LIT) {
+			*lit_ctrl = lit - 1;
+			lit = 0;
+			if (op >= out_end)
+				return 0;
+			lit_ctrl = op++;
+		}
+	}
+	while (ip < in_end) {
+		if (op >= out_end)
+			return 0;
+		*op++ = *ip++;
+		if (++lit == LZF_MAX_LIT) {
+			*lit_ctrl = lit - 1;
+			lit = 0;
+			if (op >= out_end)
+				return 0;
+			lit_ctrl = op++;
+		}
+	}
+	if (lit > 0)
+		*lit_ctrl = lit - 1;
+	else
+		op--;
+	return op - out;
+}
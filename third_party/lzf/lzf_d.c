@@ -0,0 +1,77 @@
+/*
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include "lzf.h"
+
+#include <string.h>
+
+unsigned
+lzf_decompress(const void *in_data, unsigned in_len,
+	       void *out_data, unsigned out_len)
+{
+	const uint8_t *ip = in_data;
+	const uint8_t *in_end = ip + in_len;
+	uint8_t *out = out_data;
+	uint8_t *op = out;
+	uint8_t *out_end = out + out_len;
+
+	while (ip < in_end) {
+		unsigned ctrl = *ip++;
+
+		if (ctrl < (1 << 5)) {
+			/* A literal run. */
+			unsigned len = ctrl + 1;
+			if ((unsigned) (in_end - ip) < len ||
+			    (unsigned) (out_end - op) < len)
+				return 0;
+			memcpy(op, ip, len);
+			op += len;
+			ip += len;
+			continue;
+		}
+		/* A back reference. */
+		unsigned len = ctrl >> 5;
+		if (len == 7) {
+			if (ip >= in_end)
+				return 0;
+			len += *ip++;
+		}
+		if (ip >= in_end)
+			return 0;
+		unsigned off = ((ctrl & 0x1f) << 8 | *ip++) + 1;
+		len += 2;
+		if ((unsigned) (op - out) < off ||
+		    (unsigned) (out_end - op) < len)
+			return 0;
+		/* The source and the destination may overlap. */
+		const uint8_t *ref = op - off;
+		while (len--)
+			*op++ = *ref++;
+	}
+	return op - out;
+}